@@ -1,11 +1,11 @@
 #include <stdio.h>
+#include <stdbool.h>
 #include <string.h>
 #include <errno.h>
 #include <arpa/inet.h>
 
 #include "addr.h"
 
-#define MAC_DELIM ":"
 #define LAST_MAC_COLON_POS 14
 
 static int const addr_type_sizes[MAX_ADDR_TYPE] = {
@@ -14,13 +14,22 @@ static int const addr_type_sizes[MAX_ADDR_TYPE] = {
 	IP6_LEN,
 };
 
-static addr_type detect_addr_type(const char *s)
+// Hex digit values, or 0xff for characters that are not hex digits.
+static const uint8_t hex_vals[256] = {
+	[0 ... 255] = 0xff,
+	['0'] = 0, ['1'] = 1, ['2'] = 2, ['3'] = 3, ['4'] = 4,
+	['5'] = 5, ['6'] = 6, ['7'] = 7, ['8'] = 8, ['9'] = 9,
+	['a'] = 10, ['b'] = 11, ['c'] = 12, ['d'] = 13, ['e'] = 14, ['f'] = 15,
+	['A'] = 10, ['B'] = 11, ['C'] = 12, ['D'] = 13, ['E'] = 14, ['F'] = 15,
+};
+
+// Determines the address type from the first '.' or ':' that can't be part
+// of a MAC address. Only used when the MAC fast path fails.
+static addr_type detect_addr_type(const char *s, const size_t len)
 {
 	addr_type t = -1;
-	int len;
 	int i;
 
-	len = strlen(s);
 	if (len == MAC_STRLEN) {
 		t = MAC;
 	}
@@ -40,60 +49,128 @@ static addr_type detect_addr_type(const char *s)
 	return t;
 }
 
-static error_t *parse_mac(const char *s, mac_addr mac)
+// Decodes a MAC address (s must be MAC_STRLEN long) without branching on
+// each digit, returning false if it's invalid.
+static bool decode_mac(const char *s, mac_addr mac)
 {
-	char ts[MAC_STRLEN+1];
-	char *t, *p, *ss;
-	int i, r;
-	char x;
+	uint8_t bad = 0;
+	uint8_t hi, lo;
+	int i;
 
-	if (strlen(s) != MAC_STRLEN) {
-		return error(E_INVALID_MAC);
+	for (i = 0; i < MAC_LEN; i++) {
+		hi = hex_vals[(uint8_t) s[3*i]];
+		lo = hex_vals[(uint8_t) s[3*i+1]];
+		bad |= (hi | lo) & 0xf0;
+		mac[i] = (hi << 4) | lo;
 	}
-	strncpy(ts, s, MAC_STRLEN+1);
-	ss = ts;
-	for (i = 0; i < MAC_LEN; i++, ss = NULL) {
-		t = strtok_r(ss, MAC_DELIM, &p);
-		r = sscanf(t, "%"SCNx8 "%c", &mac[i], &x);
-		if (r != 1) {
-			return error(E_INVALID_MAC);
-		}
-	}
-	if (strtok_r(NULL, MAC_DELIM, &p)) {
-		return error(E_INVALID_MAC);
+	for (i = 2; i < MAC_STRLEN; i += 3) {
+		bad |= s[i] ^ ':';
 	}
 
-	return NULL;
+	return !bad;
 }
 
-static void mac_str(const mac_addr mac, char *s)
+// Decodes a dotted quad IPv4 address (no leading zeros), returning false if
+// it's invalid.
+static bool decode_ip4(const char *s, const char *end, ip4_addr ip4)
 {
-	snprintf(s, MAC_STRLEN+1, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
-		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
-}
+	unsigned int v, d;
+	int i, n;
 
-static error_t *parse_ip4(const char *s, ip4_addr ip4)
-{
-	if (inet_pton(AF_INET, s, ip4) == 0) {
-		return errorf(E_INVALID_IP4_ADDR, "%s", s);
+	for (i = 0; i < IP4_LEN; i++) {
+		if (i > 0 && (s == end || *s++ != '.')) {
+			return false;
+		}
+		for (v = 0, n = 0; s < end && (d = (uint8_t) *s - '0') <= 9; s++, n++) {
+			if ((n > 0 && v == 0) || (v = v*10 + d) > UINT8_MAX) {
+				return false;
+			}
+		}
+		if (n == 0) {
+			return false;
+		}
+		ip4[i] = v;
 	}
 
-	return NULL;
+	return s == end;
 }
 
-static error_t *ip4_str(const ip4_addr ip4, char *s)
+// Decodes an IPv6 address in any RFC 4291 text form, including a trailing
+// dotted quad, returning false if it's invalid.
+static bool decode_ip6(const char *s, const char *end, ip6_addr ip6)
 {
-	if (inet_ntop(AF_INET, ip4, s, MAX_ADDR_STRLEN+1) == NULL) {
-		return errorf(E_IP4_STR_ERROR, "%s", strerror(errno));
+	uint8_t *p = ip6, *ep = ip6 + IP6_LEN, *gap = NULL;
+	const char *tok = s;
+	unsigned int v = 0;
+	int n = 0;
+	uint8_t d;
+	size_t l;
+
+	memset(ip6, 0, IP6_LEN);
+	if (s < end && *s == ':' && (++s == end || *s != ':')) {
+		return false;
+	}
+	while (s < end) {
+		if ((d = hex_vals[(uint8_t) *s]) != 0xff) {
+			if (n++ == 4) {
+				return false;
+			}
+			v = (v << 4) | d;
+			s++;
+		} else if (*s == ':') {
+			tok = ++s;
+			if (n == 0) {
+				if (gap) {
+					return false;
+				}
+				gap = p;
+				continue;
+			}
+			if (s == end || p + 2 > ep) {
+				return false;
+			}
+			*p++ = v >> 8;
+			*p++ = v;
+			v = 0;
+			n = 0;
+		} else if (*s == '.' && p + IP4_LEN <= ep && decode_ip4(tok, end, p)) {
+			p += IP4_LEN;
+			n = 0;
+			break;
+		} else {
+			return false;
+		}
+	}
+	if (n > 0) {
+		if (p + 2 > ep) {
+			return false;
+		}
+		*p++ = v >> 8;
+		*p++ = v;
+	}
+	if (gap) {
+		if (p == ep) {
+			return false;
+		}
+		l = p - gap;
+		memmove(ep - l, gap, l);
+		memset(gap, 0, ep - l - gap);
+		p = ep;
 	}
 
-	return NULL;
+	return p == ep;
+}
+
+static void mac_str(const mac_addr mac, char *s)
+{
+	snprintf(s, MAC_STRLEN+1, "%.2x:%.2x:%.2x:%.2x:%.2x:%.2x",
+		mac[0], mac[1], mac[2], mac[3], mac[4], mac[5]);
 }
 
-static error_t *parse_ip6(const char *s, ip6_addr ip6)
+static error_t *ip4_str(const ip4_addr ip4, char *s)
 {
-	if (inet_pton(AF_INET6, s, ip6) == 0) {
-		return errorf(E_INVALID_IP6_ADDR, "%s", s);
+	if (inet_ntop(AF_INET, ip4, s, MAX_ADDR_STRLEN+1) == NULL) {
+		return errorf(E_IP4_STR_ERROR, "%s", strerror(errno));
 	}
 
 	return NULL;
@@ -108,24 +185,45 @@ static error_t *ip6_str(const ip6_addr ip6, char *s)
 	return NULL;
 }
 
-error_t *parse_addr(const char *s, addr *a)
+error_t *parse_addrn(const char *s, const size_t len, addr *a)
 {
-	if ((a->type = detect_addr_type(s)) == -1) {
-		return errorf(E_UNKNOWN_ADDR_FORMAT, "%s", s);
+	const char *end = s + len;
+	const char *p;
+
+	if (len == MAC_STRLEN) {
+		if (decode_mac(s, a->val.mac)) {
+			a->type = MAC;
+			return NULL;
+		}
+		a->type = detect_addr_type(s, len);
+	} else {
+		for (p = s; p < end && *p != '.' && *p != ':'; p++);
+		a->type = (p == end ? -1 : (*p == '.' ? IP4 : IP6));
 	}
 
 	switch (a->type) {
 	case MAC:
-		return parse_mac(s, a->val.mac);
+		return error(E_INVALID_MAC);
 	case IP4:
-		return parse_ip4(s, a->val.ip4);
+		if (!decode_ip4(s, end, a->val.ip4)) {
+			return errorf(E_INVALID_IP4_ADDR, "%.*s", (int) len, s);
+		}
+		return NULL;
 	case IP6:
-		return parse_ip6(s, a->val.ip6);
+		if (!decode_ip6(s, end, a->val.ip6)) {
+			return errorf(E_INVALID_IP6_ADDR, "%.*s", (int) len, s);
+		}
+		return NULL;
 	default:
-		return errorf(E_UNKNOWN_ADDR_TYPE, "%d", a->type);
+		return errorf(E_UNKNOWN_ADDR_FORMAT, "%.*s", (int) len, s);
 	}
 }
 
+error_t *parse_addr(const char *s, addr *a)
+{
+	return parse_addrn(s, strlen(s), a);
+}
+
 char *addr_str(const addr *a, char *s)
 {
 	error_t *err;
@@ -153,6 +251,11 @@ char *addr_str(const addr *a, char *s)
 	return s;
 }
 
+int addr_len(const addr_type t)
+{
+	return addr_type_sizes[t];
+}
+
 int cmp_addr(const addr *a1, const addr *a2)
 {
 	int td;
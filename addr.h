@@ -2,6 +2,7 @@
 #define __ADDR_H
 
 #include <inttypes.h>
+#include <stddef.h>
 
 #include "error.h"
 
@@ -44,9 +45,16 @@ typedef struct {
 // Parses an address and determines its type.
 error_t *parse_addr(const char *s, addr *a);
 
+// Parses an address of len characters (not necessarily null terminated) and
+// determines its type in a single pass.
+error_t *parse_addrn(const char *s, const size_t len, addr *a);
+
 // Gets a string for an address. s should be sized MAX_ADDR_STRLEN+1.
 char *addr_str(const addr *a, char *s);
 
+// Returns the length in bytes of the value for an address type.
+int addr_len(const addr_type t);
+
 // Compares two addresses.
 int cmp_addr(const addr *a1, const addr *a2);
 
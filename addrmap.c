@@ -0,0 +1,102 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "addrmap.h"
+
+#define INITCAP_ADDR_MAP 64
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+// Returns the 64-bit FNV-1a hash of an address.
+static uint64_t hash_addr(const addr *a)
+{
+	const uint8_t *p = (const uint8_t *) &a->val;
+	uint64_t h = FNV64_OFFSET ^ a->type;
+	int i, l;
+
+	for (i = 0, l = addr_len(a->type); i < l; i++) {
+		h = (h ^ p[i]) * FNV64_PRIME;
+	}
+
+	return h ^ (h >> 32);
+}
+
+// Returns the slot for an address, which is either unused or holds it.
+static addr_slot *find_slot(const addr_map *m, const addr *a)
+{
+	unsigned long mask = m->cap - 1;
+	unsigned long i;
+	addr_slot *s;
+
+	for (i = hash_addr(a) & mask; ; i = (i + 1) & mask) {
+		s = &m->slots[i];
+		if (!s->used || !cmp_addr(&s->addr, a)) {
+			return s;
+		}
+	}
+}
+
+// Resizes the map to cap slots and reinserts all addresses.
+static void resize(addr_map *m, const unsigned long cap)
+{
+	addr_slot *old = m->slots;
+	unsigned long ocap = m->cap;
+	unsigned long i;
+
+	m->cap = cap;
+	m->slots = calloc(cap, sizeof(addr_slot));
+	for (i = 0; i < ocap; i++) {
+		if (old[i].used) {
+			*find_slot(m, &old[i].addr) = old[i];
+		}
+	}
+	free(old);
+}
+
+addr_map *new_addr_map(const unsigned long hint)
+{
+	addr_map *m = malloc(sizeof(addr_map));
+	unsigned long cap = INITCAP_ADDR_MAP;
+
+	while (cap * 3 < hint * 4) {
+		cap *= 2;
+	}
+	*m = (const addr_map){0};
+	resize(m, cap);
+
+	return m;
+}
+
+addr_slot *addr_map_put(addr_map *m, const addr *a, bool *added)
+{
+	addr_slot *s;
+
+	if ((m->len + 1) * 4 > m->cap * 3) {
+		resize(m, m->cap * 2);
+	}
+	s = find_slot(m, a);
+	*added = !s->used;
+	if (!s->used) {
+		s->used = true;
+		s->addr = *a;
+		s->val = 0;
+		m->len++;
+	}
+
+	return s;
+}
+
+addr_slot *addr_map_get(const addr_map *m, const addr *a)
+{
+	addr_slot *s = find_slot(m, a);
+
+	return (s->used ? s : NULL);
+}
+
+void free_addr_map(addr_map *m)
+{
+	if (m) {
+		free(m->slots);
+	}
+	free(m);
+}
@@ -0,0 +1,36 @@
+#ifndef __ADDRMAP_H
+#define __ADDRMAP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "addr.h"
+
+// Slot in an address map.
+typedef struct {
+	addr addr;
+	uint32_t val;
+	bool used;
+} addr_slot;
+
+// Open addressing hash map from address to a 32-bit value.
+typedef struct {
+	addr_slot *slots;
+	unsigned long len;
+	unsigned long cap;
+} addr_map;
+
+// Creates a new address map, sized for about hint addresses.
+addr_map *new_addr_map(const unsigned long hint);
+
+// Returns the slot for an address, adding it with val 0 (and setting *added to
+// true) if it's not already in the map. The slot is valid until the next put.
+addr_slot *addr_map_put(addr_map *m, const addr *a, bool *added);
+
+// Returns the slot for an address, or NULL if it's not in the map.
+addr_slot *addr_map_get(const addr_map *m, const addr *a);
+
+// Frees an address map.
+void free_addr_map(addr_map *m);
+
+#endif
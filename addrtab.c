@@ -0,0 +1,222 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "addrtab.h"
+#include "radix.h"
+
+#define INITCAP_COLUMN 1024
+#define RADIX_MIN_LEN_PER_BYTE 16
+
+static int cmp_mac_rows(const void *p1, const void *p2)
+{
+	return memcmp(p1, p2, MAC_LEN);
+}
+
+static int cmp_ip4_rows(const void *p1, const void *p2)
+{
+	return memcmp(p1, p2, IP4_LEN);
+}
+
+static int cmp_ip6_rows(const void *p1, const void *p2)
+{
+	return memcmp(p1, p2, IP6_LEN);
+}
+
+// Row comparators by address type, for rows that start with the key.
+static int (*const cmp_rows[MAX_ADDR_TYPE])(const void *, const void *) = {
+	cmp_mac_rows, cmp_ip4_rows, cmp_ip6_rows,
+};
+
+addr_table *new_addr_table()
+{
+	addr_table *t = malloc(sizeof(addr_table));
+	addr_type at;
+
+	*t = (const addr_table){{{0}}};
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		t->cols[at].klen = addr_len(at);
+	}
+	t->sorted = true;
+
+	return t;
+}
+
+// Ensures capacity for at least n more addresses in a column.
+static void reserve_col(addr_column *c, const unsigned long n)
+{
+	if (c->len + n <= c->cap) {
+		return;
+	}
+	c->cap = (c->cap ? c->cap*2 : INITCAP_COLUMN);
+	if (c->cap < c->len + n) {
+		c->cap = c->len + n;
+	}
+	c->keys = realloc(c->keys, c->cap * c->klen);
+	c->classids = realloc(c->classids, c->cap * sizeof(uint16_t));
+	c->uids = realloc(c->uids, c->cap * sizeof(uint32_t));
+}
+
+addr_table *new_addr_table_from(const entries *es)
+{
+	unsigned long counts[MAX_ADDR_TYPE] = {0};
+	addr_table *t = new_addr_table();
+	unsigned long i;
+	addr_type at;
+	entry *e;
+
+	for (i = 0; i < es->len; i++) {
+		counts[es->arr[i].addr.type]++;
+	}
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		reserve_col(&t->cols[at], counts[at]);
+	}
+	for (i = 0; i < es->len; i++) {
+		e = &es->arr[i];
+		addr_table_add(t, &e->addr, e->classid, e->uid);
+	}
+	t->sorted = es->sorted;
+
+	return t;
+}
+
+void addr_table_add(addr_table *t, const addr *a, const uint16_t classid,
+	const uint32_t uid)
+{
+	addr_column *c = &t->cols[a->type];
+
+	reserve_col(c, 1);
+	memcpy(&c->keys[c->len * c->klen], &a->val, c->klen);
+	c->classids[c->len] = classid;
+	c->uids[c->len] = uid;
+	c->len++;
+	t->sorted = false;
+}
+
+void col_append(addr_column *c, const uint8_t *keys, const uint16_t *classids,
+	const unsigned long n)
+{
+	reserve_col(c, n);
+	memcpy(&c->keys[c->len * c->klen], keys, n * c->klen);
+	memcpy(&c->classids[c->len], classids, n * sizeof(uint16_t));
+	memset(&c->uids[c->len], 0, n * sizeof(uint32_t));
+	c->len += n;
+}
+
+unsigned long addr_table_len(const addr_table *t)
+{
+	unsigned long n = 0;
+	addr_type at;
+
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		n += t->cols[at].len;
+	}
+
+	return n;
+}
+
+const uint8_t *col_key(const addr_column *c, const unsigned long i)
+{
+	return &c->keys[i * c->klen];
+}
+
+void col_addr(const addr_column *c, const addr_type t, const unsigned long i, addr *a)
+{
+	*a = (const addr){0};
+	a->type = t;
+	memcpy(&a->val, col_key(c, i), c->klen);
+}
+
+// Sorts a column by packing it into rows of key and index, sorting the rows,
+// then gathering the classids and uids by index. Short columns are sorted with
+// qsort, which is faster below about 16 rows per key byte.
+void sort_col(addr_column *c, const addr_type t, const unsigned int threads)
+{
+	size_t rlen = c->klen + sizeof(uint32_t);
+	uint8_t *rows, *tmp, *sorted, *r;
+	uint16_t *classids;
+	uint32_t *uids;
+	unsigned long i;
+	uint32_t idx;
+
+	if (c->len < 2) {
+		return;
+	}
+
+	rows = malloc(c->len * rlen);
+	for (i = 0, r = rows; i < c->len; i++, r += rlen) {
+		memcpy(r, col_key(c, i), c->klen);
+		idx = i;
+		memcpy(r + c->klen, &idx, sizeof(uint32_t));
+	}
+	if (c->len < RADIX_MIN_LEN_PER_BYTE * c->klen) {
+		qsort(rows, c->len, rlen, cmp_rows[t]);
+		sorted = rows;
+		tmp = NULL;
+	} else {
+		tmp = malloc(c->len * rlen);
+		sorted = radix_sort(rows, tmp, rlen, c->klen, c->len, threads);
+	}
+
+	classids = malloc(c->cap * sizeof(uint16_t));
+	uids = malloc(c->cap * sizeof(uint32_t));
+	for (i = 0, r = sorted; i < c->len; i++, r += rlen) {
+		memcpy(&c->keys[i * c->klen], r, c->klen);
+		memcpy(&idx, r + c->klen, sizeof(uint32_t));
+		classids[i] = c->classids[idx];
+		uids[i] = c->uids[idx];
+	}
+	free(c->classids);
+	free(c->uids);
+	c->classids = classids;
+	c->uids = uids;
+
+	free(tmp);
+	free(rows);
+}
+
+void sort_addr_table(addr_table *t, const unsigned int threads)
+{
+	addr_type at;
+
+	if (!t->sorted) {
+		for (at = 0; at < MAX_ADDR_TYPE; at++) {
+			sort_col(&t->cols[at], at, threads);
+		}
+		t->sorted = true;
+	}
+}
+
+bool addr_table_find(const addr_table *t, const addr *a, unsigned long *i)
+{
+	const addr_column *c = &t->cols[a->type];
+	unsigned long lo = 0, hi = c->len, mid;
+	int d;
+
+	while (lo < hi) {
+		mid = lo + (hi - lo) / 2;
+		if ((d = memcmp(col_key(c, mid), &a->val, c->klen)) == 0) {
+			*i = mid;
+			return true;
+		} else if (d < 0) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+
+	return false;
+}
+
+void free_addr_table(addr_table *t)
+{
+	addr_type at;
+
+	if (t) {
+		for (at = 0; at < MAX_ADDR_TYPE; at++) {
+			free(t->cols[at].uids);
+			free(t->cols[at].classids);
+			free(t->cols[at].keys);
+		}
+	}
+	free(t);
+}
@@ -0,0 +1,65 @@
+#ifndef __ADDRTAB_H
+#define __ADDRTAB_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "addr.h"
+#include "entry.h"
+
+// Addresses of one type, stored as parallel arrays of dense keys (klen bytes
+// each), classids and uids.
+typedef struct {
+	int klen;
+	uint8_t *keys;
+	uint16_t *classids;
+	uint32_t *uids;
+	unsigned long len;
+	unsigned long cap;
+} addr_column;
+
+// Address table with one column per address type (sorted is true if all
+// columns are known to be sorted by key).
+typedef struct {
+	addr_column cols[MAX_ADDR_TYPE];
+	bool sorted;
+} addr_table;
+
+// Creates a new, empty address table.
+addr_table *new_addr_table();
+
+// Creates a new address table from entries.
+addr_table *new_addr_table_from(const entries *es);
+
+// Appends an address with its classid and uid.
+void addr_table_add(addr_table *t, const addr *a, const uint16_t classid,
+	const uint32_t uid);
+
+// Appends n keys with their classids to a column, with uids of zero.
+void col_append(addr_column *c, const uint8_t *keys, const uint16_t *classids,
+	const unsigned long n);
+
+// Returns the total number of addresses in the table.
+unsigned long addr_table_len(const addr_table *t);
+
+// Returns a pointer to the key at index i in a column.
+const uint8_t *col_key(const addr_column *c, const unsigned long i);
+
+// Sets a to the address at index i in a column of type t.
+void col_addr(const addr_column *c, const addr_type t, const unsigned long i, addr *a);
+
+// Finds an address in a sorted table, setting *i to its index in its column.
+bool addr_table_find(const addr_table *t, const addr *a, unsigned long *i);
+
+// Sorts a column of type t by key, radix sorting large columns using up to
+// threads threads.
+void sort_col(addr_column *c, const addr_type t, const unsigned int threads);
+
+// Sorts each column by key, unless they're already sorted. Large columns are
+// radix sorted using up to threads threads.
+void sort_addr_table(addr_table *t, const unsigned int threads);
+
+// Frees an address table.
+void free_addr_table(addr_table *t);
+
+#endif
@@ -1,4 +1,5 @@
 #include <unistd.h>
+#include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
@@ -13,6 +14,19 @@
 
 #define BPF_MAPS_BASE "/sys/fs/bpf/tc/globals/tc_users_"
 #define BPF_CONFIG_PATH BPF_MAPS_BASE "config"
+#define BPF_STATS_PATH BPF_MAPS_BASE "stats"
+#define BPF_LOAD_PATH BPF_MAPS_BASE "load"
+#define BPF_USERS_PATH BPF_MAPS_BASE "users"
+#define BPF_HIST_PATH BPF_MAPS_BASE "hist"
+#define BPF_OWNERS_PATH BPF_MAPS_BASE "owners"
+#define BPF_MAX_USERS (BPF_MAP_MAX_ELEM * MAX_ADDR_TYPE)
+#define BPF_HIST_LEN 65536
+#define INITCAP_BATCH 64
+
+// Kernel internal errno returned for unsupported map operations.
+#ifndef ENOTSUPP
+#define ENOTSUPP 524
+#endif
 
 static const char * const bpf_paths[MAX_ADDR_TYPE] = {
 	BPF_MAPS_BASE "mac",
@@ -20,19 +34,184 @@ static const char * const bpf_paths[MAX_ADDR_TYPE] = {
 	BPF_MAPS_BASE "ip6",
 };
 
+// Paths that bpf_activate_set pins new address maps at, before moving them to
+// bpf_paths.
+static const char * const bpf_new_paths[MAX_ADDR_TYPE] = {
+	BPF_MAPS_BASE "mac_new",
+	BPF_MAPS_BASE "ip4_new",
+	BPF_MAPS_BASE "ip6_new",
+};
+
+static const char * const bpf_set_paths[MAX_ADDR_TYPE] = {
+	BPF_MAPS_BASE "mac_sets",
+	BPF_MAPS_BASE "ip4_sets",
+	BPF_MAPS_BASE "ip6_sets",
+};
+
+// Returns true if errno indicates that batched map operations are unsupported.
+static bool batch_unsupported()
+{
+	return errno == EINVAL || errno == ENOTSUPP || errno == EOPNOTSUPP;
+}
+
+// Opens the map sets, if present.
+static void open_sets(bpf_handle *hnd)
+{
+	int i;
+
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		if ((hnd->setfds[i] = bpf_obj_get(bpf_set_paths[i])) == -1) {
+			hnd->setfds[i] = 0;
+			return;
+		}
+	}
+	hnd->sets = true;
+}
+
+// Reads the active set and generation from the config, if it's been written.
+error_t *bpf_read_config(bpf_handle *hnd, bpf_config *bcfg)
+{
+	uint8_t ck = BPF_CONFIG_KEY;
+
+	if (bpf_lookup_elem(hnd->cfd, &ck, bcfg) == -1) {
+		return errorf(E_BPF_LOOKUP_ELEM_FAIL,
+			"unable to find bpf entry for key='%d', error='%s'", ck, strerror(errno));
+	}
+	if (hnd->sets) {
+		hnd->active_set = bcfg->active_set % BPF_MAP_SETS;
+	}
+	hnd->generation = bcfg->generation;
+
+	return NULL;
+}
+
 error_t *bpf_open(bpf_handle *hnd)
 {
+	const char *path = BPF_CONFIG_PATH;
+	bpf_config bcfg;
+	error_t *err;
 	int i;
 
 	*hnd = (const bpf_handle){0};
 	for (i = 0; i < MAX_ADDR_TYPE; i++) {
 		if ((hnd->afds[i] = bpf_obj_get(bpf_paths[i])) == -1) {
-			bpf_close(hnd);
-			return errorf(E_BPF_OBJ_GET_FAIL, "'%s', %s", bpf_paths[i], strerror(errno));
+			path = bpf_paths[i];
+			goto fail;
 		}
 	}
 	if ((hnd->cfd = bpf_obj_get(BPF_CONFIG_PATH)) == -1) {
-		return errorf(E_BPF_OBJ_GET_FAIL, "'%s', %s", BPF_CONFIG_PATH, strerror(errno));
+		goto fail;
+	}
+	open_sets(hnd);
+	bpf_read_config(hnd, &bcfg);
+
+	return NULL;
+
+fail:
+	// the handle is left empty, so it can be closed or opened again
+	err = errorf(E_BPF_OBJ_GET_FAIL, "'%s', %s", path, strerror(errno));
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		if (hnd->afds[i] == -1) {
+			hnd->afds[i] = 0;
+		}
+	}
+	if (hnd->cfd == -1) {
+		hnd->cfd = 0;
+	}
+	bpf_close(hnd);
+	*hnd = (const bpf_handle){0};
+	return err;
+}
+
+error_t *bpf_new_set(const bpf_handle *hnd, bpf_handle *nh)
+{
+	int i;
+
+	*nh = (const bpf_handle){0};
+	if (!hnd->sets) {
+		return error(E_BPF_NO_MAP_SETS);
+	}
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		if ((nh->afds[i] = bpf_create_map(BPF_MAP_TYPE_HASH, addr_len(i),
+			sizeof(uint16_t), BPF_MAP_MAX_ELEM, BPF_F_NO_PREALLOC)) == -1) {
+			nh->afds[i] = 0;
+			return errorf(E_BPF_MAP_CREATE_FAIL, "%s", strerror(errno));
+		}
+	}
+
+	return NULL;
+}
+
+error_t *bpf_activate_set(bpf_handle *hnd, bpf_handle *nh, bpf_config *bcfg)
+{
+	uint32_t old = hnd->active_set;
+	uint32_t set = (old + 1) % BPF_MAP_SETS;
+	error_t *err;
+	int i;
+
+	// the new maps are added to the inactive set and pinned at temporary paths
+	// first, so if either fails the datapath and the pins are left unchanged
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		if (bpf_update_elem(hnd->setfds[i], &set, &nh->afds[i], BPF_ANY) == -1) {
+			err = errorf(E_BPF_UPDATE_ELEM_FAIL,
+				"unable to add map to set %u in '%s', error='%s'", set,
+				bpf_set_paths[i], strerror(errno));
+			goto fail;
+		}
+		bpf_obj_unpin(bpf_new_paths[i]);
+		if (bpf_obj_pin(nh->afds[i], bpf_new_paths[i]) == -1) {
+			err = errorf(E_BPF_OBJ_PIN_FAIL, "'%s', %s", bpf_new_paths[i],
+				strerror(errno));
+			goto fail;
+		}
+	}
+
+	bcfg->active_set = set;
+	if ((err = bpf_update_config(hnd, bcfg))) {
+		bcfg->active_set = old;
+		goto fail;
+	}
+	hnd->active_set = set;
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		bpf_obj_close(hnd->afds[i]);
+		hnd->afds[i] = nh->afds[i];
+		nh->afds[i] = 0;
+	}
+
+	// each rename atomically replaces the previous pin, and the old maps are
+	// freed once their set entries are deleted too
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		if (bpf_obj_rename(bpf_new_paths[i], bpf_paths[i]) == -1) {
+			return errorf(E_BPF_OBJ_PIN_FAIL, "'%s', %s", bpf_paths[i], strerror(errno));
+		}
+	}
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		if (bpf_delete_elem(hnd->setfds[i], &old) == -1 && errno != ENOENT) {
+			return errorf(E_BPF_DELETE_ELEM_FAIL,
+				"unable to remove map from set %u in '%s', error='%s'", old,
+				bpf_set_paths[i], strerror(errno));
+		}
+	}
+
+	return NULL;
+
+fail:
+	for (i = 0; i < MAX_ADDR_TYPE; i++) {
+		bpf_obj_unpin(bpf_new_paths[i]);
+		bpf_delete_elem(hnd->setfds[i], &set);
+	}
+	return err;
+}
+
+error_t *bpf_open_stats(bpf_handle *hnd)
+{
+	if ((hnd->sfd = bpf_obj_get(BPF_STATS_PATH)) == -1) {
+		hnd->sfd = 0;
+		return errorf(E_BPF_OBJ_GET_FAIL, "'%s', %s", BPF_STATS_PATH, strerror(errno));
+	}
+	if ((hnd->lfd = bpf_obj_get(BPF_LOAD_PATH)) == -1) {
+		hnd->lfd = 0;
+		return errorf(E_BPF_OBJ_GET_FAIL, "'%s', %s", BPF_LOAD_PATH, strerror(errno));
 	}
 
 	return NULL;
@@ -44,11 +223,29 @@ error_t *bpf_close(const bpf_handle *hnd)
 
 	for (i = 0; i < MAX_ADDR_TYPE; i++) {
 		if (hnd->afds[i]) {
-			close(hnd->afds[i]);
+			bpf_obj_close(hnd->afds[i]);
+		}
+		if (hnd->setfds[i]) {
+			bpf_obj_close(hnd->setfds[i]);
 		}
 	}
 	if (hnd->cfd) {
-		close(hnd->cfd);
+		bpf_obj_close(hnd->cfd);
+	}
+	if (hnd->sfd) {
+		bpf_obj_close(hnd->sfd);
+	}
+	if (hnd->lfd) {
+		bpf_obj_close(hnd->lfd);
+	}
+	if (hnd->ufd) {
+		bpf_obj_close(hnd->ufd);
+	}
+	if (hnd->hfd) {
+		bpf_obj_close(hnd->hfd);
+	}
+	if (hnd->ofd) {
+		bpf_obj_close(hnd->ofd);
 	}
 
 	return NULL;
@@ -115,16 +312,582 @@ error_t *bpf_update_config(const bpf_handle *hnd, const bpf_config *bcfg)
 	return NULL;
 }
 
+error_t *bpf_open_state(bpf_handle *hnd)
+{
+	if ((hnd->ufd = bpf_obj_get(BPF_USERS_PATH)) == -1) {
+		hnd->ufd = 0;
+		return error(E_NO_USER_STATE);
+	}
+	if ((hnd->hfd = bpf_obj_get(BPF_HIST_PATH)) == -1) {
+		hnd->hfd = 0;
+		return error(E_NO_USER_STATE);
+	}
+	if ((hnd->ofd = bpf_obj_get(BPF_OWNERS_PATH)) == -1) {
+		hnd->ofd = 0;
+		return error(E_NO_USER_STATE);
+	}
+
+	return NULL;
+}
+
+error_t *bpf_new_state(bpf_handle *nh)
+{
+	*nh = (const bpf_handle){0};
+	if ((nh->ufd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(bpf_userid),
+		sizeof(bpf_user), BPF_MAX_USERS, BPF_F_NO_PREALLOC)) == -1) {
+		nh->ufd = 0;
+		return errorf(E_BPF_MAP_CREATE_FAIL, "%s", strerror(errno));
+	}
+	if ((nh->hfd = bpf_create_map(BPF_MAP_TYPE_ARRAY, sizeof(uint32_t),
+		sizeof(uint32_t), BPF_HIST_LEN, 0)) == -1) {
+		nh->hfd = 0;
+		return errorf(E_BPF_MAP_CREATE_FAIL, "%s", strerror(errno));
+	}
+	if ((nh->ofd = bpf_create_map(BPF_MAP_TYPE_HASH, sizeof(bpf_owner_key),
+		sizeof(bpf_userid), BPF_MAX_USERS, BPF_F_NO_PREALLOC)) == -1) {
+		nh->ofd = 0;
+		return errorf(E_BPF_MAP_CREATE_FAIL, "%s", strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_pin_state(bpf_handle *hnd, bpf_handle *nh)
+{
+	bpf_remove_state();
+	if (bpf_obj_pin(nh->ufd, BPF_USERS_PATH) == -1) {
+		return errorf(E_BPF_OBJ_PIN_FAIL, "'%s', %s", BPF_USERS_PATH, strerror(errno));
+	}
+	if (bpf_obj_pin(nh->hfd, BPF_HIST_PATH) == -1) {
+		bpf_obj_unpin(BPF_USERS_PATH);
+		return errorf(E_BPF_OBJ_PIN_FAIL, "'%s', %s", BPF_HIST_PATH, strerror(errno));
+	}
+	if (bpf_obj_pin(nh->ofd, BPF_OWNERS_PATH) == -1) {
+		bpf_obj_unpin(BPF_USERS_PATH);
+		bpf_obj_unpin(BPF_HIST_PATH);
+		return errorf(E_BPF_OBJ_PIN_FAIL, "'%s', %s", BPF_OWNERS_PATH, strerror(errno));
+	}
+
+	if (hnd->ufd) {
+		bpf_obj_close(hnd->ufd);
+	}
+	if (hnd->hfd) {
+		bpf_obj_close(hnd->hfd);
+	}
+	if (hnd->ofd) {
+		bpf_obj_close(hnd->ofd);
+	}
+	hnd->ufd = nh->ufd;
+	hnd->hfd = nh->hfd;
+	hnd->ofd = nh->ofd;
+	nh->ufd = 0;
+	nh->hfd = 0;
+	nh->ofd = 0;
+
+	return NULL;
+}
+
+void bpf_remove_state()
+{
+	bpf_obj_unpin(BPF_USERS_PATH);
+	bpf_obj_unpin(BPF_HIST_PATH);
+	bpf_obj_unpin(BPF_OWNERS_PATH);
+}
+
+// Sets a user state map key from a user ID.
+static void userid_key(const char *userid, bpf_userid key)
+{
+	memset(key, 0, sizeof(bpf_userid));
+	strncpy(key, userid, MAX_USERID_STRLEN);
+}
+
+error_t *bpf_lookup_user(const bpf_handle *hnd, const char *userid, bpf_user *u,
+	bool *found)
+{
+	bpf_userid key;
+
+	userid_key(userid, key);
+	*u = (const bpf_user){0};
+	if (bpf_lookup_elem(hnd->ufd, key, u) == -1) {
+		if (errno != ENOENT) {
+			return errorf(E_BPF_LOOKUP_ELEM_FAIL,
+				"unable to find state for userid='%s', error='%s'", userid,
+				strerror(errno));
+		}
+		*found = false;
+	} else {
+		*found = true;
+	}
+
+	return NULL;
+}
+
+error_t *bpf_update_user(const bpf_handle *hnd, const char *userid, const bpf_user *u)
+{
+	bpf_userid key;
+
+	userid_key(userid, key);
+	if (bpf_update_elem(hnd->ufd, key, u, BPF_ANY) == -1) {
+		return errorf(E_BPF_UPDATE_ELEM_FAIL,
+			"unable to update state for userid='%s', error='%s'", userid,
+			strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_delete_user(const bpf_handle *hnd, const char *userid)
+{
+	bpf_userid key;
+
+	userid_key(userid, key);
+	if (bpf_delete_elem(hnd->ufd, key) == -1 && errno != ENOENT) {
+		return errorf(E_BPF_DELETE_ELEM_FAIL,
+			"unable to delete state for userid='%s', error='%s'", userid,
+			strerror(errno));
+	}
+
+	return NULL;
+}
+
+// Updates n elements of a hash map, in batches, or one by one if batches are
+// unsupported. On failure, returns -1 with errno set and *fail set to the
+// index of the first element not updated.
+static int update_all(const int fd, const void *keys, const size_t ksize,
+	const void *values, const size_t vsize, const unsigned long n,
+	unsigned long *fail)
+{
+	bool nobatch = false;
+	unsigned int cnt, req;
+	unsigned long i;
+
+	for (i = 0; i < n; i += cnt) {
+		if (nobatch) {
+			for (; i < n; i++) {
+				if (bpf_update_elem(fd, (const uint8_t *) keys + i * ksize,
+					(const uint8_t *) values + i * vsize, BPF_ANY) == -1) {
+					*fail = i;
+					return -1;
+				}
+			}
+			break;
+		}
+		req = cnt = (n - i > BPF_BATCH_LEN ? BPF_BATCH_LEN : n - i);
+		if (bpf_update_batch(fd, (const uint8_t *) keys + i * ksize,
+			(const uint8_t *) values + i * vsize, &cnt, BPF_ANY) == -1) {
+			if ((cnt == 0 || cnt == req) && batch_unsupported()) {
+				nobatch = true;
+				cnt = 0;
+				continue;
+			}
+			*fail = i + cnt;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+error_t *bpf_load_users(const bpf_handle *hnd, const bpf_userid *userids,
+	const bpf_user *us, const unsigned long n)
+{
+	unsigned long fail;
+
+	if (update_all(hnd->ufd, userids, sizeof(bpf_userid), us, sizeof(bpf_user), n,
+		&fail) == -1) {
+		return errorf(E_BPF_UPDATE_ELEM_FAIL,
+			"unable to update state for userid='%s', error='%s'",
+			userids[fail], strerror(errno));
+	}
+
+	return NULL;
+}
+
+void bpf_owner_key_of(const addr *a, bpf_owner_key *key)
+{
+	memset(key, 0, sizeof(bpf_owner_key));
+	key->type = a->type;
+	memcpy(key->val, &a->val, addr_len(a->type));
+}
+
+error_t *bpf_lookup_owner(const bpf_handle *hnd, const addr *a, bpf_userid userid,
+	bool *found)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	bpf_owner_key key;
+
+	bpf_owner_key_of(a, &key);
+	if (bpf_lookup_elem(hnd->ofd, &key, userid) == -1) {
+		if (errno != ENOENT) {
+			return errorf(E_BPF_LOOKUP_ELEM_FAIL,
+				"unable to find user of addr='%s', error='%s'", addr_str(a, astr),
+				strerror(errno));
+		}
+		*found = false;
+	} else {
+		*found = true;
+	}
+
+	return NULL;
+}
+
+error_t *bpf_update_owner(const bpf_handle *hnd, const addr *a, const char *userid)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	bpf_owner_key key;
+	bpf_userid val;
+
+	bpf_owner_key_of(a, &key);
+	userid_key(userid, val);
+	if (bpf_update_elem(hnd->ofd, &key, val, BPF_ANY) == -1) {
+		return errorf(E_BPF_UPDATE_ELEM_FAIL,
+			"unable to update user of addr='%s', error='%s'", addr_str(a, astr),
+			strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_delete_owner(const bpf_handle *hnd, const addr *a)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	bpf_owner_key key;
+
+	bpf_owner_key_of(a, &key);
+	if (bpf_delete_elem(hnd->ofd, &key) == -1 && errno != ENOENT) {
+		return errorf(E_BPF_DELETE_ELEM_FAIL,
+			"unable to delete user of addr='%s', error='%s'", addr_str(a, astr),
+			strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_load_owners(const bpf_handle *hnd, const bpf_owner_key *keys,
+	const bpf_userid *userids, const unsigned long n)
+{
+	unsigned long fail;
+
+	if (update_all(hnd->ofd, keys, sizeof(bpf_owner_key), userids,
+		sizeof(bpf_userid), n, &fail) == -1) {
+		return errorf(E_BPF_UPDATE_ELEM_FAIL,
+			"unable to update user of address for userid='%s', error='%s'",
+			userids[fail], strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_read_hist(const bpf_handle *hnd, const uint16_t classid, uint32_t *n)
+{
+	uint32_t key = classid;
+
+	if (bpf_lookup_elem(hnd->hfd, &key, n) == -1) {
+		return errorf(E_BPF_LOOKUP_ELEM_FAIL,
+			"unable to read users for classid=%u, error='%s'", classid, strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_write_hist(const bpf_handle *hnd, const uint16_t classid, const uint32_t n)
+{
+	uint32_t key = classid;
+
+	if (bpf_update_elem(hnd->hfd, &key, &n, BPF_ANY) == -1) {
+		return errorf(E_BPF_UPDATE_ELEM_FAIL,
+			"unable to write users for classid=%u, error='%s'", classid, strerror(errno));
+	}
+
+	return NULL;
+}
+
+// Looks up n consecutive elements of an array map from index lo, in batches,
+// or one by one if batches are unsupported. On failure, returns -1 with errno
+// set and *fail set to the index of the first element not read.
+static int lookup_array(const int fd, const uint32_t lo, const uint32_t n,
+	void *values, const size_t size, uint32_t *fail)
+{
+	uint32_t keys[BPF_BATCH_LEN];
+	unsigned int cnt, req;
+	bool nobatch = false;
+	uint32_t i, prev;
+
+	for (i = 0; i < n; i += cnt) {
+		if (nobatch) {
+			for (; i < n; i++) {
+				prev = lo + i;
+				if (bpf_lookup_elem(fd, &prev, (uint8_t *) values + i * size) == -1) {
+					*fail = prev;
+					return -1;
+				}
+			}
+			break;
+		}
+		// the batch starts after the key in in_batch, or at index 0 if NULL
+		prev = lo + i - 1;
+		req = cnt = (n - i > BPF_BATCH_LEN ? BPF_BATCH_LEN : n - i);
+		if (bpf_lookup_batch(fd, (lo + i > 0 ? &prev : NULL), &prev, keys,
+			(uint8_t *) values + i * size, &cnt) == -1) {
+			if (i == 0 && cnt == 0 && batch_unsupported()) {
+				nobatch = true;
+				continue;
+			}
+			// ENOENT only means the end of the map was reached
+			if (errno != ENOENT || cnt == 0) {
+				*fail = lo + i + cnt;
+				return -1;
+			}
+		}
+		if (cnt != req && i + cnt < n) {
+			errno = ENOENT;
+			*fail = lo + i + cnt;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+// Updates n consecutive elements of an array map from index lo, in batches,
+// or one by one if batches are unsupported. On failure, returns -1 with errno
+// set and *fail set to the index of the first element not updated.
+static int update_array(const int fd, const uint32_t lo, const uint32_t n,
+	const void *values, const size_t size, uint32_t *fail)
+{
+	uint32_t keys[BPF_BATCH_LEN];
+	unsigned int cnt, req;
+	bool nobatch = false;
+	uint32_t i, k;
+
+	for (i = 0; i < n; i += cnt) {
+		if (nobatch) {
+			for (; i < n; i++) {
+				k = lo + i;
+				if (bpf_update_elem(fd, &k, (const uint8_t *) values + i * size,
+					BPF_ANY) == -1) {
+					*fail = k;
+					return -1;
+				}
+			}
+			break;
+		}
+		req = cnt = (n - i > BPF_BATCH_LEN ? BPF_BATCH_LEN : n - i);
+		for (k = 0; k < cnt; k++) {
+			keys[k] = lo + i + k;
+		}
+		if (bpf_update_batch(fd, keys, (const uint8_t *) values + i * size, &cnt,
+			BPF_ANY) == -1) {
+			if ((cnt == 0 || cnt == req) && batch_unsupported()) {
+				nobatch = true;
+				cnt = 0;
+				continue;
+			}
+			*fail = lo + i + cnt;
+			return -1;
+		}
+	}
+
+	return 0;
+}
+
+error_t *bpf_read_stats(const bpf_handle *hnd, const uint16_t lo, const uint32_t n,
+	classid_stats *s)
+{
+	uint32_t fail;
+
+	if (lookup_array(hnd->sfd, lo, n, s, sizeof(classid_stats), &fail) == -1) {
+		return errorf(E_BPF_LOOKUP_ELEM_FAIL,
+			"unable to read traffic counters for classid=%u, error='%s'",
+			fail, strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_read_loads(const bpf_handle *hnd, const uint16_t lo, const uint32_t n,
+	classid_load *l)
+{
+	uint32_t fail;
+
+	if (lookup_array(hnd->lfd, lo, n, l, sizeof(classid_load), &fail) == -1) {
+		return errorf(E_BPF_LOOKUP_ELEM_FAIL,
+			"unable to read load for classid=%u, error='%s'", fail, strerror(errno));
+	}
+
+	return NULL;
+}
+
+error_t *bpf_write_loads(const bpf_handle *hnd, const uint16_t lo, const uint32_t n,
+	const classid_load *l)
+{
+	uint32_t fail;
+
+	if (update_array(hnd->lfd, lo, n, l, sizeof(classid_load), &fail) == -1) {
+		return errorf(E_BPF_UPDATE_ELEM_FAIL,
+			"unable to write load for classid=%u, error='%s'", fail, strerror(errno));
+	}
+
+	return NULL;
+}
+
+static bpf_batch *new_batch(const bpf_handle *hnd, const bool delete,
+	const uint64_t flags)
+{
+	bpf_batch *b = malloc(sizeof(bpf_batch));
+	*b = (const bpf_batch){0};
+	b->hnd = hnd;
+	b->delete = delete;
+	b->flags = flags;
+
+	return b;
+}
+
+bpf_batch *bpf_new_update_batch(const bpf_handle *hnd, const uint64_t flags)
+{
+	return new_batch(hnd, false, flags);
+}
+
+bpf_batch *bpf_new_delete_batch(const bpf_handle *hnd)
+{
+	return new_batch(hnd, true, 0);
+}
+
+void bpf_batch_add(bpf_batch *b, const addr *addr, const uint16_t classid)
+{
+	bpf_batch_add_key(b, addr->type, &addr->val, classid);
+}
+
+void bpf_batch_add_key(bpf_batch *b, const addr_type t, const void *key,
+	const uint16_t classid)
+{
+	int klen = addr_len(t);
+
+	if (b->len[t] == b->cap[t]) {
+		b->cap[t] = (b->cap[t] ? b->cap[t]*2 : INITCAP_BATCH);
+		b->keys[t] = realloc(b->keys[t], b->cap[t] * klen);
+		if (!b->delete) {
+			b->classids[t] = realloc(b->classids[t], b->cap[t] * sizeof(uint16_t));
+		}
+	}
+	memcpy(&b->keys[t][b->len[t] * klen], key, klen);
+	if (!b->delete) {
+		b->classids[t][b->len[t]] = classid;
+	}
+	b->len[t]++;
+}
+
+// Applies batch elements one by one, starting at index i for address type t.
+static error_t *apply_elems(bpf_batch *b, const addr_type t, unsigned long i)
+{
+	int klen = addr_len(t);
+	error_t *err;
+	addr a;
+
+	a.type = t;
+	for (; i < b->len[t]; i++) {
+		memcpy(&a.val, &b->keys[t][i * klen], klen);
+		if (b->delete) {
+			err = bpf_delete(b->hnd, &a);
+		} else {
+			err = bpf_update(b->hnd, &a, b->classids[t][i], b->flags);
+		}
+		if (err) {
+			return err;
+		}
+	}
+
+	return NULL;
+}
+
+error_t *bpf_batch_apply(bpf_batch *b)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	unsigned int cnt, req;
+	unsigned long i, n;
+	error_t *err;
+	addr_type t;
+	int klen, fd;
+	addr a;
+	int r;
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		fd = b->hnd->afds[t];
+		klen = addr_len(t);
+		for (i = 0; i < b->len[t]; i += cnt) {
+			if (b->nobatch) {
+				if ((err = apply_elems(b, t, i))) {
+					return err;
+				}
+				break;
+			}
+			n = b->len[t] - i;
+			req = cnt = (n > BPF_BATCH_LEN ? BPF_BATCH_LEN : n);
+			if (b->delete) {
+				r = bpf_delete_batch(fd, &b->keys[t][i * klen], &cnt);
+			} else {
+				// elem_flags only accepts BPF_F_LOCK, so batches use BPF_ANY
+				r = bpf_update_batch(fd, &b->keys[t][i * klen], &b->classids[t][i],
+					&cnt, BPF_ANY);
+			}
+			if (r == -1) {
+				if ((cnt == 0 || cnt == req) && batch_unsupported()) {
+					b->nobatch = true;
+					cnt = 0;
+					continue;
+				}
+				a.type = t;
+				memcpy(&a.val, &b->keys[t][(i + cnt) * klen], klen);
+				if (b->delete) {
+					return errorf(E_BPF_DELETE_ELEM_FAIL,
+						"unable to delete bpf entry for addr='%s', error='%s'",
+						addr_str(&a, astr), strerror(errno));
+				}
+				return errorf(E_BPF_UPDATE_ELEM_FAIL,
+					"unable to update bpf entry for addr='%s', error='%s'",
+					addr_str(&a, astr), strerror(errno));
+			}
+		}
+		b->len[t] = 0;
+	}
+
+	return NULL;
+}
+
+void bpf_free_batch(bpf_batch *b)
+{
+	addr_type t;
+
+	if (b) {
+		for (t = 0; t < MAX_ADDR_TYPE; t++) {
+			free(b->keys[t]);
+			free(b->classids[t]);
+		}
+	}
+	free(b);
+}
+
 bpf_it *bpf_new_it(const bpf_handle *hnd)
 {
 	bpf_it *it = malloc(sizeof(bpf_it));
 	*it = (const bpf_it){0};
 	it->hnd = hnd;
+	it->end = MAX_ADDR_TYPE;
 
 	return it;
 }
 
-error_t *bpf_next(bpf_it *it, addr *next, uint16_t *classid)
+bpf_it *bpf_new_type_it(const bpf_handle *hnd, const addr_type t)
+{
+	bpf_it *it = bpf_new_it(hnd);
+	it->addr_type = t;
+	it->end = t + 1;
+
+	return it;
+}
+
+// Returns the next entry using one get next key and lookup per element.
+static error_t *next_elem(bpf_it *it, addr *next, uint16_t *classid)
 {
 	error_t *err;
 	int fd;
@@ -136,7 +899,7 @@ error_t *bpf_next(bpf_it *it, addr *next, uint16_t *classid)
 				return errorf(E_BPF_GET_NEXT_KEY_FAIL, "%s", strerror(errno));
 			}
 			it->key = NULL;
-			if (++(it->addr_type) == MAX_ADDR_TYPE) {
+			if (++(it->addr_type) == it->end) {
 				it->done = true;
 			}
 		} else {
@@ -151,3 +914,59 @@ error_t *bpf_next(bpf_it *it, addr *next, uint16_t *classid)
 
 	return NULL;
 }
+
+// Reads the next batch of entries for the iterator's current address type.
+static error_t *read_batch(bpf_it *it)
+{
+	unsigned int cnt = BPF_BATCH_LEN;
+	int fd = it->hnd->afds[it->addr_type];
+
+	if (bpf_lookup_batch(fd, (it->started ? &it->in_batch : NULL), &it->out_batch,
+		it->keys, it->classids, &cnt) == -1) {
+		if (errno == ENOENT) {
+			it->last = true;
+		} else if (!it->started && batch_unsupported()) {
+			it->nobatch = true;
+			return NULL;
+		} else {
+			return errorf(E_BPF_LOOKUP_BATCH_FAIL, "%s", strerror(errno));
+		}
+	}
+	it->in_batch = it->out_batch;
+	it->started = true;
+	it->pos = 0;
+	it->len = cnt;
+
+	return NULL;
+}
+
+error_t *bpf_next(bpf_it *it, addr *next, uint16_t *classid)
+{
+	error_t *err;
+	int klen;
+
+	while (!it->done && !it->nobatch) {
+		if (it->pos < it->len) {
+			klen = addr_len(it->addr_type);
+			next->type = it->addr_type;
+			memcpy(&next->val, &it->keys[it->pos * klen], klen);
+			if (classid) {
+				*classid = it->classids[it->pos];
+			}
+			it->pos++;
+			return NULL;
+		}
+		if (it->last) {
+			it->started = false;
+			it->last = false;
+			it->len = 0;
+			if (++(it->addr_type) == it->end) {
+				it->done = true;
+			}
+		} else if ((err = read_batch(it))) {
+			return err;
+		}
+	}
+
+	return next_elem(it, next, classid);
+}
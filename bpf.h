@@ -2,28 +2,150 @@
 #define __BPF_H
 
 #include <stdbool.h>
+#include <stdint.h>
 
 #include "addr.h"
 #include "bpf_config.h"
+#include "bpf_stats.h"
 #include "error.h"
+#include "limits.h"
 
 // BPF file descriptors.
 typedef struct {
 	int afds[MAX_ADDR_TYPE];
+	int setfds[MAX_ADDR_TYPE];
 	int cfd;
+	int sfd;
+	int lfd;
+	int ufd;
+	int hfd;
+	int ofd;
+	bool sets;
+	uint8_t active_set;
+	uint32_t generation;
 } bpf_handle;
 
-// BPF maps iterator.
+// Key of the user state map, a zero padded user ID.
+typedef char bpf_userid[MAX_USERID_STRLEN+1];
+
+// State of a user, kept in a map only used by tc-users to apply delta input:
+// the user's classid and number of addresses.
+typedef struct {
+	uint16_t classid;
+	uint32_t naddrs;
+} bpf_user;
+
+// Key of the address owner map, which records the user ID that each address
+// belongs to, alongside the user state: a zero padded address type and value.
+typedef struct {
+	uint8_t type;
+	uint8_t val[sizeof(addr_val)];
+} bpf_owner_key;
+
+// Maximum number of elements per batched BPF map operation.
+#define BPF_BATCH_LEN 4096
+
+// BPF maps iterator. An iterator only falls back to per-element reads before
+// its first batch of an address type, so it never restarts a walk part way.
 typedef struct {
 	const bpf_handle *hnd;
 	addr_type addr_type;
+	addr_type end;
 	void *key;
 	bool done;
+	bool started;
+	bool last;
+	bool nobatch;
+	addr_val in_batch;
+	addr_val out_batch;
+	uint8_t keys[BPF_BATCH_LEN * sizeof(addr_val)];
+	uint16_t classids[BPF_BATCH_LEN];
+	unsigned int pos;
+	unsigned int len;
 } bpf_it;
 
-// Opens the BPF maps.
+// Pending BPF map updates or deletes, collected per address type.
+typedef struct {
+	const bpf_handle *hnd;
+	bool delete;
+	bool nobatch;
+	uint64_t flags;
+	uint8_t *keys[MAX_ADDR_TYPE];
+	uint16_t *classids[MAX_ADDR_TYPE];
+	unsigned long len[MAX_ADDR_TYPE];
+	unsigned long cap[MAX_ADDR_TYPE];
+} bpf_batch;
+
+// Opens the BPF maps. The pinned address maps are those of the active map set,
+// if the map sets are present.
 error_t *bpf_open(bpf_handle *hnd);
 
+// Creates empty address maps in nh, for loading and then activating with
+// bpf_activate_set. Only the address map fds in nh are set.
+error_t *bpf_new_set(const bpf_handle *hnd, bpf_handle *nh);
+
+// Activates the address maps in nh as the inactive map set, switching the
+// datapath to them with one update of the BPF config (bcfg). The maps are
+// pinned at temporary paths before the switch, so that nothing changes if
+// that fails, then moved in place of the previous ones, which are released.
+// Once the datapath has switched, the maps are moved to hnd even on error.
+error_t *bpf_activate_set(bpf_handle *hnd, bpf_handle *nh, bpf_config *bcfg);
+
+// Opens the pinned user state maps, returning E_NO_USER_STATE if there are
+// none.
+error_t *bpf_open_state(bpf_handle *hnd);
+
+// Creates empty user state maps in nh. Only the user state fds are set.
+error_t *bpf_new_state(bpf_handle *nh);
+
+// Pins the user state maps in nh in place of any previous ones, and moves them
+// to hnd.
+error_t *bpf_pin_state(bpf_handle *hnd, bpf_handle *nh);
+
+// Unpins the user state maps, if any.
+void bpf_remove_state();
+
+// Looks up the state of a user.
+error_t *bpf_lookup_user(const bpf_handle *hnd, const char *userid, bpf_user *u,
+	bool *found);
+
+// Updates the state of a user.
+error_t *bpf_update_user(const bpf_handle *hnd, const char *userid, const bpf_user *u);
+
+// Deletes the state of a user.
+error_t *bpf_delete_user(const bpf_handle *hnd, const char *userid);
+
+// Updates the states of n users, with batched updates if supported.
+error_t *bpf_load_users(const bpf_handle *hnd, const bpf_userid *userids,
+	const bpf_user *us, const unsigned long n);
+
+// Sets an address owner map key from an address.
+void bpf_owner_key_of(const addr *a, bpf_owner_key *key);
+
+// Looks up the user ID that an address belongs to.
+error_t *bpf_lookup_owner(const bpf_handle *hnd, const addr *a, bpf_userid userid,
+	bool *found);
+
+// Records the user ID that an address belongs to.
+error_t *bpf_update_owner(const bpf_handle *hnd, const addr *a, const char *userid);
+
+// Deletes the record of the user ID that an address belongs to.
+error_t *bpf_delete_owner(const bpf_handle *hnd, const addr *a);
+
+// Records the user IDs that n addresses belong to, with batched updates if
+// supported.
+error_t *bpf_load_owners(const bpf_handle *hnd, const bpf_owner_key *keys,
+	const bpf_userid *userids, const unsigned long n);
+
+// Reads the number of users of a classid.
+error_t *bpf_read_hist(const bpf_handle *hnd, const uint16_t classid, uint32_t *n);
+
+// Writes the number of users of a classid.
+error_t *bpf_write_hist(const bpf_handle *hnd, const uint16_t classid, const uint32_t n);
+
+// Opens the traffic counter and load maps.
+error_t *bpf_open_stats(bpf_handle *hnd);
+
 // Closes the BPF maps.
 error_t *bpf_close(const bpf_handle *hnd);
 
@@ -37,12 +159,53 @@ error_t *bpf_update(const bpf_handle *hnd, const addr *addr, const uint16_t clas
 // Deletes an address to classid mapping.
 error_t *bpf_delete(const bpf_handle *hnd, const addr *addr);
 
+// Reads the BPF configuration, and sets the active set and generation in hnd
+// from it (done by bpf_open).
+error_t *bpf_read_config(bpf_handle *hnd, bpf_config *bcfg);
+
 // Updates the BPF configuration.
 error_t *bpf_update_config(const bpf_handle *hnd, const bpf_config *bcfg);
 
+// Reads the traffic counters for the n classids from lo.
+error_t *bpf_read_stats(const bpf_handle *hnd, const uint16_t lo, const uint32_t n,
+	classid_stats *s);
+
+// Reads the load state for the n classids from lo.
+error_t *bpf_read_loads(const bpf_handle *hnd, const uint16_t lo, const uint32_t n,
+	classid_load *l);
+
+// Writes the load state for the n classids from lo.
+error_t *bpf_write_loads(const bpf_handle *hnd, const uint16_t lo, const uint32_t n,
+	const classid_load *l);
+
+// Creates a new batch of updates. The flags are only used for per-element
+// fallback, as batched updates are always applied with BPF_ANY.
+bpf_batch *bpf_new_update_batch(const bpf_handle *hnd, const uint64_t flags);
+
+// Creates a new batch of deletes.
+bpf_batch *bpf_new_delete_batch(const bpf_handle *hnd);
+
+// Adds an address (and its classid, for updates) to a batch.
+void bpf_batch_add(bpf_batch *b, const addr *addr, const uint16_t classid);
+
+// Adds a dense key of address type t (and its classid, for updates) to a batch.
+void bpf_batch_add_key(bpf_batch *b, const addr_type t, const void *key,
+	const uint16_t classid);
+
+// Applies and empties a batch, falling back to per-element operations for this
+// and later applies of the batch if the kernel does not support batched map
+// operations.
+error_t *bpf_batch_apply(bpf_batch *b);
+
+// Frees a batch.
+void bpf_free_batch(bpf_batch *b);
+
 // Creates a new BPF maps iterator.
 bpf_it *bpf_new_it(const bpf_handle *hnd);
 
+// Creates a new iterator over the BPF map for one address type.
+bpf_it *bpf_new_type_it(const bpf_handle *hnd, const addr_type t);
+
 // Returns the next entry in the iteration (it->done == true if no more).
 error_t *bpf_next(bpf_it *it, addr *next, uint16_t *classid);
 
@@ -7,4 +7,5 @@ void init_bpf_config(const config *cfg, bpf_config *bcfg)
 	bcfg->flows_per_user = cfg->flows_per_user;
 	bcfg->uncl_flows_start = cfg->uncl_flows.lo;
 	bcfg->uncl_flows_len = u16_range_size(&cfg->uncl_flows);
+	bcfg->count_traffic = (cfg->assign == ASSIGN_TRAFFIC);
 }
@@ -5,11 +5,20 @@
 
 #define BPF_CONFIG_KEY 1
 
+// Number of address map sets, of which the datapath uses the active one.
+#define BPF_MAP_SETS 2
+
+// Maximum number of elements per address map.
+#define BPF_MAP_MAX_ELEM (65536 * 4)
+
 typedef struct {
 	classify_by classify_by;
 	uint16_t flows_per_user;
 	uint16_t uncl_flows_start;
 	uint16_t uncl_flows_len;
+	uint8_t count_traffic;
+	uint8_t active_set;
+	uint32_t generation;
 } bpf_config;
 
 // Initializes BPF config from tc-users config.
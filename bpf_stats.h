@@ -0,0 +1,24 @@
+#ifndef __BPF_STATS_H
+#define __BPF_STATS_H
+
+#include <stdint.h>
+
+// Number of classids with traffic counters (one per possible classid).
+#define BPF_STATS_LEN 65536
+
+// Traffic counters for a classid, shared by all CPUs and updated by the BPF
+// program with atomic adds.
+typedef struct {
+	uint64_t bytes;
+	uint64_t packets;
+} classid_stats;
+
+// Load state for a classid, kept by tc-users between runs: the byte counter
+// and time at the last run, and the EWMA of the byte rate in bytes/s.
+typedef struct {
+	uint64_t bytes;
+	uint64_t time;
+	uint64_t ewma;
+} classid_load;
+
+#endif
@@ -1,15 +1,22 @@
 #include <linux/unistd.h>
 #include <linux/bpf.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 #include <unistd.h>
 
 #include "bpflib.h"
+#include "bpfmock.h"
+
+#define POSSIBLE_CPUS_PATH "/sys/devices/system/cpu/possible"
 
 static __u64 ptr_to_u64(const void *ptr)
 {
 	return (__u64) (unsigned long) ptr;
 }
 
-int bpf_obj_get(const char *pathname)
+static int sys_obj_get(const char *pathname)
 {
 	union bpf_attr attr;
 
@@ -19,7 +26,48 @@ int bpf_obj_get(const char *pathname)
 	return syscall(__NR_bpf, BPF_OBJ_GET, &attr, sizeof(attr));
 }
 
-int bpf_get_next_key(const int fd, const void *key, void *next_key)
+static int sys_obj_pin(const int fd, const char *pathname)
+{
+	union bpf_attr attr;
+
+	attr = (const union bpf_attr){{0}};
+	attr.bpf_fd = fd;
+	attr.pathname = ptr_to_u64((void *)pathname);
+
+	return syscall(__NR_bpf, BPF_OBJ_PIN, &attr, sizeof(attr));
+}
+
+static int sys_obj_unpin(const char *pathname)
+{
+	return unlink(pathname);
+}
+
+static int sys_obj_rename(const char *oldpath, const char *newpath)
+{
+	return rename(oldpath, newpath);
+}
+
+static int sys_obj_close(const int fd)
+{
+	return close(fd);
+}
+
+static int sys_create_map(const unsigned int type, const unsigned int key_size,
+	const unsigned int value_size, const unsigned int max_entries, const unsigned int flags)
+{
+	union bpf_attr attr;
+
+	attr = (const union bpf_attr){{0}};
+	attr.map_type = type;
+	attr.key_size = key_size;
+	attr.value_size = value_size;
+	attr.max_entries = max_entries;
+	attr.map_flags = flags;
+
+	return syscall(__NR_bpf, BPF_MAP_CREATE, &attr, sizeof(attr));
+}
+
+static int sys_get_next_key(const int fd, const void *key, void *next_key)
 {
 	union bpf_attr attr;
 
@@ -31,7 +79,7 @@ int bpf_get_next_key(const int fd, const void *key, void *next_key)
 	return syscall(__NR_bpf, BPF_MAP_GET_NEXT_KEY, &attr, sizeof(attr));
 }
 
-int bpf_lookup_elem(const int fd, const void *key, void *value)
+static int sys_lookup_elem(const int fd, const void *key, void *value)
 {
 	union bpf_attr attr;
 
@@ -43,7 +91,8 @@ int bpf_lookup_elem(const int fd, const void *key, void *value)
 	return syscall(__NR_bpf, BPF_MAP_LOOKUP_ELEM, &attr, sizeof(attr));
 }
 
-int bpf_update_elem(const int fd, const void *key, const void *value, unsigned long long flags)
+static int sys_update_elem(const int fd, const void *key, const void *value,
+	const unsigned long long flags)
 {
 	union bpf_attr attr;
 
@@ -56,7 +105,7 @@ int bpf_update_elem(const int fd, const void *key, const void *value, unsigned l
 	return syscall(__NR_bpf, BPF_MAP_UPDATE_ELEM, &attr, sizeof(attr));
 }
 
-int bpf_delete_elem(const int fd, const void *key)
+static int sys_delete_elem(const int fd, const void *key)
 {
 	union bpf_attr attr;
 
@@ -66,3 +115,210 @@ int bpf_delete_elem(const int fd, const void *key)
 
 	return syscall(__NR_bpf, BPF_MAP_DELETE_ELEM, &attr, sizeof(attr));
 }
+
+static int sys_lookup_batch(const int fd, void *in_batch, void *out_batch, void *keys,
+	void *values, unsigned int *count)
+{
+	union bpf_attr attr;
+	int r;
+
+	attr = (const union bpf_attr){{0}};
+	attr.batch.map_fd = fd;
+	attr.batch.in_batch = ptr_to_u64(in_batch);
+	attr.batch.out_batch = ptr_to_u64(out_batch);
+	attr.batch.keys = ptr_to_u64(keys);
+	attr.batch.values = ptr_to_u64(values);
+	attr.batch.count = *count;
+
+	r = syscall(__NR_bpf, BPF_MAP_LOOKUP_BATCH, &attr, sizeof(attr));
+	*count = attr.batch.count;
+
+	return r;
+}
+
+static int sys_update_batch(const int fd, const void *keys, const void *values, unsigned int *count,
+	const unsigned long long flags)
+{
+	union bpf_attr attr;
+	int r;
+
+	attr = (const union bpf_attr){{0}};
+	attr.batch.map_fd = fd;
+	attr.batch.keys = ptr_to_u64(keys);
+	attr.batch.values = ptr_to_u64(values);
+	attr.batch.count = *count;
+	attr.batch.elem_flags = flags;
+
+	r = syscall(__NR_bpf, BPF_MAP_UPDATE_BATCH, &attr, sizeof(attr));
+	*count = attr.batch.count;
+
+	return r;
+}
+
+static int sys_delete_batch(const int fd, const void *keys, unsigned int *count)
+{
+	union bpf_attr attr;
+	int r;
+
+	attr = (const union bpf_attr){{0}};
+	attr.batch.map_fd = fd;
+	attr.batch.keys = ptr_to_u64(keys);
+	attr.batch.count = *count;
+
+	r = syscall(__NR_bpf, BPF_MAP_DELETE_BATCH, &attr, sizeof(attr));
+	*count = attr.batch.count;
+
+	return r;
+}
+
+// Kernel backend.
+static const bpf_backend g_sys_backend = {
+	sys_obj_get,
+	sys_obj_pin,
+	sys_obj_unpin,
+	sys_obj_rename,
+	sys_obj_close,
+	sys_create_map,
+	sys_get_next_key,
+	sys_lookup_elem,
+	sys_update_elem,
+	sys_delete_elem,
+	sys_lookup_batch,
+	sys_update_batch,
+	sys_delete_batch,
+};
+
+// Selected backend and mock directory (NULL for the kernel).
+static const bpf_backend *g_backend;
+static const char *g_mock_dir;
+
+// Returns the backend, selecting it on first use.
+static const bpf_backend *backend()
+{
+	if (!g_backend) {
+		g_mock_dir = getenv(BPF_MOCK_ENV);
+#ifdef BPF_MOCK_DIR
+		if (!g_mock_dir) {
+			g_mock_dir = BPF_MOCK_DIR;
+		}
+#endif
+		if (g_mock_dir && *g_mock_dir) {
+			g_backend = mock_backend(g_mock_dir);
+		} else {
+			g_mock_dir = NULL;
+			g_backend = &g_sys_backend;
+		}
+	}
+
+	return g_backend;
+}
+
+bool bpf_mocked()
+{
+	return backend() != &g_sys_backend;
+}
+
+const char *bpf_state_path(const char *path, char *buf)
+{
+	const char *base;
+
+	if (!bpf_mocked()) {
+		return path;
+	}
+	base = strrchr(path, '/');
+	snprintf(buf, PATH_MAX, "%s/%s", g_mock_dir, (base ? base + 1 : path));
+
+	return buf;
+}
+
+int bpf_possible_cpus()
+{
+	static int n;
+	int lo, hi;
+	FILE *f;
+
+	if (n == 0) {
+		n = 1;
+		if ((f = fopen(POSSIBLE_CPUS_PATH, "r"))) {
+			switch (fscanf(f, "%d-%d", &lo, &hi)) {
+			case 2:
+				n = hi + 1;
+				break;
+			case 1:
+				n = lo + 1;
+				break;
+			}
+			fclose(f);
+		}
+	}
+
+	return n;
+}
+
+int bpf_obj_get(const char *pathname)
+{
+	return backend()->obj_get(pathname);
+}
+
+int bpf_obj_pin(const int fd, const char *pathname)
+{
+	return backend()->obj_pin(fd, pathname);
+}
+
+int bpf_obj_unpin(const char *pathname)
+{
+	return backend()->obj_unpin(pathname);
+}
+
+int bpf_obj_rename(const char *oldpath, const char *newpath)
+{
+	return backend()->obj_rename(oldpath, newpath);
+}
+
+int bpf_obj_close(const int fd)
+{
+	return backend()->obj_close(fd);
+}
+
+int bpf_create_map(const unsigned int type, const unsigned int key_size,
+	const unsigned int value_size, const unsigned int max_entries, const unsigned int flags)
+{
+	return backend()->create_map(type, key_size, value_size, max_entries, flags);
+}
+
+int bpf_get_next_key(const int fd, const void *key, void *next_key)
+{
+	return backend()->get_next_key(fd, key, next_key);
+}
+
+int bpf_lookup_elem(const int fd, const void *key, void *value)
+{
+	return backend()->lookup_elem(fd, key, value);
+}
+
+int bpf_update_elem(const int fd, const void *key, const void *value, const unsigned long long flags)
+{
+	return backend()->update_elem(fd, key, value, flags);
+}
+
+int bpf_delete_elem(const int fd, const void *key)
+{
+	return backend()->delete_elem(fd, key);
+}
+
+int bpf_lookup_batch(const int fd, void *in_batch, void *out_batch, void *keys,
+	void *values, unsigned int *count)
+{
+	return backend()->lookup_batch(fd, in_batch, out_batch, keys, values, count);
+}
+
+int bpf_update_batch(const int fd, const void *keys, const void *values, unsigned int *count,
+	const unsigned long long flags)
+{
+	return backend()->update_batch(fd, keys, values, count, flags);
+}
+
+int bpf_delete_batch(const int fd, const void *keys, unsigned int *count)
+{
+	return backend()->delete_batch(fd, keys, count);
+}
@@ -1,8 +1,65 @@
 #ifndef __BPFLIB_H
 #define __BPFLIB_H
 
+#include <stdbool.h>
+
+// Environment variable that selects the mock backend, set to the directory to
+// keep its pinned maps in. The default is set at build time by BPF_MOCK_DIR.
+#define BPF_MOCK_ENV "TC_USERS_MOCK_BPF"
+
+// Environment variable that sets the maximum entries of the mock backend's
+// address maps, instead of BPF_MAP_MAX_ELEM, for tests and benchmarks with
+// larger tables. Maps sized by a multiple of BPF_MAP_MAX_ELEM, like the user
+// state maps, are scaled with it.
+#define BPF_MOCK_MAX_ELEM_ENV "TC_USERS_MOCK_MAX_ELEM"
+
+// Backend for BPF object and map operations, either the kernel (with the bpf
+// syscall) or an in-memory mock. All return -1 and set errno on failure.
+typedef struct {
+	int (*obj_get)(const char *pathname);
+	int (*obj_pin)(const int fd, const char *pathname);
+	int (*obj_unpin)(const char *pathname);
+	int (*obj_rename)(const char *oldpath, const char *newpath);
+	int (*obj_close)(const int fd);
+	int (*create_map)(const unsigned int type, const unsigned int key_size,
+		const unsigned int value_size, const unsigned int max_entries,
+		const unsigned int flags);
+	int (*get_next_key)(const int fd, const void *key, void *next_key);
+	int (*lookup_elem)(const int fd, const void *key, void *value);
+	int (*update_elem)(const int fd, const void *key, const void *value,
+		const unsigned long long flags);
+	int (*delete_elem)(const int fd, const void *key);
+	int (*lookup_batch)(const int fd, void *in_batch, void *out_batch, void *keys,
+		void *values, unsigned int *count);
+	int (*update_batch)(const int fd, const void *keys, const void *values,
+		unsigned int *count, const unsigned long long flags);
+	int (*delete_batch)(const int fd, const void *keys, unsigned int *count);
+} bpf_backend;
+
+// Returns true if the mock backend is in use.
+bool bpf_mocked();
+
+// Returns the path for a local state file, in the mock directory if the mock
+// backend is in use (buf must have room for PATH_MAX bytes).
+const char *bpf_state_path(const char *path, char *buf);
+
+// Returns the number of possible CPUs, which per-CPU map values are sized by.
+int bpf_possible_cpus();
+
 int bpf_obj_get(const char *pathname);
 
+int bpf_obj_pin(const int fd, const char *pathname);
+
+int bpf_obj_unpin(const char *pathname);
+
+// Moves a pin to a new path, atomically replacing any pin already there.
+int bpf_obj_rename(const char *oldpath, const char *newpath);
+
+int bpf_obj_close(const int fd);
+
+int bpf_create_map(const unsigned int type, const unsigned int key_size,
+	const unsigned int value_size, const unsigned int max_entries, const unsigned int flags);
+
 int bpf_get_next_key(const int fd, const void *key, void *next_key);
 
 int bpf_lookup_elem(const int fd, const void *key, void *value);
@@ -11,4 +68,12 @@ int bpf_update_elem(const int fd, const void *key, const void *value, const unsi
 
 int bpf_delete_elem(const int fd, const void *key);
 
+int bpf_lookup_batch(const int fd, void *in_batch, void *out_batch, void *keys,
+	void *values, unsigned int *count);
+
+int bpf_update_batch(const int fd, const void *keys, const void *values, unsigned int *count,
+	const unsigned long long flags);
+
+int bpf_delete_batch(const int fd, const void *keys, unsigned int *count);
+
 #endif
@@ -0,0 +1,852 @@
+#include <errno.h>
+#include <limits.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include <linux/bpf.h>
+
+#include "addr.h"
+#include "bpf_config.h"
+#include "bpf_stats.h"
+#include "bpfmock.h"
+
+#define MOCK_MAGIC "TCUMOCK"
+#define MOCK_MAGIC_LEN 8
+#define MOCK_VERSION 1
+#define INITCAP_MAP 64
+#define INITCAP_FDS 16
+
+// First mock file descriptor, far above real ones so they're never confused.
+#define MOCK_FD_BASE (1 << 24)
+
+// Slot states.
+enum slot_state {
+	SLOT_EMPTY,
+	SLOT_USED,
+	SLOT_DELETED,
+};
+
+// In-memory map, an open addressing hash table with linear probing, so that
+// iteration follows slot order as a kernel hash map's follows its buckets.
+// Array maps use the same table, with absent indexes reading as zeros.
+typedef struct {
+	unsigned int type;
+	unsigned int key_size;
+	unsigned int value_size;
+	unsigned int max_entries;
+	unsigned int flags;
+	uint8_t *keys;
+	uint8_t *values;
+	uint8_t *states;
+	uint32_t cap;
+	uint32_t len;
+	uint32_t used;
+	char *pin;
+	bool dirty;
+	int refs;
+} mock_map;
+
+// Header of a pinned map file, followed by the keys then the values.
+typedef struct {
+	char magic[MOCK_MAGIC_LEN];
+	uint32_t version;
+	uint32_t type;
+	uint32_t key_size;
+	uint32_t value_size;
+	uint32_t max_entries;
+	uint32_t flags;
+	uint32_t len;
+} mock_header;
+
+// Map that the tc loader pins from tc-users-bpf.o.
+typedef struct {
+	const char *name;
+	unsigned int type;
+	unsigned int key_size;
+	unsigned int value_size;
+	unsigned int max_entries;
+	unsigned int flags;
+} mock_spec;
+
+static const mock_spec g_specs[] = {
+	{"tc_users_mac", BPF_MAP_TYPE_HASH, MAC_LEN, sizeof(uint16_t), BPF_MAP_MAX_ELEM,
+		BPF_F_NO_PREALLOC},
+	{"tc_users_ip4", BPF_MAP_TYPE_HASH, IP4_LEN, sizeof(uint16_t), BPF_MAP_MAX_ELEM,
+		BPF_F_NO_PREALLOC},
+	{"tc_users_ip6", BPF_MAP_TYPE_HASH, IP6_LEN, sizeof(uint16_t), BPF_MAP_MAX_ELEM,
+		BPF_F_NO_PREALLOC},
+	{"tc_users_mac_sets", BPF_MAP_TYPE_ARRAY_OF_MAPS, sizeof(uint32_t),
+		sizeof(uint32_t), BPF_MAP_SETS, 0},
+	{"tc_users_ip4_sets", BPF_MAP_TYPE_ARRAY_OF_MAPS, sizeof(uint32_t),
+		sizeof(uint32_t), BPF_MAP_SETS, 0},
+	{"tc_users_ip6_sets", BPF_MAP_TYPE_ARRAY_OF_MAPS, sizeof(uint32_t),
+		sizeof(uint32_t), BPF_MAP_SETS, 0},
+	{"tc_users_config", BPF_MAP_TYPE_HASH, sizeof(uint8_t), sizeof(bpf_config), 1, 0},
+	{"tc_users_stats", BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(classid_stats),
+		BPF_STATS_LEN, 0},
+	{"tc_users_load", BPF_MAP_TYPE_ARRAY, sizeof(uint32_t), sizeof(classid_load),
+		BPF_STATS_LEN, 0},
+};
+
+// Mock state: the directory, the address map size, all maps, and the map for
+// each open fd (fds are MOCK_FD_BASE plus the index). All operations hold the
+// mutex.
+static const char *g_dir;
+static unsigned int g_max_elem = BPF_MAP_MAX_ELEM;
+static mock_map **g_maps;
+static unsigned int g_nmaps;
+static mock_map **g_fds;
+static unsigned int g_nfds;
+static pthread_mutex_t g_mu = PTHREAD_MUTEX_INITIALIZER;
+
+// Returns -1 with errno set to err.
+static int fail(const int err)
+{
+	errno = err;
+	return -1;
+}
+
+// Returns true for the array map types, which have uint32_t index keys.
+static bool is_array(const mock_map *m)
+{
+	return m->type == BPF_MAP_TYPE_ARRAY || m->type == BPF_MAP_TYPE_PERCPU_ARRAY ||
+		m->type == BPF_MAP_TYPE_ARRAY_OF_MAPS;
+}
+
+// Returns the FNV-1a hash of a key.
+static uint32_t hash_key(const uint8_t *key, const unsigned int len)
+{
+	uint32_t h = 2166136261u;
+	unsigned int i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ key[i]) * 16777619u;
+	}
+
+	return h;
+}
+
+// Returns the slot index of a key, or -1 if it's not in the map.
+static long find_slot(const mock_map *m, const void *key)
+{
+	uint32_t i;
+
+	if (m->cap == 0) {
+		return -1;
+	}
+	for (i = hash_key(key, m->key_size) & (m->cap - 1); m->states[i] != SLOT_EMPTY;
+		i = (i + 1) & (m->cap - 1)) {
+		if (m->states[i] == SLOT_USED &&
+			!memcmp(&m->keys[i * m->key_size], key, m->key_size)) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// Returns the first used slot at or after i, or -1 if there are none.
+static long next_used(const mock_map *m, uint32_t i)
+{
+	for (; i < m->cap; i++) {
+		if (m->states[i] == SLOT_USED) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+// Resizes the table to cap slots, dropping deleted slots.
+static void resize_map(mock_map *m, const uint32_t cap)
+{
+	mock_map old = *m;
+	uint32_t i, j;
+
+	m->keys = malloc((size_t) cap * m->key_size);
+	m->values = malloc((size_t) cap * m->value_size);
+	m->states = calloc(cap, 1);
+	m->cap = cap;
+	m->used = old.len;
+	for (i = 0; i < old.cap; i++) {
+		if (old.states[i] != SLOT_USED) {
+			continue;
+		}
+		for (j = hash_key(&old.keys[i * m->key_size], m->key_size) & (cap - 1);
+			m->states[j] != SLOT_EMPTY; j = (j + 1) & (cap - 1)) {
+		}
+		memcpy(&m->keys[j * m->key_size], &old.keys[i * m->key_size], m->key_size);
+		memcpy(&m->values[j * m->value_size], &old.values[i * m->value_size],
+			m->value_size);
+		m->states[j] = SLOT_USED;
+	}
+	free(old.keys);
+	free(old.values);
+	free(old.states);
+}
+
+// Inserts a key that is not in the map.
+static void insert_key(mock_map *m, const void *key, const void *value)
+{
+	uint32_t cap, i;
+
+	if ((m->used + 1) * 4 > m->cap * 3) {
+		for (cap = INITCAP_MAP; cap < (m->len + 1) * 2; cap *= 2) {
+		}
+		resize_map(m, cap);
+	}
+	for (i = hash_key(key, m->key_size) & (m->cap - 1); m->states[i] == SLOT_USED;
+		i = (i + 1) & (m->cap - 1)) {
+	}
+	if (m->states[i] == SLOT_EMPTY) {
+		m->used++;
+	}
+	memcpy(&m->keys[i * m->key_size], key, m->key_size);
+	memcpy(&m->values[i * m->value_size], value, m->value_size);
+	m->states[i] = SLOT_USED;
+	m->len++;
+}
+
+// Returns the maximum entries for a new map, scaling hash maps sized by a
+// multiple of BPF_MAP_MAX_ELEM to g_max_elem.
+static unsigned int scale_max_entries(const unsigned int type,
+	const unsigned int max_entries)
+{
+	if (type != BPF_MAP_TYPE_HASH || max_entries % BPF_MAP_MAX_ELEM) {
+		return max_entries;
+	}
+	return max_entries / BPF_MAP_MAX_ELEM * g_max_elem;
+}
+
+// Creates a new map, with per-CPU values sized for all possible CPUs.
+static mock_map *new_map(const unsigned int type, const unsigned int key_size,
+	const unsigned int value_size, const unsigned int max_entries,
+	const unsigned int flags)
+{
+	mock_map *m = malloc(sizeof(mock_map));
+
+	*m = (const mock_map){type, key_size, value_size, max_entries, flags};
+	if (type == BPF_MAP_TYPE_PERCPU_ARRAY || type == BPF_MAP_TYPE_PERCPU_HASH) {
+		m->value_size = ((value_size + 7) & ~7) * bpf_possible_cpus();
+	}
+	g_maps = realloc(g_maps, (g_nmaps + 1) * sizeof(mock_map *));
+	g_maps[g_nmaps++] = m;
+
+	return m;
+}
+
+// Frees a map that is neither pinned nor open.
+static void release_map(mock_map *m)
+{
+	unsigned int i;
+
+	if (m->refs > 0 || m->pin) {
+		return;
+	}
+	for (i = 0; i < g_nmaps; i++) {
+		if (g_maps[i] == m) {
+			g_maps[i] = g_maps[--g_nmaps];
+			break;
+		}
+	}
+	free(m->keys);
+	free(m->values);
+	free(m->states);
+	free(m);
+}
+
+// Returns a new fd for a map.
+static int new_fd(mock_map *m)
+{
+	unsigned int i;
+
+	for (i = 0; i < g_nfds && g_fds[i]; i++) {
+	}
+	if (i == g_nfds) {
+		g_nfds = (g_nfds ? g_nfds * 2 : INITCAP_FDS);
+		g_fds = realloc(g_fds, g_nfds * sizeof(mock_map *));
+		memset(&g_fds[i], 0, (g_nfds - i) * sizeof(mock_map *));
+	}
+	g_fds[i] = m;
+	m->refs++;
+
+	return MOCK_FD_BASE + i;
+}
+
+// Returns the map for an fd, or NULL with errno set to EBADF.
+static mock_map *fd_map(const int fd)
+{
+	unsigned int i = fd - MOCK_FD_BASE;
+
+	if (fd < MOCK_FD_BASE || i >= g_nfds || !g_fds[i]) {
+		errno = EBADF;
+		return NULL;
+	}
+
+	return g_fds[i];
+}
+
+// Returns the basename of a pin path.
+static const char *pin_name(const char *pathname)
+{
+	const char *base = strrchr(pathname, '/');
+
+	return (base ? base + 1 : pathname);
+}
+
+// Returns the pinned map with a name, or NULL if it's not loaded.
+static mock_map *find_pinned(const char *name)
+{
+	unsigned int i;
+
+	for (i = 0; i < g_nmaps; i++) {
+		if (g_maps[i]->pin && !strcmp(g_maps[i]->pin, name)) {
+			return g_maps[i];
+		}
+	}
+
+	return NULL;
+}
+
+// Returns the file path for a pin name in buf (PATH_MAX bytes).
+static const char *pin_file(const char *name, char *buf)
+{
+	snprintf(buf, PATH_MAX, "%s/%s", g_dir, name);
+	return buf;
+}
+
+// Loads a pinned map from its file, or returns NULL with errno set.
+static mock_map *load_map(const char *name)
+{
+	char path[PATH_MAX];
+	mock_map *m = NULL;
+	uint8_t *keys, *vals;
+	mock_header h;
+	uint32_t i;
+	FILE *fp;
+
+	if ((fp = fopen(pin_file(name, path), "r")) == NULL) {
+		return NULL;
+	}
+	if (fread(&h, sizeof(h), 1, fp) != 1 || memcmp(h.magic, MOCK_MAGIC, MOCK_MAGIC_LEN) ||
+		h.version != MOCK_VERSION) {
+		fclose(fp);
+		errno = EINVAL;
+		return NULL;
+	}
+	m = new_map(h.type, h.key_size, h.value_size, h.max_entries, h.flags);
+	m->value_size = h.value_size;
+	keys = malloc((size_t) h.len * h.key_size);
+	vals = malloc((size_t) h.len * h.value_size);
+	if (fread(keys, h.key_size, h.len, fp) == h.len &&
+		fread(vals, h.value_size, h.len, fp) == h.len) {
+		for (i = 0; i < h.len; i++) {
+			insert_key(m, &keys[i * h.key_size], &vals[i * h.value_size]);
+		}
+		m->pin = strdup(name);
+	} else {
+		release_map(m);
+		m = NULL;
+		errno = EINVAL;
+	}
+	free(vals);
+	free(keys);
+	fclose(fp);
+
+	return m;
+}
+
+// Saves a pinned map to its file.
+static void save_map(const mock_map *m)
+{
+	mock_header h = {{0}, MOCK_VERSION, m->type, m->key_size, m->value_size,
+		m->max_entries, m->flags, m->len};
+	char path[PATH_MAX], tmp[PATH_MAX+4];
+	uint32_t i;
+	FILE *fp;
+
+	memcpy(h.magic, MOCK_MAGIC, MOCK_MAGIC_LEN);
+
+	pin_file(m->pin, path);
+	snprintf(tmp, sizeof(tmp), "%s.tmp", path);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		fprintf(stderr, "Warning: unable to save mock map '%s', %s\n", path,
+			strerror(errno));
+		return;
+	}
+	fwrite(&h, sizeof(h), 1, fp);
+	for (i = 0; i < m->cap; i++) {
+		if (m->states[i] == SLOT_USED) {
+			fwrite(&m->keys[i * m->key_size], m->key_size, 1, fp);
+		}
+	}
+	for (i = 0; i < m->cap; i++) {
+		if (m->states[i] == SLOT_USED) {
+			fwrite(&m->values[i * m->value_size], m->value_size, 1, fp);
+		}
+	}
+	if (fclose(fp) == 0) {
+		rename(tmp, path);
+	} else {
+		unlink(tmp);
+	}
+}
+
+// Saves all changed pinned maps, at exit.
+static void save_maps()
+{
+	unsigned int i;
+
+	pthread_mutex_lock(&g_mu);
+	for (i = 0; i < g_nmaps; i++) {
+		if (g_maps[i]->pin && g_maps[i]->dirty) {
+			save_map(g_maps[i]);
+			g_maps[i]->dirty = false;
+		}
+	}
+	pthread_mutex_unlock(&g_mu);
+}
+
+static int mock_obj_get(const char *pathname)
+{
+	const char *name = pin_name(pathname);
+	mock_map *m;
+	size_t i;
+	int fd = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if (!(m = find_pinned(name)) && !(m = load_map(name)) && errno == ENOENT) {
+		for (i = 0; i < sizeof(g_specs) / sizeof(g_specs[0]); i++) {
+			if (!strcmp(g_specs[i].name, name)) {
+				m = new_map(g_specs[i].type, g_specs[i].key_size,
+					g_specs[i].value_size,
+					scale_max_entries(g_specs[i].type, g_specs[i].max_entries),
+					g_specs[i].flags);
+				m->pin = strdup(name);
+				m->dirty = true;
+				break;
+			}
+		}
+		errno = ENOENT;
+	}
+	if (m) {
+		fd = new_fd(m);
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return fd;
+}
+
+static int mock_obj_pin(const int fd, const char *pathname)
+{
+	const char *name = pin_name(pathname);
+	char path[PATH_MAX];
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if (!(m = fd_map(fd))) {
+		goto out;
+	}
+	if (m->pin || find_pinned(name) || access(pin_file(name, path), F_OK) == 0) {
+		errno = EEXIST;
+		goto out;
+	}
+	m->pin = strdup(name);
+	m->dirty = true;
+	r = 0;
+
+out:
+	pthread_mutex_unlock(&g_mu);
+	return r;
+}
+
+static int mock_obj_unpin(const char *pathname)
+{
+	const char *name = pin_name(pathname);
+	char path[PATH_MAX];
+	mock_map *m;
+	int r;
+
+	pthread_mutex_lock(&g_mu);
+	r = unlink(pin_file(name, path));
+	if ((m = find_pinned(name))) {
+		free(m->pin);
+		m->pin = NULL;
+		release_map(m);
+		r = 0;
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return (r == 0 ? 0 : fail(ENOENT));
+}
+
+static int mock_obj_rename(const char *oldpath, const char *newpath)
+{
+	const char *name = pin_name(newpath);
+	char opath[PATH_MAX], npath[PATH_MAX];
+	mock_map *m, *prev;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if (!(m = find_pinned(pin_name(oldpath))) && !(m = load_map(pin_name(oldpath)))) {
+		goto out;
+	}
+	if ((prev = find_pinned(name)) && prev != m) {
+		free(prev->pin);
+		prev->pin = NULL;
+		release_map(prev);
+	}
+	// a map pinned since the last save has no file yet, and is saved at exit
+	rename(pin_file(m->pin, opath), pin_file(name, npath));
+	free(m->pin);
+	m->pin = strdup(name);
+	m->dirty = true;
+	r = 0;
+
+out:
+	pthread_mutex_unlock(&g_mu);
+	return r;
+}
+
+static int mock_obj_close(const int fd)
+{
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if ((m = fd_map(fd))) {
+		g_fds[fd - MOCK_FD_BASE] = NULL;
+		m->refs--;
+		release_map(m);
+		r = 0;
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return r;
+}
+
+static int mock_create_map(const unsigned int type, const unsigned int key_size,
+	const unsigned int value_size, const unsigned int max_entries,
+	const unsigned int flags)
+{
+	int fd;
+
+	if (key_size == 0 || value_size == 0 || max_entries == 0) {
+		return fail(EINVAL);
+	}
+	pthread_mutex_lock(&g_mu);
+	fd = new_fd(new_map(type, key_size, value_size,
+		scale_max_entries(type, max_entries), flags));
+	pthread_mutex_unlock(&g_mu);
+
+	return fd;
+}
+
+// Returns the next key after key (or the first if key is NULL or not found).
+static int find_next_key(const mock_map *m, const void *key, void *next)
+{
+	uint32_t idx;
+	long i;
+
+	if (is_array(m)) {
+		idx = 0;
+		if (key && *(const uint32_t *) key < m->max_entries) {
+			idx = *(const uint32_t *) key + 1;
+		}
+		if (idx >= m->max_entries) {
+			return fail(ENOENT);
+		}
+		memcpy(next, &idx, sizeof(idx));
+		return 0;
+	}
+
+	i = (key ? find_slot(m, key) : -1);
+	if ((i = next_used(m, i + 1)) == -1) {
+		return fail(ENOENT);
+	}
+	memcpy(next, &m->keys[i * m->key_size], m->key_size);
+
+	return 0;
+}
+
+// Looks up a key.
+static int lookup_key(const mock_map *m, const void *key, void *value)
+{
+	long i;
+
+	if (is_array(m) && *(const uint32_t *) key >= m->max_entries) {
+		return fail(ENOENT);
+	}
+	if ((i = find_slot(m, key)) != -1) {
+		memcpy(value, &m->values[i * m->value_size], m->value_size);
+	} else if (is_array(m)) {
+		memset(value, 0, m->value_size);
+	} else {
+		return fail(ENOENT);
+	}
+
+	return 0;
+}
+
+// Updates a key, with BPF_ANY, BPF_NOEXIST or BPF_EXIST semantics.
+static int update_key(mock_map *m, const void *key, const void *value,
+	const unsigned long long flags)
+{
+	long i;
+
+	if (flags > BPF_EXIST) {
+		return fail(EINVAL);
+	}
+	if (is_array(m)) {
+		if (*(const uint32_t *) key >= m->max_entries) {
+			return fail(E2BIG);
+		}
+		if (flags == BPF_NOEXIST) {
+			return fail(EEXIST);
+		}
+	}
+	if ((i = find_slot(m, key)) != -1) {
+		if (flags == BPF_NOEXIST) {
+			return fail(EEXIST);
+		}
+		memcpy(&m->values[i * m->value_size], value, m->value_size);
+	} else if (flags == BPF_EXIST && !is_array(m)) {
+		return fail(ENOENT);
+	} else if (!is_array(m) && m->len >= m->max_entries) {
+		return fail(E2BIG);
+	} else {
+		insert_key(m, key, value);
+	}
+	m->dirty = true;
+
+	return 0;
+}
+
+// Deletes a key.
+static int delete_key(mock_map *m, const void *key)
+{
+	long i;
+
+	if (m->type == BPF_MAP_TYPE_ARRAY || m->type == BPF_MAP_TYPE_PERCPU_ARRAY) {
+		return fail(EINVAL);
+	}
+	if ((i = find_slot(m, key)) == -1) {
+		return fail(ENOENT);
+	}
+	m->states[i] = SLOT_DELETED;
+	m->len--;
+	m->dirty = true;
+
+	return 0;
+}
+
+static int mock_get_next_key(const int fd, const void *key, void *next_key)
+{
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if ((m = fd_map(fd))) {
+		r = find_next_key(m, key, next_key);
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return r;
+}
+
+static int mock_lookup_elem(const int fd, const void *key, void *value)
+{
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if ((m = fd_map(fd))) {
+		r = lookup_key(m, key, value);
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return r;
+}
+
+static int mock_update_elem(const int fd, const void *key, const void *value,
+	const unsigned long long flags)
+{
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if ((m = fd_map(fd))) {
+		r = update_key(m, key, value, flags);
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return r;
+}
+
+static int mock_delete_elem(const int fd, const void *key)
+{
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if ((m = fd_map(fd))) {
+		r = delete_key(m, key);
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return r;
+}
+
+// Looks up a batch of array map elements in index order. As in the kernel's
+// generic batch lookup, in_batch is the index before the first one (or NULL
+// to start at zero), and out_batch is set to the last index copied. Returns
+// ENOENT if the end is reached before count elements are copied.
+static int lookup_array_batch(const mock_map *m, const void *in_batch,
+	void *out_batch, void *keys, void *values, unsigned int *count)
+{
+	uint32_t idx = 0;
+	unsigned int n;
+
+	if (in_batch) {
+		idx = *(const uint32_t *) in_batch + 1;
+	}
+	for (n = 0; n < *count && idx < m->max_entries; n++, idx++) {
+		memcpy((uint8_t *) keys + n * sizeof(idx), &idx, sizeof(idx));
+		lookup_key(m, &idx, (uint8_t *) values + n * m->value_size);
+	}
+	if (n > 0) {
+		idx--;
+		memcpy(out_batch, &idx, sizeof(idx));
+	}
+	if (n < *count) {
+		*count = n;
+		return fail(ENOENT);
+	}
+
+	return 0;
+}
+
+// Looks up a batch of hash map elements in slot order, with the slot to start
+// at as the batch token. Like the kernel, returns ENOENT once the end is
+// reached, with count set to the number of elements copied. Array maps are
+// looked up by lookup_array_batch.
+static int mock_lookup_batch(const int fd, void *in_batch, void *out_batch, void *keys,
+	void *values, unsigned int *count)
+{
+	uint32_t slot = 0;
+	unsigned int n = 0;
+	mock_map *m;
+	long i = 0;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if (!(m = fd_map(fd))) {
+		goto out;
+	}
+	if (is_array(m)) {
+		r = lookup_array_batch(m, in_batch, out_batch, keys, values, count);
+		goto out;
+	}
+	if (in_batch) {
+		memcpy(&slot, in_batch, sizeof(slot));
+	}
+	for (i = slot; n < *count && (i = next_used(m, i)) != -1; i++, n++) {
+		memcpy((uint8_t *) keys + n * m->key_size, &m->keys[i * m->key_size],
+			m->key_size);
+		memcpy((uint8_t *) values + n * m->value_size, &m->values[i * m->value_size],
+			m->value_size);
+	}
+	if (i != -1 && next_used(m, i) != -1) {
+		slot = i;
+		memcpy(out_batch, &slot, sizeof(slot));
+		r = 0;
+	} else {
+		errno = ENOENT;
+	}
+	*count = n;
+
+out:
+	pthread_mutex_unlock(&g_mu);
+	return r;
+}
+
+static int mock_update_batch(const int fd, const void *keys, const void *values,
+	unsigned int *count, const unsigned long long flags)
+{
+	unsigned int n = 0;
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if ((m = fd_map(fd))) {
+		for (r = 0; n < *count && r == 0; n++) {
+			r = update_key(m, (const uint8_t *) keys + n * m->key_size,
+				(const uint8_t *) values + n * m->value_size, flags);
+		}
+		if (r == -1) {
+			n--;
+		}
+		*count = n;
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return r;
+}
+
+static int mock_delete_batch(const int fd, const void *keys, unsigned int *count)
+{
+	unsigned int n = 0;
+	mock_map *m;
+	int r = -1;
+
+	pthread_mutex_lock(&g_mu);
+	if ((m = fd_map(fd))) {
+		for (r = 0; n < *count && r == 0; n++) {
+			r = delete_key(m, (const uint8_t *) keys + n * m->key_size);
+		}
+		if (r == -1) {
+			n--;
+		}
+		*count = n;
+	}
+	pthread_mutex_unlock(&g_mu);
+
+	return r;
+}
+
+static const bpf_backend g_mock_backend = {
+	mock_obj_get,
+	mock_obj_pin,
+	mock_obj_unpin,
+	mock_obj_rename,
+	mock_obj_close,
+	mock_create_map,
+	mock_get_next_key,
+	mock_lookup_elem,
+	mock_update_elem,
+	mock_delete_elem,
+	mock_lookup_batch,
+	mock_update_batch,
+	mock_delete_batch,
+};
+
+const bpf_backend *mock_backend(const char *dir)
+{
+	const char *max = getenv(BPF_MOCK_MAX_ELEM_ENV);
+	unsigned long n;
+
+	if (max && (n = strtoul(max, NULL, 10)) > 0 && n <= UINT32_MAX) {
+		g_max_elem = n;
+	}
+	g_dir = dir;
+	mkdir(dir, 0755);
+	atexit(save_maps);
+
+	return &g_mock_backend;
+}
@@ -0,0 +1,13 @@
+#ifndef __BPFMOCK_H
+#define __BPFMOCK_H
+
+#include "bpflib.h"
+
+// Returns the in-memory mock backend. Pinned maps are loaded from and saved
+// to files named after the pin's basename in dir (created if needed), so they
+// persist between runs, and the maps the tc loader pins from tc-users-bpf.o
+// are created empty on first use, with the address map size from
+// BPF_MOCK_MAX_ELEM_ENV if set.
+const bpf_backend *mock_backend(const char *dir);
+
+#endif
@@ -0,0 +1,148 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "bpflib.h"
+#include "cache.h"
+
+#define CACHE_TMP_PATH CACHE_PATH ".tmp"
+
+// Returns the cache path, or the temp cache path if tmp is true, in buf
+// (PATH_MAX bytes). The cache is kept with the maps for the mock backend.
+static const char *cache_path(const bool tmp, char *buf)
+{
+	return bpf_state_path((tmp ? CACHE_TMP_PATH : CACHE_PATH), buf);
+}
+
+// Returns true if the keys of a cached column are strictly increasing.
+static bool keys_sorted(const uint8_t *keys, const int klen, const uint32_t n)
+{
+	uint32_t i;
+
+	for (i = 1; i < n; i++) {
+		if (memcmp(&keys[(i-1) * klen], &keys[i * klen], klen) >= 0) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool load_cache(const uint32_t generation, addr_table *t)
+{
+	const uint8_t *keys[MAX_ADDR_TYPE];
+	char path[PATH_MAX];
+	const cache_header *h;
+	bool ok = false;
+	struct stat st;
+	size_t len;
+	addr_type at;
+	char *buf;
+	int fd;
+
+	if (generation == 0 || (fd = open(cache_path(false, path), O_RDONLY)) == -1) {
+		return false;
+	}
+	if (fstat(fd, &st) == -1 || (size_t) st.st_size < sizeof(cache_header)) {
+		close(fd);
+		return false;
+	}
+	buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (buf == MAP_FAILED) {
+		return false;
+	}
+
+	h = (const cache_header *) buf;
+	if (memcmp(h->magic, CACHE_MAGIC, CACHE_MAGIC_LEN) ||
+		h->version != CACHE_VERSION || h->generation != generation) {
+		goto out;
+	}
+	len = sizeof(cache_header);
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		len += (size_t) h->counts[at] * (addr_len(at) + sizeof(uint16_t));
+	}
+	if (len != (size_t) st.st_size) {
+		goto out;
+	}
+
+	len = sizeof(cache_header);
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		keys[at] = (const uint8_t *) buf + len;
+		if (!keys_sorted(keys[at], addr_len(at), h->counts[at])) {
+			goto out;
+		}
+		len += (size_t) h->counts[at] * (addr_len(at) + sizeof(uint16_t));
+	}
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		col_append(&t->cols[at], keys[at],
+			(const uint16_t *) (keys[at] + h->counts[at] * addr_len(at)),
+			h->counts[at]);
+	}
+	t->sorted = true;
+	ok = true;
+
+out:
+	munmap(buf, st.st_size);
+	return ok;
+}
+
+error_t *write_cache(const uint32_t generation, const addr_table *t)
+{
+	char pbuf[PATH_MAX], tbuf[PATH_MAX];
+	const char *path, *tmp;
+	cache_header h = {0};
+	const addr_column *c;
+	error_t *err = NULL;
+	addr_type at;
+	FILE *fp;
+
+	memcpy(h.magic, CACHE_MAGIC, CACHE_MAGIC_LEN);
+	h.version = CACHE_VERSION;
+	h.generation = generation;
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		h.counts[at] = t->cols[at].len;
+	}
+
+	path = cache_path(false, pbuf);
+	tmp = cache_path(true, tbuf);
+	if ((fp = fopen(tmp, "w")) == NULL) {
+		return errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", tmp, strerror(errno));
+	}
+	if (fwrite(&h, sizeof(h), 1, fp) != 1) {
+		goto fail;
+	}
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		c = &t->cols[at];
+		if (fwrite(c->keys, c->klen, c->len, fp) != c->len ||
+			fwrite(c->classids, sizeof(uint16_t), c->len, fp) != c->len) {
+			goto fail;
+		}
+	}
+	if (fclose(fp) == 0) {
+		fp = NULL;
+		if (rename(tmp, path) == 0) {
+			return NULL;
+		}
+	}
+
+fail:
+	err = errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", tmp, strerror(errno));
+	if (fp) {
+		fclose(fp);
+	}
+	unlink(tmp);
+	return err;
+}
+
+void remove_cache()
+{
+	char path[PATH_MAX];
+
+	unlink(cache_path(false, path));
+}
@@ -0,0 +1,38 @@
+#ifndef __CACHE_H
+#define __CACHE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "addrtab.h"
+#include "error.h"
+
+#define CACHE_PATH "/run/tc-users.cache"
+#define CACHE_MAGIC "TCUCACHE"
+#define CACHE_MAGIC_LEN 8
+#define CACHE_VERSION 1
+
+// Cache of the BPF address maps as of the last sync. The generation is also
+// written to the BPF config, and the cache is only used if they match. All
+// integers are in host byte order, and the header is followed by, for each
+// address type, the keys sorted by address (counts[type] * address length
+// bytes), then the uint16_t classid of each key.
+typedef struct {
+	char magic[CACHE_MAGIC_LEN];
+	uint32_t version;
+	uint32_t generation;
+	uint32_t counts[MAX_ADDR_TYPE];
+} cache_header;
+
+// Loads the cache into an empty table, if it exists, is valid and has the
+// given generation (never 0). Returns false if the cache can't be used.
+bool load_cache(const uint32_t generation, addr_table *t);
+
+// Writes a sorted table to the cache with a generation, replacing any previous
+// cache atomically.
+error_t *write_cache(const uint32_t generation, const addr_table *t);
+
+// Removes the cache, so it can't be used until it's written again.
+void remove_cache();
+
+#endif
@@ -0,0 +1,70 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "check.h"
+#include "log.h"
+
+#define HASH_MUL1 0x9e3779b97f4a7c15ull
+#define HASH_MUL2 0xc2b2ae3d27d4eb4full
+#define PREFETCH_DIST 16
+
+// Returns a hash of an address.
+static uint64_t hash_addr(const addr *a)
+{
+	uint64_t w[2] = {0};
+
+	memcpy(w, &a->val, addr_len(a->type));
+	return ((w[0] ^ a->type) * HASH_MUL1 ^ w[1]) * HASH_MUL2;
+}
+
+error_t *check_entries(const config *cfg, entries *es)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	unsigned long i, j, n, mask, conflicts;
+	entry *e, *f = NULL;
+	uint64_t *slots;
+	uint32_t tag;
+	uint64_t h;
+	int bits;
+
+	// open addressing index of the entries kept so far, with a load factor
+	// of at most 1/2. Slots hold the low 32 bits of the hash as a tag, so
+	// that most probes don't have to load an entry, and the index+1.
+	for (bits = 4; (1ul << bits) < 2 * es->len; bits++);
+	mask = (1ul << bits) - 1;
+	slots = calloc(mask + 1, sizeof(uint64_t));
+
+	for (i = 0, n = 0, conflicts = 0; i < es->len; i++) {
+		if (i + PREFETCH_DIST < es->len) {
+			h = hash_addr(&es->arr[i + PREFETCH_DIST].addr);
+			__builtin_prefetch(&slots[h >> (64 - bits)]);
+		}
+		e = &es->arr[i];
+		h = hash_addr(&e->addr);
+		tag = (uint32_t) h;
+		for (j = h >> (64 - bits); slots[j]; j = (j + 1) & mask) {
+			if ((uint32_t) (slots[j] >> 32) == tag &&
+				!cmp_addr(&(f = &es->arr[(uint32_t) slots[j] - 1])->addr, &e->addr)) {
+				break;
+			}
+		}
+		if (!slots[j]) {
+			es->arr[n++] = *e;
+			slots[j] = (uint64_t) tag << 32 | n;
+		} else if (f->uid == e->uid) {
+			logw(cfg, "duplicate address %s for userid %s\n",
+				addr_str(&e->addr, astr), entry_userid(es, e));
+		} else {
+			logw(cfg, "address %s mapped to userid %s and %s\n",
+				addr_str(&e->addr, astr), entry_userid(es, f), entry_userid(es, e));
+			conflicts++;
+		}
+	}
+	es->len = n;
+
+	free(slots);
+	if (conflicts > 0) {
+		return errorf(E_CONFLICTING_ADDRS, "%lu", conflicts);
+	}
+	return NULL;
+}
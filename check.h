@@ -0,0 +1,14 @@
+#ifndef __CHECK_H
+#define __CHECK_H
+
+#include "config.h"
+#include "entry.h"
+#include "error.h"
+
+// Checks entries for addresses that appear more than once, warning about each
+// one. Duplicates with the same user ID are removed, keeping the first. If any
+// address is mapped to more than one user ID, E_CONFLICTING_ADDRS is returned
+// after all of them have been reported.
+error_t *check_entries(const config *cfg, entries *es);
+
+#endif
@@ -0,0 +1,129 @@
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "classid_heap.h"
+
+classid_heap *new_classid_heap(const u16_range *r)
+{
+	classid_heap *h = malloc(sizeof(classid_heap));
+	uint32_t i;
+
+	*h = (const classid_heap){0};
+	h->base = r->lo;
+	h->len = u16_range_size(r);
+	h->counts = calloc(h->len, sizeof(uint64_t));
+	h->heap = malloc(h->len * sizeof(uint32_t));
+	h->pos = malloc(h->len * sizeof(uint32_t));
+	for (i = 0; i < h->len; i++) {
+		h->heap[i] = i;
+		h->pos[i] = i;
+	}
+
+	return h;
+}
+
+// Returns true if heap slot i orders before slot j.
+static bool less(const classid_heap *h, const uint32_t i, const uint32_t j)
+{
+	uint32_t a = h->heap[i], b = h->heap[j];
+
+	return h->counts[a] < h->counts[b] || (h->counts[a] == h->counts[b] && a < b);
+}
+
+// Moves the classid in heap slot i down until the heap is ordered.
+static void sift_down(classid_heap *h, uint32_t i)
+{
+	uint32_t c, t;
+
+	while ((c = 2 * i + 1) < h->len) {
+		if (c + 1 < h->len && less(h, c + 1, c)) {
+			c++;
+		}
+		if (!less(h, c, i)) {
+			break;
+		}
+		t = h->heap[i];
+		h->heap[i] = h->heap[c];
+		h->heap[c] = t;
+		h->pos[h->heap[i]] = i;
+		h->pos[h->heap[c]] = c;
+		i = c;
+	}
+}
+
+// Moves the classid in heap slot i up until the heap is ordered.
+static void sift_up(classid_heap *h, uint32_t i)
+{
+	uint32_t p, t;
+
+	while (i > 0 && less(h, i, (p = (i - 1) / 2))) {
+		t = h->heap[i];
+		h->heap[i] = h->heap[p];
+		h->heap[p] = t;
+		h->pos[h->heap[i]] = i;
+		h->pos[h->heap[p]] = p;
+		i = p;
+	}
+}
+
+void set_classid_count(classid_heap *h, const uint16_t classid, const uint64_t count)
+{
+	h->counts[classid - h->base] = count;
+}
+
+void heapify_classids(classid_heap *h)
+{
+	uint32_t i;
+
+	for (i = h->len / 2; i > 0; i--) {
+		sift_down(h, i - 1);
+	}
+}
+
+void inc_classid_count(classid_heap *h, const uint16_t classid)
+{
+	add_classid_count(h, classid, 1);
+}
+
+void dec_classid_count(classid_heap *h, const uint16_t classid)
+{
+	uint32_t i = classid - h->base;
+
+	if (h->counts[i] > 0) {
+		h->counts[i]--;
+		sift_up(h, h->pos[i]);
+	}
+}
+
+void add_classid_count(classid_heap *h, const uint16_t classid, const uint64_t n)
+{
+	uint32_t i = classid - h->base;
+
+	h->counts[i] += n;
+	sift_down(h, h->pos[i]);
+}
+
+uint16_t pick_classid(classid_heap *h)
+{
+	return pick_classid_add(h, 1);
+}
+
+uint16_t pick_classid_add(classid_heap *h, const uint64_t n)
+{
+	uint32_t i = h->heap[0];
+
+	h->counts[i] += n;
+	sift_down(h, 0);
+
+	return h->base + i;
+}
+
+void free_classid_heap(classid_heap *h)
+{
+	if (h) {
+		free(h->pos);
+		free(h->heap);
+		free(h->counts);
+	}
+	free(h);
+}
@@ -0,0 +1,47 @@
+#ifndef __CLASSID_HEAP_H
+#define __CLASSID_HEAP_H
+
+#include <stdint.h>
+
+#include "config.h"
+
+// Min-heap of the classids in a range, keyed by a count (their number of
+// users, or a load), then by classid.
+typedef struct {
+	uint16_t base;
+	uint32_t len;
+	uint64_t *counts;
+	uint32_t *heap;
+	uint32_t *pos;
+} classid_heap;
+
+// Creates a new classid heap for a range, with all counts zero.
+classid_heap *new_classid_heap(const u16_range *r);
+
+// Sets the count for a classid. Counts must be set before the first pick.
+void set_classid_count(classid_heap *h, const uint16_t classid, const uint64_t count);
+
+// Orders the heap after counts were set.
+void heapify_classids(classid_heap *h);
+
+// Increments the count for a classid.
+void inc_classid_count(classid_heap *h, const uint16_t classid);
+
+// Decrements the count for a classid, if it's not zero.
+void dec_classid_count(classid_heap *h, const uint16_t classid);
+
+// Adds n to the count for a classid.
+void add_classid_count(classid_heap *h, const uint16_t classid, const uint64_t n);
+
+// Returns the least used classid (the lowest, if tied), and increments its
+// count.
+uint16_t pick_classid(classid_heap *h);
+
+// Returns the least used classid (the lowest, if tied), and adds n to its
+// count.
+uint16_t pick_classid_add(classid_heap *h, const uint64_t n);
+
+// Frees a classid heap.
+void free_classid_heap(classid_heap *h);
+
+#endif
@@ -7,156 +7,450 @@
 #include "classify.h"
 #include "log.h"
 
+#define FNV64_OFFSET 14695981039346656037ull
+#define FNV64_PRIME 1099511628211ull
+
+// Classification state of a user.
+typedef enum {
+	USER_UNCLASSIFIED,
+	USER_DIRECT,
+	USER_INDIRECT,
+	USER_STICKY,
+	USER_MOVED,
+	USER_EXISTING,
+} user_state;
+
+// Classification of a user, indexed by uid.
 typedef struct {
 	uint16_t classid;
-	uint16_t count;
-} classid_count;
+	uint8_t state;
+} user_class;
 
-typedef struct {
-	classid_count *arr;
-	int base;
-	int pos;
-	int len;
-} classid_hist;
+bool userid_to_classid(const config *cfg, const char *userid, uint16_t *classid)
+{
+	char *end;
+	long uid;
+
+	uid = strtol(userid, &end, 10);
+	if (!*end && uid >= 0 && uid <= UINT16_MAX &&
+		is_in_range(&cfg->user_flows, (uint16_t) uid)) {
+		*classid = (uint16_t) uid;
+		return true;
+	}
+	return false;
+}
 
-static int cmp_ents(const void *p1, const void *p2)
+// Mixes the bits of x (the splitmix64 finalizer).
+static uint64_t mix64(uint64_t x)
 {
-	const entry *e1 = p1, *e2 = p2;
-	int cld;
+	x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ull;
+	x = (x ^ (x >> 27)) * 0x94d049bb133111ebull;
+	return x ^ (x >> 31);
+}
+
+// Returns a 64-bit hash of a userid that is the same on every host.
+static uint64_t hash_userid64(const char *s)
+{
+	uint64_t h = FNV64_OFFSET;
+
+	for (; *s; s++) {
+		h = (h ^ (uint8_t) *s) * FNV64_PRIME;
+	}
+	return mix64(h);
+}
+
+// Returns a bucket in [0, n) for key using jump consistent hashing, so that
+// growing n by one moves only 1/n of the keys.
+static uint32_t jump_hash(uint64_t key, const uint32_t n)
+{
+	int64_t b = -1, j = 0;
 
-	if ((cld = e1->classified - e2->classified) == 0) {
-		return strncmp(e1->userid, e2->userid, MAX_USERID_STRLEN+1);
+	while (j < n) {
+		b = j;
+		key = key * 2862933555777941757ull + 1;
+		j = (b + 1) * ((double) (1ll << 31) / (double) ((key >> 33) + 1));
 	}
+	return b;
+}
+
+// Returns the classid a userid hashes to in the user flows range. If loads is
+// not NULL, classids with max users are skipped by rehashing the key, and the
+// load of the returned classid is incremented.
+static uint16_t hash_classid(const config *cfg, const char *userid, uint32_t *loads,
+	const uint32_t max)
+{
+	uint32_t n = u16_range_size(&cfg->user_flows);
+	uint64_t key = hash_userid64(userid);
+	uint32_t b = jump_hash(key, n);
 
-	return cld;
+	if (loads) {
+		while (loads[b] >= max) {
+			key = mix64(key + 1);
+			b = jump_hash(key, n);
+		}
+		loads[b]++;
+	}
+	return cfg->user_flows.lo + b;
 }
 
-static int cmp_classid_count(const void *p1, const void *p2)
+// Assigns hashed classids to indirect users. With a max load, users are taken
+// in userid order, so the result depends only on the set of userids.
+static void assign_hashed(const config *cfg, entries *es, user_class *ucs)
 {
-    const classid_count *c1 = p1, *c2 = p2;
-	int cntd;
+	uint32_t n = u16_range_size(&cfg->user_flows);
+	uint32_t *loads = NULL;
+	uint64_t users = 0;
+	uint32_t max = 0;
+	uint32_t u;
 
-	if ((cntd = c1->count - c2->count) == 0) {
-		return c1->classid - c2->classid;
+	if (cfg->max_load) {
+		for (u = 0; u < es->us->len; u++) {
+			users += (ucs[u].state == USER_INDIRECT);
+		}
+		max = (users * cfg->max_load + 100ull * n - 1) / (100ull * n);
+		loads = malloc(n * sizeof(uint32_t));
+		memset(loads, 0, n * sizeof(uint32_t));
 	}
 
-	return cntd;
+	for (u = 0; u < es->us->len; u++) {
+		if (ucs[u].state == USER_INDIRECT) {
+			ucs[u].classid = hash_classid(cfg, userid_str(es->us, u), loads, max);
+		}
+	}
+
+	free(loads);
 }
 
-static bool userid_to_classid(const config *cfg, const char *userid, uint16_t *classid)
+// Moves up to max_moves kept users off the most loaded shared classids with
+// more than the average load, then assigns new users to the least loaded
+// classids. As traffic is counted per classid, the load of each kept user is
+// estimated as its classid's load divided by its number of users. Heap counts
+// are the load plus the number of users, so that classids without traffic are
+// filled evenly.
+static void assign_by_load(const config *cfg, entries *es, user_class *ucs,
+	const uint64_t *loads)
 {
-	char *end;
-	long uid;
+	uint32_t n = u16_range_size(&cfg->user_flows);
+	uint32_t *users = malloc(n * sizeof(uint32_t));
+	uint32_t *nkept = malloc(n * sizeof(uint32_t));
+	uint32_t *starts = malloc((n + 1) * sizeof(uint32_t));
+	uint64_t *load = malloc(n * sizeof(uint64_t));
+	uint64_t *each = malloc(n * sizeof(uint64_t));
+	uint64_t total = 0, avg, mean;
+	uint32_t *kept = NULL;
+	classid_heap *h;
+	uint32_t u, c, hi, lo, m;
+	uint16_t base = cfg->user_flows.lo;
 
-	uid = strtol(userid, &end, 10);
-	if (!*end && uid >= 0 && uid <= UINT16_MAX &&
-		is_in_range(&cfg->user_flows, (uint16_t) uid)) {
-		*classid = (uint16_t) uid;
-		return true;
+	memset(users, 0, n * sizeof(uint32_t));
+	memset(nkept, 0, n * sizeof(uint32_t));
+	memcpy(load, loads, n * sizeof(uint64_t));
+	for (c = 0; c < n; c++) {
+		total += load[c];
 	}
-	return false;
+	avg = total / n;
+
+	// group kept users by classid
+	for (u = 0; u < es->us->len; u++) {
+		if (ucs[u].state == USER_DIRECT || ucs[u].state == USER_STICKY) {
+			users[ucs[u].classid - base]++;
+		}
+		if (ucs[u].state == USER_STICKY) {
+			nkept[ucs[u].classid - base]++;
+		}
+	}
+	for (c = 0, starts[0] = 0; c < n; c++) {
+		starts[c + 1] = starts[c] + nkept[c];
+		each[c] = (users[c] > 0 ? load[c] / users[c] : 0);
+	}
+	kept = malloc((starts[n] + 1) * sizeof(uint32_t));
+	memset(nkept, 0, n * sizeof(uint32_t));
+	for (u = 0; u < es->us->len; u++) {
+		if (ucs[u].state == USER_STICKY) {
+			c = ucs[u].classid - base;
+			kept[starts[c] + nkept[c]++] = u;
+		}
+	}
+
+	// move users from the most loaded shared classid to the least loaded one,
+	// while it's above average and the move lowers its load below the source's
+	for (m = 0; m < cfg->max_moves; m++) {
+		hi = lo = n;
+		for (c = 0; c < n; c++) {
+			if (nkept[c] > 0 && users[c] > 1 && each[c] > 0 &&
+				(hi == n || load[c] > load[hi])) {
+				hi = c;
+			}
+			if (lo == n || load[c] < load[lo] ||
+				(load[c] == load[lo] && users[c] < users[lo])) {
+				lo = c;
+			}
+		}
+		if (hi == n || load[hi] <= avg) {
+			break;
+		}
+		if (load[lo] + each[hi] >= load[hi]) {
+			break;
+		}
+		u = kept[starts[hi] + --nkept[hi]];
+		ucs[u].classid = base + lo;
+		ucs[u].state = USER_MOVED;
+		load[hi] -= each[hi];
+		users[hi]--;
+		load[lo] += each[hi];
+		users[lo]++;
+	}
+
+	// assign new users the mean user load
+	for (c = 0, u = 0; c < n; c++) {
+		u += users[c];
+	}
+	mean = (u > 0 ? total / u : 0);
+	h = new_classid_heap(&cfg->user_flows);
+	for (c = 0; c < n; c++) {
+		set_classid_count(h, base + c, load[c] + users[c]);
+	}
+	heapify_classids(h);
+	for (u = 0; u < es->us->len; u++) {
+		if (ucs[u].state == USER_INDIRECT) {
+			ucs[u].classid = pick_classid_add(h, mean + 1);
+		}
+	}
+
+	free_classid_heap(h);
+	free(kept);
+	free(each);
+	free(load);
+	free(starts);
+	free(nkept);
+	free(users);
 }
 
-static classid_hist *new_classid_hist(const config *cfg, entries *es)
+// Creates a classid heap with the counts of already classified entries.
+static classid_heap *new_entries_heap(const config *cfg, entries *es)
 {
+	classid_heap *h = new_classid_heap(&cfg->user_flows);
+	uint32_t *counts = malloc(h->len * sizeof(uint32_t));
 	ents_it *it = new_ents_it(es);
-	classid_hist *cidh = NULL;
+	uint32_t i;
 	entry *e;
-	int i;
 
-	cidh = malloc(sizeof(classid_hist));
-	*cidh = (const classid_hist){0};
-	cidh->base = cfg->user_flows.lo;
-	cidh->len = u16_range_size(&cfg->user_flows);
-	cidh->arr = malloc(cidh->len * sizeof(classid_count));
-	for (i = 0; i < cidh->len; i++) {
-		cidh->arr[i] = (const classid_count){0};
-		cidh->arr[i].classid = cidh->base + i;
-	}
+	memset(counts, 0, h->len * sizeof(uint32_t));
 	while ((e = es_next(it))) {
 		if (e->classified) {
-			cidh->arr[e->classid - cidh->base].count++;
+			counts[e->classid - h->base]++;
 		}
 	}
-	qsort(cidh->arr, cidh->len, sizeof(classid_count), cmp_classid_count);
+	for (i = 0; i < h->len; i++) {
+		set_classid_count(h, h->base + i, counts[i]);
+	}
+	heapify_classids(h);
 
 	free(it);
-	return cidh;
+	free(counts);
+	return h;
 }
 
-static uint16_t least_used_classid(classid_hist *h)
+static void classify_direct(const bpf_handle *hnd, const config *cfg, entries *es,
+	user_class *ucs)
 {
-	classid_count *cnt;
+	char astr[MAX_ADDR_STRLEN+1];
+	ents_it *it = new_ents_it(es);
+	uint16_t classid;
+	uint32_t u;
+	entry *e;
 
-	cnt = &h->arr[h->pos];
-	h->pos++;
-	if (h->pos >= h->len || h->arr[h->pos].count > cnt->count) {
-		h->pos = 0;
+	for (u = 0; u < es->us->len; u++) {
+		if (userid_to_classid(cfg, userid_str(es->us, u), &classid)) {
+			ucs[u].classid = classid;
+			ucs[u].state = USER_DIRECT;
+		}
 	}
-	cnt->count++;
 
-	return cnt->classid;
+	while ((e = es_next(it))) {
+		if (!e->classified && ucs[e->uid].state == USER_DIRECT) {
+			e->classid = ucs[e->uid].classid;
+			e->classified = true;
+			if (cfg->log >= LOG_VERBOSE) {
+				logv(cfg, "Classify: %s %u (direct from userid %s)\n",
+					addr_str(&e->addr, astr), e->classid, entry_userid(es, e));
+			}
+		}
+	}
+
+	free(it);
 }
 
-static void free_classid_hist(classid_hist *h) {
-	if (h) {
-		free(h->arr);
+// Keeps the classid of a user whose address is in the BPF maps with a classid
+// in the user flows range. The first such address in the input is used.
+static void find_sticky(const config *cfg, const addr_table *bt, const entry *e,
+	user_class *uc)
+{
+	const addr_column *c = &bt->cols[e->addr.type];
+	unsigned long i;
+
+	if (addr_table_find(bt, &e->addr, &i) &&
+		is_in_range(&cfg->user_flows, c->classids[i])) {
+		uc->classid = c->classids[i];
+		uc->state = USER_STICKY;
 	}
-	free(h);
 }
 
-static void classify_direct(const bpf_handle *hnd, const config *cfg, entries *es)
+static void classify_indirect(const bpf_handle *hnd, const config *cfg, entries *es,
+	user_class *ucs, const addr_table *bt, const uint64_t *loads)
 {
-	ents_it *it = new_ents_it(es);
 	char astr[MAX_ADDR_STRLEN+1];
+	classid_heap *h = NULL;
+	bool pending = false;
+	ents_it *it = NULL;
+	user_class *uc;
+	uint32_t u;
 	entry *e;
 
+	it = new_ents_it(es);
 	while ((e = es_next(it))) {
-		if (!e->classified && (userid_to_classid(cfg, e->userid, &e->classid))) {
+		if (!e->classified) {
+			uc = &ucs[e->uid];
+			if (uc->state == USER_UNCLASSIFIED) {
+				uc->state = USER_INDIRECT;
+			}
+			if (uc->state == USER_INDIRECT && (cfg->assign == ASSIGN_STICKY ||
+				cfg->assign == ASSIGN_TRAFFIC)) {
+				find_sticky(cfg, bt, e, uc);
+			}
+			pending = true;
+		}
+	}
+	free(it);
+	if (!pending) {
+		return;
+	}
+
+	if (cfg->assign == ASSIGN_HASH) {
+		assign_hashed(cfg, es, ucs);
+	} else if (cfg->assign == ASSIGN_TRAFFIC) {
+		assign_by_load(cfg, es, ucs, loads);
+	} else {
+		// count sticky users, then assign classids to new users in userid order
+		h = new_entries_heap(cfg, es);
+		for (u = 0; u < es->us->len; u++) {
+			if (ucs[u].state == USER_STICKY) {
+				inc_classid_count(h, ucs[u].classid);
+			}
+		}
+		for (u = 0; u < es->us->len; u++) {
+			if (ucs[u].state == USER_INDIRECT) {
+				ucs[u].classid = pick_classid(h);
+			}
+		}
+	}
+
+	it = new_ents_it(es);
+	while ((e = es_next(it))) {
+		if (!e->classified) {
+			uc = &ucs[e->uid];
+			e->classid = uc->classid;
 			e->classified = true;
-			logv(cfg, "Classify: %s %u (direct from userid %s)\n",
-				addr_str(&e->addr, astr), e->classid, e->userid);
+			if (uc->state == USER_INDIRECT) {
+				uc->state = USER_EXISTING;
+				if (cfg->log >= LOG_VERBOSE) {
+					logv(cfg, "Classify: %s %u (indirect for userid %s)\n",
+						addr_str(&e->addr, astr), e->classid, entry_userid(es, e));
+				}
+			} else if (uc->state == USER_STICKY) {
+				uc->state = USER_EXISTING;
+				if (cfg->log >= LOG_VERBOSE) {
+					logv(cfg, "Classify: %s %u (sticky for userid %s)\n",
+						addr_str(&e->addr, astr), e->classid, entry_userid(es, e));
+				}
+			} else if (uc->state == USER_MOVED) {
+				uc->state = USER_EXISTING;
+				if (cfg->log >= LOG_VERBOSE) {
+					logv(cfg, "Classify: %s %u (moved by load for userid %s)\n",
+						addr_str(&e->addr, astr), e->classid, entry_userid(es, e));
+				}
+			} else if (cfg->log >= LOG_VERBOSE) {
+				logv(cfg, "Classify: %s %u (existing for userid %s)\n",
+					addr_str(&e->addr, astr), e->classid, entry_userid(es, e));
+			}
 		}
 	}
 
 	free(it);
+	free_classid_heap(h);
+}
+
+void classify(const bpf_handle *hnd, const config *cfg, entries *es,
+	const addr_table *bt, const uint64_t *loads)
+{
+	user_class *ucs;
+
+	// uids in userid order, so that classids are assigned in that order
+	order_entry_userids(es);
+	ucs = malloc(es->us->len * sizeof(user_class));
+	memset(ucs, 0, es->us->len * sizeof(user_class));
+
+	classify_direct(hnd, cfg, es, ucs);
+	classify_indirect(hnd, cfg, es, ucs, bt, loads);
+
+	free(ucs);
 }
 
-static void classify_indirect(const bpf_handle *hnd, const config *cfg, entries *es)
+classifier *new_classifier(const config *cfg)
 {
+	classifier *c = malloc(sizeof(classifier));
+	*c = (const classifier){0};
+	c->cfg = cfg;
+	c->us = new_userids();
+	c->heap = new_classid_heap(&cfg->user_flows);
+
+	return c;
+}
+
+void classify_entry(classifier *c, const userids *us, entry *e)
+{
+	const char *userid = userid_str(us, e->uid);
 	char astr[MAX_ADDR_STRLEN+1];
-	classid_hist *cidh = NULL;
-	ents_it *cit = NULL;
-	entry *e, *pe;
-
-	sort_entries(es, cmp_ents);
-	if (es->len > 0 && !es->arr[0].classified) {
-		cidh = new_classid_hist(cfg, es);
-		cit = new_ents_it(es);
-		while ((e = es_next_prev(cit, &pe))) {
-			if (!e->classified) {
-				if (pe && !strncmp(pe->userid, e->userid, MAX_USERID_STRLEN+1)) {
-					e->classid = pe->classid;
-					logv(cfg, "Classify: %s %u (existing for userid %s)\n",
-						addr_str(&e->addr, astr), e->classid, e->userid);
-				} else {
-					e->classid = least_used_classid(cidh);
-					logv(cfg, "Classify: %s %u (indirect for userid %s)\n",
-						addr_str(&e->addr, astr), e->classid, e->userid);
-				}
-				e->classified = true;
+	bool added;
+	uint32_t u;
+
+	if (userid_to_classid(c->cfg, userid, &e->classid)) {
+		inc_classid_count(c->heap, e->classid);
+		if (c->cfg->log >= LOG_VERBOSE) {
+			logv(c->cfg, "Classify: %s %u (direct from userid %s)\n",
+				addr_str(&e->addr, astr), e->classid, userid);
+		}
+	} else {
+		u = intern_userid(c->us, userid, strlen(userid), &added);
+		if (added) {
+			if (u == c->cap) {
+				c->cap = c->us->cap;
+				c->classids = realloc(c->classids, c->cap * sizeof(uint16_t));
+			}
+			if (c->cfg->assign == ASSIGN_HASH) {
+				c->classids[u] = hash_classid(c->cfg, userid, NULL, 0);
 			} else {
-				break;
+				c->classids[u] = pick_classid(c->heap);
 			}
+			if (c->cfg->log >= LOG_VERBOSE) {
+				logv(c->cfg, "Classify: %s %u (indirect for userid %s)\n",
+					addr_str(&e->addr, astr), c->classids[u], userid);
+			}
+		} else if (c->cfg->log >= LOG_VERBOSE) {
+			logv(c->cfg, "Classify: %s %u (existing for userid %s)\n",
+				addr_str(&e->addr, astr), c->classids[u], userid);
 		}
+		e->classid = c->classids[u];
 	}
-
-	free(cit);
-	free_classid_hist(cidh);
+	e->classified = true;
 }
 
-void classify(const bpf_handle *hnd, const config *cfg, entries *es)
+void free_classifier(classifier *c)
 {
-	classify_direct(hnd, cfg, es);
-	classify_indirect(hnd, cfg, es);
+	if (c) {
+		free_classid_heap(c->heap);
+		free(c->classids);
+		free_userids(c->us);
+	}
+	free(c);
 }
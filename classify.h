@@ -1,12 +1,42 @@
 #ifndef __CLASSIFY_H
 #define __CLASSIFY_H
 
+#include "addrtab.h"
 #include "bpf.h"
+#include "classid_heap.h"
 #include "config.h"
 #include "entry.h"
 #include "error.h"
+#include "userids.h"
 
-// Assigns classids to entries.
-void classify(const bpf_handle *hnd, const config *cfg, entries *es);
+// Classifies entries one at a time, as they're streamed in.
+typedef struct {
+	const config *cfg;
+	userids *us;
+	uint16_t *classids;
+	uint32_t cap;
+	classid_heap *heap;
+} classifier;
+
+// Sets classid from a user ID that is a number in the user flows range, for
+// direct classification, and returns true, or returns false.
+bool userid_to_classid(const config *cfg, const char *userid, uint16_t *classid);
+
+// Assigns classids to entries. In sticky and traffic assign modes, users keep
+// the classids of their addresses in bt, the sorted contents of the BPF maps.
+// In traffic mode, loads are the classid loads from read_classid_loads.
+void classify(const bpf_handle *hnd, const config *cfg, entries *es,
+	const addr_table *bt, const uint64_t *loads);
+
+// Creates a new streaming classifier.
+classifier *new_classifier(const config *cfg);
+
+// Assigns a classid to one entry, whose user ID is interned in us. Indirectly
+// classified users are assigned the least used classid among the entries
+// classified so far.
+void classify_entry(classifier *c, const userids *us, entry *e);
+
+// Frees a streaming classifier.
+void free_classifier(classifier *c);
 
 #endif
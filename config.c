@@ -17,6 +17,14 @@ static const char * const classify_addr_strs[MAX_CLASSIFY_ADDR-1] = {
 	"dstip",
 };
 
+// Assign mode strings.
+static const char * const assign_mode_strs[MAX_ASSIGN_MODE] = {
+	"balanced",
+	"sticky",
+	"hash",
+	"traffic",
+};
+
 static classify_addr parse_classify_addr(const char *s) {
 	int i;
 
@@ -73,9 +81,23 @@ void init_config(config *cfg)
 		{ D_UNCL_FLOW_LO, D_UNCL_FLOW_HI, },
 		{ D_FLOWS_PER_USER_LO, D_FLOWS_PER_USER_HI, },
 		D_CLASSIFY_BY,
+		D_ASSIGN,
+		D_MAX_LOAD,
+		D_MAX_MOVES,
+		false,
+		false,
+		false,
+		false,
+		false,
+		false,
 		false,
+		D_DEBOUNCE,
+		D_MIN_INTERVAL,
 		LOG_NORMAL,
 		NULL,
+		NULL,
+		NULL,
+		D_THREADS,
 		0,
 	};
 }
@@ -122,9 +144,9 @@ char *u16_range_str(const u16_range *r, char *s)
 	return s;
 }
 
-uint16_t u16_range_size(const u16_range *r)
+uint32_t u16_range_size(const u16_range *r)
 {
-	return r->hi - r->lo + 1;
+	return (uint32_t) r->hi - r->lo + 1;
 }
 
 bool is_in_range(const u16_range *r, const uint16_t v)
@@ -202,6 +224,25 @@ char *classify_by_str(const classify_by cb, char *s)
 	return s;
 }
 
+error_t *parse_assign_mode(const char *s, assign_mode *m)
+{
+	int i;
+
+	for (i = 0; i < MAX_ASSIGN_MODE; i++) {
+		if (!strcmp(s, assign_mode_strs[i])) {
+			*m = i;
+			return NULL;
+		}
+	}
+
+	return errorf(E_INVALID_ASSIGN_MODE, "%s", s);
+}
+
+const char *assign_mode_str(const assign_mode m)
+{
+	return assign_mode_strs[m];
+}
+
 bool is_u16_pow2(const uint16_t x)
 {
 	return x && !(x & (x - 1));
@@ -248,6 +289,99 @@ error_t *validate_config(const config *cfg)
 			u16_range_size(&cfg->uncl_flows));
 	}
 
+	if (cfg->threads < 1) {
+		return errorf(E_INVALID_THREADS, "%u", cfg->threads);
+	}
+
+	if (cfg->max_load != 0 && cfg->max_load < 100) {
+		return errorf(E_INVALID_MAX_LOAD, "%u%% is less than 100%%", cfg->max_load);
+	}
+	if (cfg->max_load != 0 && cfg->assign != ASSIGN_HASH) {
+		return errorf(E_INVALID_MAX_LOAD, "only used with %s assign mode",
+			assign_mode_str(ASSIGN_HASH));
+	}
+
+	if (cfg->stream && (cfg->assign == ASSIGN_STICKY || cfg->assign == ASSIGN_TRAFFIC)) {
+		return errorf(E_INVALID_ASSIGN_MODE, "%s can't be used when streaming",
+			assign_mode_str(cfg->assign));
+	}
+	if (cfg->stream && cfg->max_load != 0) {
+		return errorf(E_INVALID_MAX_LOAD, "can't be used when streaming");
+	}
+	if (cfg->stream && cfg->replace) {
+		return error(E_STREAM_REPLACE);
+	}
+
+	if (cfg->delta) {
+		if (cfg->mode == COMPILE) {
+			return errorf(E_DELTA_OPTION, "compile");
+		}
+		if (cfg->stream) {
+			return errorf(E_DELTA_OPTION, "stream");
+		}
+		if (cfg->replace) {
+			return errorf(E_DELTA_OPTION, "replace");
+		}
+		if (cfg->track_users) {
+			return errorf(E_DELTA_OPTION, "track-users, as delta always tracks users");
+		}
+		if (cfg->assign != ASSIGN_BALANCED) {
+			return errorf(E_DELTA_OPTION, "assign %s", assign_mode_str(cfg->assign));
+		}
+	}
+	if (cfg->stream && cfg->track_users) {
+		return errorf(E_INVALID_TRACK_USERS, "can't be used when streaming");
+	}
+	if (cfg->parallel_sync && cfg->stream) {
+		return errorf(E_INVALID_PARALLEL_SYNC, "can't be used when streaming");
+	}
+	if (cfg->parallel_sync && cfg->delta) {
+		return errorf(E_INVALID_PARALLEL_SYNC, "can't be used with delta input");
+	}
+
+	if (cfg->mode == DUMP) {
+		if (cfg->stream) {
+			return errorf(E_DUMP_OPTION, "stream");
+		}
+		if (cfg->replace) {
+			return errorf(E_DUMP_OPTION, "replace");
+		}
+		if (cfg->delta) {
+			return errorf(E_DUMP_OPTION, "delta");
+		}
+		if (cfg->daemon) {
+			return errorf(E_DUMP_OPTION, "daemon");
+		}
+		return NULL;
+	}
+
+	if (cfg->daemon) {
+		if (cfg->mode == COMPILE) {
+			return errorf(E_DAEMON_OPTION, "compile");
+		}
+		if (cfg->stream) {
+			return errorf(E_DAEMON_OPTION, "stream");
+		}
+		if (cfg->delta) {
+			return errorf(E_DAEMON_OPTION, "delta");
+		}
+		if (!strcmp(cfg->input, "-")) {
+			return errorf(E_DAEMON_OPTION, "input from stdin");
+		}
+	}
+	if (cfg->control) {
+		if (!cfg->daemon) {
+			return errorf(E_INVALID_CONTROL, "requires --daemon");
+		}
+		if (!cfg->track_users) {
+			return errorf(E_INVALID_CONTROL, "requires --track-users");
+		}
+		if (cfg->assign != ASSIGN_BALANCED) {
+			return errorf(E_INVALID_CONTROL, "can't be used with assign %s",
+				assign_mode_str(cfg->assign));
+		}
+	}
+
 	return NULL;
 }
 
@@ -24,6 +24,12 @@
 #define D_UNCL_FLOWS STR(D_UNCL_FLOW_LO) "-" STR(D_UNCL_FLOW_HI)
 #define D_FLOWS_PER_USER STR(D_FLOWS_PER_USER_LO) "-" STR(D_FLOWS_PER_USER_HI)
 #define D_CLASSIFY_BY { SRC_MAC, SRC_IP, 0, 0, }
+#define D_THREADS 1
+#define D_ASSIGN ASSIGN_BALANCED
+#define D_MAX_LOAD 0
+#define D_MAX_MOVES 64
+#define D_DEBOUNCE 500
+#define D_MIN_INTERVAL 5
 
 // Log level.
 typedef enum {
@@ -42,9 +48,20 @@ typedef enum {
 	MAX_CLASSIFY_ADDR,
 } classify_addr;
 
+// Assignment mode for indirectly classified users.
+typedef enum {
+	ASSIGN_BALANCED,
+	ASSIGN_STICKY,
+	ASSIGN_HASH,
+	ASSIGN_TRAFFIC,
+	MAX_ASSIGN_MODE,
+} assign_mode;
+
 // Execution mode.
 typedef enum {
 	RUN,
+	COMPILE,
+	DUMP,
 	PRINT_HELP,
 	PRINT_VERSION,
 } run_mode;
@@ -65,9 +82,23 @@ typedef struct {
 	u16_range uncl_flows;
 	u16_range fpu_range;
 	classify_by classify_by;
+	assign_mode assign;
+	uint16_t max_load;
+	uint16_t max_moves;
 	bool noop;
+	bool stream;
+	bool replace;
+	bool delta;
+	bool track_users;
+	bool parallel_sync;
+	bool daemon;
+	uint16_t debounce;
+	uint16_t min_interval;
 	log_level log;
 	char *input;
+	char *output;
+	char *control;
+	uint16_t threads;
 	uint16_t flows_per_user;
 } config;
 
@@ -84,7 +115,7 @@ bool u16_ranges_overlap(const u16_range *r1, const u16_range *r2);
 char *u16_range_str(const u16_range *r, char *s);
 
 // Returns the size of a u16_range.
-uint16_t u16_range_size(const u16_range *r);
+uint32_t u16_range_size(const u16_range *r);
 
 // Returns true if v is in range r.
 bool is_in_range(const u16_range *r, const uint16_t v);
@@ -98,6 +129,12 @@ error_t *parse_classify_by(const char *s, classify_by cb);
 // Returns a string for the classify_by value (s should be sized MAX_CLASSIFY_BY_STRLEN+1).
 char *classify_by_str(const classify_by cb, char *s);
 
+// Parses an assign mode string.
+error_t *parse_assign_mode(const char *s, assign_mode *m);
+
+// Returns the string for an assign mode.
+const char *assign_mode_str(const assign_mode m);
+
 // Returns true if the specified uint16_t is power of 2.
 bool is_u16_pow2(const uint16_t x);
 
@@ -0,0 +1,338 @@
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "cache.h"
+#include "control.h"
+#include "input.h"
+#include "log.h"
+
+// Size of each client's input buffer, which bounds the commands read at once.
+#define CONTROL_IN_SIZE 16384
+
+// Size of unsent replies at which a client's commands are no longer read.
+#define MAX_CONTROL_OUT (1 << 20)
+
+#define CONTROL_BACKLOG 16
+
+// Commands run in one call to serve_control.
+typedef struct {
+	control *c;
+	bpf_handle *hnd;
+	const config *cfg;
+	entries *es;
+	bool *changed;
+} control_run;
+
+error_t *open_control(const char *path, control *c)
+{
+	struct sockaddr_un sa = {0};
+	error_t *err;
+
+	*c = (const control){0};
+	if (strlen(path) >= sizeof(sa.sun_path)) {
+		return errorf(E_CONTROL_FAIL, "'%s', path too long", path);
+	}
+	sa.sun_family = AF_UNIX;
+	strcpy(sa.sun_path, path);
+
+	if ((c->fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0)) == -1) {
+		c->fd = 0;
+		return errorf(E_CONTROL_FAIL, "'%s', %s", path, strerror(errno));
+	}
+	unlink(path);
+	if (bind(c->fd, (struct sockaddr *) &sa, sizeof(sa)) == -1 ||
+		listen(c->fd, CONTROL_BACKLOG) == -1) {
+		err = errorf(E_CONTROL_FAIL, "'%s', %s", path, strerror(errno));
+		close(c->fd);
+		*c = (const control){0};
+		return err;
+	}
+	c->path = strdup(path);
+
+	return NULL;
+}
+
+// Closes a client, discarding any unsent replies.
+static void close_client(control_client *cl)
+{
+	close(cl->fd);
+	free(cl->in);
+	free(cl->out);
+	*cl = (const control_client){0};
+}
+
+void close_control(control *c)
+{
+	int i;
+
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+		if (c->clients[i].fd) {
+			close_client(&c->clients[i]);
+		}
+	}
+	if (c->fd) {
+		close(c->fd);
+	}
+	if (c->path) {
+		unlink(c->path);
+	}
+	free(c->path);
+	free_delta_hist(&c->hist);
+	*c = (const control){0};
+}
+
+void control_pollfds(const control *c, struct pollfd *fds)
+{
+	const control_client *cl;
+	int i;
+
+	fds[0] = (const struct pollfd){c->fd, POLLIN, 0};
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+		cl = &c->clients[i];
+		fds[1+i] = (const struct pollfd){-1, 0, 0};
+		if (cl->fd) {
+			fds[1+i].fd = cl->fd;
+			if (!cl->eof && cl->outlen < MAX_CONTROL_OUT) {
+				fds[1+i].events |= POLLIN;
+			}
+			if (cl->outlen) {
+				fds[1+i].events |= POLLOUT;
+			}
+		}
+	}
+}
+
+bool control_ready(const struct pollfd *fds)
+{
+	int i;
+
+	for (i = 0; i < CONTROL_POLLFDS; i++) {
+		if (fds[i].revents) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void reset_control(control *c)
+{
+	free_delta_hist(&c->hist);
+}
+
+// Accepts pending connections, while there are free client slots.
+static void accept_clients(control *c, const config *cfg)
+{
+	int fd, i;
+
+	while ((fd = accept(c->fd, NULL, NULL)) != -1) {
+		for (i = 0; i < MAX_CONTROL_CLIENTS && c->clients[i].fd; i++);
+		if (i == MAX_CONTROL_CLIENTS) {
+			logw(cfg, "control socket has too many clients\n");
+			close(fd);
+			continue;
+		}
+		fcntl(fd, F_SETFL, O_NONBLOCK);
+		fcntl(fd, F_SETFD, FD_CLOEXEC);
+		c->clients[i] = (const control_client){fd, malloc(CONTROL_IN_SIZE)};
+	}
+}
+
+// Appends a reply line for a client.
+static void reply(control_client *cl, const char *fmt, ...)
+{
+	char line[MAX_ERROR_STRLEN+16];
+	va_list a;
+	size_t n;
+
+	va_start(a, fmt);
+	n = vsnprintf(line, sizeof(line) - 1, fmt, a);
+	va_end(a);
+	if (n > sizeof(line) - 2) {
+		n = sizeof(line) - 2;
+	}
+	line[n++] = '\n';
+
+	while (cl->outlen + n > cl->outcap) {
+		cl->outcap = (cl->outcap ? cl->outcap * 2 : CONTROL_IN_SIZE);
+		cl->out = realloc(cl->out, cl->outcap);
+	}
+	memcpy(cl->out + cl->outlen, line, n);
+	cl->outlen += n;
+}
+
+// Prepares for a command that may change the maps. The user state is opened and
+// the user counts are read if needed. The first change in a run removes the
+// cache and sets a new generation, so the maps aren't taken to match it, or
+// the synced contents kept by the daemon.
+static error_t *begin_change(control_run *r)
+{
+	bpf_config bcfg;
+	error_t *err;
+
+	if (!r->hnd->ufd && (err = bpf_open_state(r->hnd))) {
+		return err;
+	}
+	if (!r->c->hist.heap && (err = read_delta_hist(r->hnd, r->cfg, &r->c->hist))) {
+		free_delta_hist(&r->c->hist);
+		return err;
+	}
+	if (r->cfg->noop || *r->changed) {
+		return NULL;
+	}
+
+	remove_cache();
+	if ((err = bpf_read_config(r->hnd, &bcfg))) {
+		return err;
+	}
+	if (++bcfg.generation == 0) {
+		bcfg.generation = 1;
+	}
+	if ((err = bpf_update_config(r->hnd, &bcfg))) {
+		return err;
+	}
+	r->hnd->generation = bcfg.generation;
+	*r->changed = true;
+
+	return NULL;
+}
+
+// Runs one command, without its line terminator, and appends its reply.
+static void run_command(control_run *r, control_client *cl, const char *line,
+	size_t len)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	uint16_t classid;
+	error_t *err;
+	bool found;
+	entry e;
+	addr a;
+	char op;
+
+	while (len > 0 && isspace((unsigned char) line[len-1])) {
+		len--;
+	}
+
+	if (len > 0 && line[0] == '?') {
+		if ((err = parse_addrn(line + 1, len - 1, &a)) ||
+			(err = bpf_lookup(r->hnd, &a, &classid, &found))) {
+			reply(cl, "ERR %s", err->message);
+		} else if (!found) {
+			reply(cl, "ERR address not mapped (%s)", addr_str(&a, astr));
+		} else {
+			reply(cl, "OK %u", classid);
+		}
+		return;
+	}
+
+	if (!r->es) {
+		r->es = new_entries();
+	}
+	if ((err = parse_delta_line(line, len, r->es->us, &op, &e)) ||
+		(err = begin_change(r)) ||
+		(err = apply_delta_entry(r->hnd, r->cfg, op, &e, userid_str(r->es->us, e.uid),
+			&r->c->hist))) {
+		reply(cl, "ERR %s", err->message);
+	} else if (op == '-') {
+		reply(cl, "OK");
+	} else {
+		reply(cl, "OK %u", e.classid);
+	}
+}
+
+// Reads from a client and runs its complete commands, and at EOF, any
+// incomplete last command. A command that doesn't fit in the input buffer gets
+// one error reply, after which the client is closed, as the rest of its line
+// can't be told apart from the next command.
+static void read_client(control_run *r, control_client *cl)
+{
+	const char *p, *nl, *end;
+	ssize_t n;
+
+	if (cl->eof) {
+		return;
+	}
+	if (cl->inlen == CONTROL_IN_SIZE) {
+		reply(cl, "ERR %s", error(E_LONG_LINE)->message);
+		cl->eof = true;
+		cl->inlen = 0;
+		return;
+	}
+	if ((n = read(cl->fd, cl->in + cl->inlen, CONTROL_IN_SIZE - cl->inlen)) == -1) {
+		if (errno != EAGAIN && errno != EINTR) {
+			cl->eof = true;
+		}
+		return;
+	}
+	if (n == 0) {
+		cl->eof = true;
+	}
+	cl->inlen += n;
+
+	end = cl->in + cl->inlen;
+	for (p = cl->in; (nl = memchr(p, '\n', end - p)); p = nl + 1) {
+		run_command(r, cl, p, nl - p);
+	}
+	if (cl->eof && p < end) {
+		run_command(r, cl, p, end - p);
+		p = end;
+	}
+	cl->inlen = end - p;
+	memmove(cl->in, p, cl->inlen);
+}
+
+// Sends as many unsent replies to a client as it accepts.
+static void write_client(control_client *cl)
+{
+	ssize_t n;
+
+	if (!cl->outlen) {
+		return;
+	}
+	if ((n = send(cl->fd, cl->out, cl->outlen, MSG_NOSIGNAL)) == -1) {
+		if (errno != EAGAIN && errno != EINTR) {
+			cl->eof = true;
+			cl->outlen = 0;
+		}
+		return;
+	}
+	cl->outlen -= n;
+	memmove(cl->out, cl->out + n, cl->outlen);
+}
+
+void serve_control(control *c, const struct pollfd *fds, bpf_handle *hnd,
+	const config *cfg, bool *changed)
+{
+	control_run r = {c, hnd, cfg, NULL, changed};
+	control_client *cl;
+	short ev;
+	int i;
+
+	*changed = false;
+	for (i = 0; i < MAX_CONTROL_CLIENTS; i++) {
+		cl = &c->clients[i];
+		if (!cl->fd || !(ev = fds[1+i].revents)) {
+			continue;
+		}
+		if (ev & (POLLIN | POLLHUP | POLLERR)) {
+			read_client(&r, cl);
+		}
+		write_client(cl);
+		if (cl->eof && !cl->outlen) {
+			close_client(cl);
+		}
+	}
+	if (fds[0].revents & POLLIN) {
+		accept_clients(c, cfg);
+	}
+
+	free_entries(r.es);
+}
@@ -0,0 +1,72 @@
+#ifndef __CONTROL_H
+#define __CONTROL_H
+
+#include <poll.h>
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "bpf.h"
+#include "config.h"
+#include "delta.h"
+#include "error.h"
+
+// Maximum number of connected control clients.
+#define MAX_CONTROL_CLIENTS 16
+
+// Number of pollfds used by the control socket and its clients.
+#define CONTROL_POLLFDS (1 + MAX_CONTROL_CLIENTS)
+
+// Connected control client, with its unprocessed input and unsent replies.
+typedef struct {
+	int fd;
+	char *in;
+	size_t inlen;
+	char *out;
+	size_t outlen;
+	size_t outcap;
+	bool eof;
+} control_client;
+
+// Control socket, a listening AF_UNIX stream socket for commands that are
+// applied directly to the BPF maps, like delta input. Each command is a line,
+// and each gets a reply line, in order:
+//
+// +USERID,ADDR  adds the address            OK CLASSID
+// -USERID,ADDR  removes the address         OK
+// =USERID,ADDR  adds or moves the address   OK CLASSID
+// >USERID,ADDR  moves the address           OK CLASSID
+// ?ADDR         looks up the address        OK CLASSID
+//
+// or ERR followed by an error message. Clients may send any number of commands
+// without waiting for replies, and the replies to the commands read together
+// are sent after their map writes are done.
+typedef struct {
+	int fd;
+	char *path;
+	control_client clients[MAX_CONTROL_CLIENTS];
+	delta_hist hist;
+} control;
+
+// Creates the control socket at path, replacing any existing file.
+error_t *open_control(const char *path, control *c);
+
+// Closes the control socket and its clients, and removes its file.
+void close_control(control *c);
+
+// Sets the CONTROL_POLLFDS pollfds to poll for the control socket.
+void control_pollfds(const control *c, struct pollfd *fds);
+
+// Returns true if the control socket's pollfds have any events.
+bool control_ready(const struct pollfd *fds);
+
+// Accepts new clients and runs their commands, given their polled pollfds. The
+// first command to change the maps in a call removes the cache and sets a new
+// generation in the BPF config, and sets *changed.
+void serve_control(control *c, const struct pollfd *fds, bpf_handle *hnd,
+	const config *cfg, bool *changed);
+
+// Discards the user counts, so they're read again from the user state maps
+// for the next command (e.g. after a full sync has replaced them).
+void reset_control(control *c);
+
+#endif
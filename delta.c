@@ -0,0 +1,406 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include <linux/bpf.h>
+
+#include "classid_heap.h"
+#include "classify.h"
+#include "delta.h"
+#include "log.h"
+
+// State of a user in a delta, loaded from the user state map on first use.
+typedef struct {
+	bpf_user u;
+	bool loaded;
+	bool found;
+	bool dirty;
+} delta_user;
+
+error_t *read_delta_hist(const bpf_handle *hnd, const config *cfg, delta_hist *h)
+{
+	uint16_t classid;
+	error_t *err;
+	uint32_t i, n;
+
+	h->heap = new_classid_heap(&cfg->user_flows);
+	h->dirty = calloc(h->heap->len, sizeof(bool));
+	for (i = 0; i < h->heap->len; i++) {
+		classid = h->heap->base + i;
+		if ((err = bpf_read_hist(hnd, classid, &n))) {
+			return err;
+		}
+		set_classid_count(h->heap, classid, n);
+	}
+	heapify_classids(h->heap);
+
+	return NULL;
+}
+
+void free_delta_hist(delta_hist *h)
+{
+	free(h->dirty);
+	free_classid_heap(h->heap);
+	*h = (const delta_hist){0};
+}
+
+// Loads the state of a user, if not already loaded.
+static error_t *load_user(const bpf_handle *hnd, const char *userid, delta_user *du)
+{
+	error_t *err;
+
+	if (!du->loaded) {
+		if ((err = bpf_lookup_user(hnd, userid, &du->u, &du->found))) {
+			return err;
+		}
+		du->loaded = true;
+	}
+
+	return NULL;
+}
+
+// Adds a new user, directly classified or with the least used classid.
+static void add_user(const config *cfg, const char *userid, delta_user *du,
+	delta_hist *h)
+{
+	uint16_t classid;
+
+	if (userid_to_classid(cfg, userid, &classid)) {
+		inc_classid_count(h->heap, classid);
+	} else {
+		classid = pick_classid(h->heap);
+	}
+	h->dirty[classid - h->heap->base] = true;
+
+	du->u = (const bpf_user){classid, 0};
+	du->found = true;
+	du->dirty = true;
+}
+
+// Removes a user whose last address was removed.
+static void remove_user(const config *cfg, delta_user *du, delta_hist *h)
+{
+	if (is_in_range(&cfg->user_flows, du->u.classid)) {
+		dec_classid_count(h->heap, du->u.classid);
+		h->dirty[du->u.classid - h->heap->base] = true;
+	}
+	du->found = false;
+	du->dirty = true;
+}
+
+// Writes the state of a user, if changed.
+static error_t *write_user(const bpf_handle *hnd, const char *userid,
+	const delta_user *du)
+{
+	if (!du->dirty) {
+		return NULL;
+	}
+	if (du->found) {
+		return bpf_update_user(hnd, userid, &du->u);
+	}
+	return bpf_delete_user(hnd, userid);
+}
+
+// Returns the state of the user that owns an address: its element of dus if
+// it's one of the users us of the delta, or else tmp, which is written by the
+// caller. us and dus may be NULL.
+static delta_user *owner_user(const userids *us, delta_user *dus, const char *owner,
+	delta_user *tmp)
+{
+	uint32_t uid;
+
+	if (us && find_userid(us, owner, strlen(owner), &uid)) {
+		return &dus[uid];
+	}
+	*tmp = (const delta_user){0};
+	return tmp;
+}
+
+// Applies one delta entry for user state du, with the states dus of the users
+// us of the delta for moving addresses from them.
+static error_t *apply_entry(const bpf_handle *hnd, const config *cfg, const char op,
+	entry *e, const char *userid, delta_user *du, const userids *us, delta_user *dus,
+	delta_hist *h, unsigned long *changes)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	bool found, owned = false;
+	delta_user *ou, tmp;
+	bpf_userid owner;
+	uint16_t classid;
+	error_t *err;
+
+	if ((err = load_user(hnd, userid, du))) {
+		return err;
+	}
+	if ((err = bpf_lookup(hnd, &e->addr, &classid, &found))) {
+		return err;
+	}
+	if (found && (err = bpf_lookup_owner(hnd, &e->addr, owner, &owned))) {
+		return err;
+	}
+
+	if (op == '-') {
+		if (!du->found) {
+			return errorf(E_DELTA_UNKNOWN_USER, "%s", userid);
+		}
+		if (!found) {
+			return errorf(E_DELTA_ADDR_MISSING, "%s", addr_str(&e->addr, astr));
+		}
+		if (!owned) {
+			return errorf(E_DELTA_ADDR_NO_OWNER, "%s", addr_str(&e->addr, astr));
+		}
+		if (strcmp(owner, userid)) {
+			return errorf(E_DELTA_ADDR_MISMATCH, "%s belongs to user %s",
+				addr_str(&e->addr, astr), owner);
+		}
+		logn(cfg, "Delta: delete %s %u\n", addr_str(&e->addr, astr), classid);
+		if (!cfg->noop && ((err = bpf_delete(hnd, &e->addr)) ||
+			(err = bpf_delete_owner(hnd, &e->addr)))) {
+			return err;
+		}
+		if (du->u.naddrs > 0) {
+			du->u.naddrs--;
+		}
+		if (du->u.naddrs == 0) {
+			remove_user(cfg, du, h);
+		}
+		du->dirty = true;
+		(*changes)++;
+		return NULL;
+	}
+
+	if (op == '+' && found) {
+		return errorf(E_DELTA_ADDR_EXISTS, "%s", addr_str(&e->addr, astr));
+	}
+	if (op == '>' && !found) {
+		return errorf(E_DELTA_ADDR_MISSING, "%s", addr_str(&e->addr, astr));
+	}
+	if (found && !owned) {
+		return errorf(E_DELTA_ADDR_NO_OWNER, "%s", addr_str(&e->addr, astr));
+	}
+	if (found && !strcmp(owner, userid)) {
+		e->classid = classid;
+		e->classified = true;
+		if (cfg->log >= LOG_VERBOSE) {
+			logv(cfg, "Delta: leave %s %u\n", addr_str(&e->addr, astr), classid);
+		}
+		return NULL;
+	}
+	ou = NULL;
+	if (found) {
+		ou = owner_user(us, dus, owner, &tmp);
+		if ((err = load_user(hnd, owner, ou))) {
+			return err;
+		}
+	}
+	if (!du->found) {
+		add_user(cfg, userid, du, h);
+	}
+	e->classid = du->u.classid;
+	e->classified = true;
+
+	if (!found) {
+		logn(cfg, "Delta: add %s %u\n", addr_str(&e->addr, astr), e->classid);
+		if (!cfg->noop &&
+			((err = bpf_update(hnd, &e->addr, e->classid, BPF_NOEXIST)) ||
+			(err = bpf_update_owner(hnd, &e->addr, userid)))) {
+			return err;
+		}
+	} else {
+		// the address moves from its owner, whose state is updated in the
+		// same step
+		logn(cfg, "Delta: move %s %u from user %s\n", addr_str(&e->addr, astr),
+			e->classid, owner);
+		if (!cfg->noop && ((classid != e->classid &&
+			(err = bpf_update(hnd, &e->addr, e->classid, BPF_EXIST))) ||
+			(err = bpf_update_owner(hnd, &e->addr, userid)))) {
+			return err;
+		}
+		if (ou->found) {
+			if (ou->u.naddrs > 0) {
+				ou->u.naddrs--;
+			}
+			if (ou->u.naddrs == 0) {
+				remove_user(cfg, ou, h);
+			}
+			ou->dirty = true;
+		}
+		if (ou == &tmp && !cfg->noop && (err = write_user(hnd, owner, ou))) {
+			return err;
+		}
+	}
+	du->u.naddrs++;
+	du->dirty = true;
+	(*changes)++;
+
+	return NULL;
+}
+
+// Writes the changed user counts.
+static error_t *write_hist(const bpf_handle *hnd, delta_hist *h)
+{
+	error_t *err;
+	uint32_t i;
+
+	for (i = 0; i < h->heap->len; i++) {
+		if (h->dirty[i]) {
+			if ((err = bpf_write_hist(hnd, h->heap->base + i, h->heap->counts[i]))) {
+				return err;
+			}
+			h->dirty[i] = false;
+		}
+	}
+
+	return NULL;
+}
+
+// Writes the changed user states and counts.
+static error_t *write_state(const bpf_handle *hnd, const entries *es,
+	const delta_user *dus, delta_hist *h)
+{
+	error_t *err;
+	uint32_t i;
+
+	for (i = 0; i < es->us->len; i++) {
+		if ((err = write_user(hnd, userid_str(es->us, i), &dus[i]))) {
+			return err;
+		}
+	}
+
+	return write_hist(hnd, h);
+}
+
+error_t *apply_delta(const bpf_handle *hnd, const config *cfg, entries *es,
+	const char *ops)
+{
+	delta_hist h = {0};
+	unsigned long changes = 0;
+	delta_user *dus = NULL;
+	error_t *err, *werr;
+	unsigned long i;
+	entry *e;
+
+	if ((err = read_delta_hist(hnd, cfg, &h))) {
+		goto out;
+	}
+	dus = calloc(es->us->len, sizeof(delta_user));
+
+	for (i = 0; i < es->len; i++) {
+		e = &es->arr[i];
+		if ((err = apply_entry(hnd, cfg, ops[i], e, userid_str(es->us, e->uid),
+			&dus[e->uid], es->us, dus, &h, &changes))) {
+			break;
+		}
+	}
+
+	if (!cfg->noop && (werr = write_state(hnd, es, dus, &h)) && !err) {
+		err = werr;
+	}
+	if (!err) {
+		logn(cfg, "Delta: %lu changes from %lu lines\n", changes, es->len);
+	}
+
+out:
+	free(dus);
+	free_delta_hist(&h);
+	return err;
+}
+
+error_t *apply_delta_entry(const bpf_handle *hnd, const config *cfg, const char op,
+	entry *e, const char *userid, delta_hist *h)
+{
+	unsigned long changes = 0;
+	delta_user du = {0};
+	error_t *err, *werr;
+
+	err = apply_entry(hnd, cfg, op, e, userid, &du, NULL, NULL, h, &changes);
+	if (!cfg->noop && (werr = write_user(hnd, userid, &du)) && !err) {
+		err = werr;
+	}
+	if (!cfg->noop && (werr = write_hist(hnd, h)) && !err) {
+		err = werr;
+	}
+
+	return err;
+}
+
+// Records the user IDs that the addresses of entries belong to, BPF_BATCH_LEN
+// at a time.
+static error_t *load_owners(const bpf_handle *hnd, const entries *es)
+{
+	bpf_userid *userids = malloc(BPF_BATCH_LEN * sizeof(bpf_userid));
+	bpf_owner_key *keys = malloc(BPF_BATCH_LEN * sizeof(bpf_owner_key));
+	error_t *err = NULL;
+	unsigned long i, n;
+	entry *e;
+
+	for (i = 0; i < es->len && !err; i += n) {
+		for (n = 0; n < BPF_BATCH_LEN && i + n < es->len; n++) {
+			e = &es->arr[i + n];
+			bpf_owner_key_of(&e->addr, &keys[n]);
+			memset(userids[n], 0, sizeof(bpf_userid));
+			strncpy(userids[n], entry_userid(es, e), MAX_USERID_STRLEN);
+		}
+		err = bpf_load_owners(hnd, keys, userids, n);
+	}
+
+	free(keys);
+	free(userids);
+	return err;
+}
+
+error_t *save_user_state(bpf_handle *hnd, const config *cfg, entries *es)
+{
+	uint32_t n = u16_range_size(&cfg->user_flows);
+	uint32_t nu = es->us->len;
+	bpf_userid *userids;
+	uint32_t *hist;
+	bpf_handle nh;
+	bpf_user *us;
+	error_t *err;
+	unsigned long i;
+	uint32_t u, c;
+
+	userids = malloc(nu * sizeof(bpf_userid));
+	us = malloc(nu * sizeof(bpf_user));
+	hist = malloc(n * sizeof(uint32_t));
+	memset(userids, 0, nu * sizeof(bpf_userid));
+	memset(us, 0, nu * sizeof(bpf_user));
+	memset(hist, 0, n * sizeof(uint32_t));
+
+	for (i = 0; i < es->len; i++) {
+		us[es->arr[i].uid].classid = es->arr[i].classid;
+		us[es->arr[i].uid].naddrs++;
+	}
+	for (u = 0; u < nu; u++) {
+		strncpy(userids[u], userid_str(es->us, u), MAX_USERID_STRLEN);
+		if (us[u].naddrs > 0 && is_in_range(&cfg->user_flows, us[u].classid)) {
+			hist[us[u].classid - cfg->user_flows.lo]++;
+		}
+	}
+
+	if ((err = bpf_new_state(&nh))) {
+		goto out;
+	}
+	if ((err = bpf_load_users(&nh, userids, us, nu))) {
+		goto out;
+	}
+	if ((err = load_owners(&nh, es))) {
+		goto out;
+	}
+	for (c = 0; c < n; c++) {
+		if (hist[c] && (err = bpf_write_hist(&nh, cfg->user_flows.lo + c, hist[c]))) {
+			goto out;
+		}
+	}
+	if ((err = bpf_pin_state(hnd, &nh))) {
+		goto out;
+	}
+	logv(cfg, "Saved state of %u users\n", nu);
+
+out:
+	bpf_close(&nh);
+	free(hist);
+	free(us);
+	free(userids);
+	return err;
+}
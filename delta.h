@@ -0,0 +1,47 @@
+#ifndef __DELTA_H
+#define __DELTA_H
+
+#include "bpf.h"
+#include "classid_heap.h"
+#include "config.h"
+#include "entry.h"
+#include "error.h"
+
+// Per-classid user counts for deltas, kept in a heap to pick the least used,
+// with the classids whose counts have changed since they were written.
+typedef struct {
+	classid_heap *heap;
+	bool *dirty;
+} delta_hist;
+
+// Reads the user counts of the user flows range from the user state maps.
+error_t *read_delta_hist(const bpf_handle *hnd, const config *cfg, delta_hist *h);
+
+// Frees the user counts.
+void free_delta_hist(delta_hist *h);
+
+// Applies delta input to the BPF maps, with targeted map operations for each
+// entry according to its operation in ops: '+' adds the address, '-' removes
+// it, '=' adds it, or moves it from the user it belongs to, unless it already
+// belongs to its user, and '>' moves it like '=', but only if it's mapped. The
+// user state maps record which user each address belongs to, so a move also
+// updates the address count of its previous user. Known users keep their classid from the user state maps, and
+// new users are assigned the least used classid from the per-classid user
+// counts, so the cost is proportional to the size of the delta rather than of
+// the maps. The user state is updated for the changes made, even if an error
+// stops the delta part way through.
+error_t *apply_delta(const bpf_handle *hnd, const config *cfg, entries *es,
+	const char *ops);
+
+// Applies one delta entry like apply_delta, but with user counts h kept
+// between calls, writing the user's state and the changed counts before
+// returning.
+error_t *apply_delta_entry(const bpf_handle *hnd, const config *cfg, const char op,
+	entry *e, const char *userid, delta_hist *h);
+
+// Saves the classids and address counts of the users in classified entries,
+// the per-classid user counts, and the user of each address, in new user state
+// maps that replace the pinned ones.
+error_t *save_user_state(bpf_handle *hnd, const config *cfg, entries *es);
+
+#endif
@@ -0,0 +1,70 @@
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "bpf_config.h"
+#include "dump.h"
+#include "version.h"
+
+// Size of the output buffer.
+#define DUMP_BUF_SIZE (1 << 16)
+
+// Writes the BPF config as comments.
+static void write_config(FILE *fp, const bpf_config *bcfg)
+{
+	char cbstr[MAX_CLASSIFY_BY_STRLEN+1];
+
+	fprintf(fp, "# tc-users %s dump of the BPF maps\n", VERSION);
+	fprintf(fp, "# user IDs are classids, for use with the same --user-flows\n");
+	fprintf(fp, "# classify by addresses: %s\n", classify_by_str(bcfg->classify_by, cbstr));
+	fprintf(fp, "# bpf flows per user: %u\n", bcfg->flows_per_user);
+	fprintf(fp, "# uncl flows: %u-%u\n", bcfg->uncl_flows_start,
+		bcfg->uncl_flows_start + bcfg->uncl_flows_len - 1);
+	fprintf(fp, "# count traffic: %s\n", (bcfg->count_traffic ? "yes" : "no"));
+	fprintf(fp, "# active set: %u\n", bcfg->active_set);
+	fprintf(fp, "# generation: %u\n", bcfg->generation);
+}
+
+error_t *dump_bpf(bpf_handle *hnd, const char *path, unsigned long *n)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	error_t *err = NULL;
+	bpf_config bcfg;
+	uint16_t classid;
+	bool tostdout;
+	bpf_it *it;
+	FILE *fp;
+	addr a;
+
+	*n = 0;
+	if ((err = bpf_read_config(hnd, &bcfg))) {
+		return err;
+	}
+
+	tostdout = !strcmp(path, "-");
+	if ((fp = (tostdout ? stdout : fopen(path, "w"))) == NULL) {
+		return errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", path, strerror(errno));
+	}
+	if (!tostdout) {
+		setvbuf(fp, NULL, _IOFBF, DUMP_BUF_SIZE);
+	}
+
+	write_config(fp, &bcfg);
+	it = bpf_new_it(hnd);
+	while ((err = bpf_next(it, &a, &classid)) == NULL && !it->done) {
+		if (fprintf(fp, "%u %s\n", classid, addr_str(&a, astr)) < 0) {
+			break;
+		}
+		(*n)++;
+	}
+	free(it);
+
+	if (!err && (ferror(fp) || fflush(fp))) {
+		err = errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", path, strerror(errno));
+	}
+	if (!tostdout && fclose(fp) && !err) {
+		err = errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", path, strerror(errno));
+	}
+	return err;
+}
@@ -0,0 +1,15 @@
+#ifndef __DUMP_H
+#define __DUMP_H
+
+#include "bpf.h"
+#include "error.h"
+
+// Writes the contents of the BPF address maps in the input format to a file,
+// or stdout if path is "-", with the BPF config as comments first. The user ID
+// of each address is its classid, so the dump classifies the same addresses
+// as the maps when used as input with the same --user-flows. The maps are read
+// in batches, so memory use doesn't depend on their size. *n is set to the
+// number of entries written.
+error_t *dump_bpf(bpf_handle *hnd, const char *path, unsigned long *n);
+
+#endif
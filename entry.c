@@ -6,6 +6,7 @@ entries *new_entries()
 {
 	entries *es = malloc(sizeof(entries));
 	*es = (const entries){0};
+	es->us = new_userids();
 	return es;
 }
 
@@ -19,14 +20,42 @@ void append_entry(entries *es, const entry *e)
 	es->len++;
 }
 
+void reserve_entries(entries *es, const unsigned long n)
+{
+	if (es->len + n > es->cap) {
+		es->cap = es->len + n;
+		es->arr = realloc(es->arr, es->cap * sizeof(entry));
+	}
+}
+
+const char *entry_userid(const entries *es, const entry *e)
+{
+	return userid_str(es->us, e->uid);
+}
+
+void order_entry_userids(entries *es)
+{
+	uint32_t *remap = malloc(es->us->len * sizeof(uint32_t));
+	unsigned long i;
+
+	order_userids(es->us, remap);
+	for (i = 0; i < es->len; i++) {
+		es->arr[i].uid = remap[es->arr[i].uid];
+	}
+
+	free(remap);
+}
+
 void sort_entries(entries *es, int (*compar)(const void *, const void *))
 {
 	qsort(es->arr, es->len, sizeof(entry), compar);
+	es->sorted = false;
 }
 
 void free_entries(entries *es)
 {
 	if (es) {
+		free_userids(es->us);
 		free(es->arr);
 	}
 	free(es);
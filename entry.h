@@ -5,20 +5,24 @@
 
 #include "addr.h"
 #include "limits.h"
+#include "userids.h"
 
-// Contains one mapping of address, user ID and class ID.
+// Contains one mapping of address, user ID and class ID. The user ID is
+// interned in the userids table of the entries that contain the entry.
 typedef struct {
 	addr addr;
-	char userid[MAX_USERID_STRLEN+1];
+	uint32_t uid;
 	uint16_t classid;
 	bool classified;
 } entry;
 
-// Contains an array of entries.
+// Contains an array of entries (sorted is true if known to be sorted by address).
 typedef struct {
 	entry *arr;
+	userids *us;
 	unsigned long len;
 	unsigned long cap;
+	bool sorted;
 } entries;
 
 // An entries iterator.
@@ -33,6 +37,15 @@ entries *new_entries();
 // Appends an entry.
 void append_entry(entries *es, const entry *e);
 
+// Ensures capacity for at least n more entries.
+void reserve_entries(entries *es, const unsigned long n);
+
+// Returns the user ID string for an entry.
+const char *entry_userid(const entries *es, const entry *e);
+
+// Renumbers uids so that comparing them orders entries by user ID.
+void order_entry_userids(entries *es);
+
 // Sorts entries with a comparator.
 void sort_entries(entries *es, int (*compar)(const void *, const void *));
 
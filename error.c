@@ -12,6 +12,8 @@ static const char * const err_strs[E_MAX] = {
 	"too many command line arguments",
 	"file argument required",
 	"unable to open input file",
+	"unable to read input",
+	"unable to write output",
 	"input contained no data",
 	"empty range",
 	"invalid range",
@@ -27,6 +29,12 @@ static const char * const err_strs[E_MAX] = {
 	"user flows size must be multiple of minimum flows per user",
 	"user flows size must be multiple of maximum flows per user",
 	"unclassified flows size must be power of two",
+	"invalid number of threads",
+	"invalid assign mode",
+	"invalid max load",
+	"replace can't be used when streaming",
+	"invalid track users",
+	"invalid parallel sync",
 	"line too long",
 	"too few fields",
 	"user ID empty",
@@ -44,10 +52,31 @@ static const char * const err_strs[E_MAX] = {
 	"BPF get next key failure",
 	"BPF lookup element failure",
 	"BPF delete element failure",
+	"BPF lookup batch failure",
+	"BPF map create failure",
+	"BPF pin object failure",
+	"BPF map sets not found",
+	"duplicate address in input",
+	"addresses mapped to more than one user ID",
+	"invalid snapshot",
+	"snapshot input can't be streamed",
+	"invalid delta operation, must be '+', '-', '=' or '>'",
+	"option can't be used with delta input",
+	"delta adds an address that is already mapped",
+	"delta removes or moves an address that is not mapped",
+	"delta removes an address that is mapped to another user",
+	"delta changes an address with no recorded user ID",
+	"delta removes an address of an unknown user ID",
+	"no user state, run a full sync with --track-users first",
+	"option can't be used with --daemon",
+	"unable to watch input file",
+	"invalid control socket",
+	"control socket failed",
+	"option can't be used with --dump",
 };
 
-// Global error value (only for use by errorf).
-static error_t g_error;
+// Global error value, one per thread (only for use by error and errorf).
+static __thread error_t g_error;
 
 // Sets and returns the global error.
 error_t *error(enum err_code code)
@@ -61,15 +90,22 @@ error_t *error(enum err_code code)
 error_t *errorf(enum err_code code, const char *fmt, ...)
 {
 	va_list a;
+	size_t l;
 
 	g_error.code = code;
 	strncpy(g_error.message, err_strs[code], MAX_ERROR_STRLEN+1);
-	strncat(g_error.message, " (", MAX_ERROR_STRLEN+1);
+	strncat(g_error.message, " (", MAX_ERROR_STRLEN - strlen(g_error.message));
+	l = strlen(g_error.message);
 	va_start(a, fmt);
-	vsnprintf(g_error.message + strlen(g_error.message),
-		MAX_ERROR_STRLEN+1, fmt, a);
+	vsnprintf(g_error.message + l, MAX_ERROR_STRLEN+1 - l, fmt, a);
 	va_end(a);
-	strncat(g_error.message, ")", MAX_ERROR_STRLEN+1);
+	strncat(g_error.message, ")", MAX_ERROR_STRLEN - strlen(g_error.message));
 
 	return &g_error;
 }
+
+error_t *copy_error(const error_t *err)
+{
+	g_error = *err;
+	return &g_error;
+}
@@ -11,6 +11,8 @@ enum err_code {
 	E_TOO_MANY_ARGS,
 	E_FILE_ARG_REQUIRED,
 	E_OPEN_INPUT_FILE_FAILED,
+	E_READ_INPUT_FAILED,
+	E_WRITE_OUTPUT_FAILED,
 	E_NO_INPUT,
 	E_EMPTY_RANGE,
 	E_INVALID_RANGE,
@@ -26,6 +28,12 @@ enum err_code {
 	E_USER_FLOWS_SIZE_NOT_MULTIPLE_MIN,
 	E_USER_FLOWS_SIZE_NOT_MULTIPLE_MAX,
 	E_UNCL_FLOWS_SIZE_NOT_POW2,
+	E_INVALID_THREADS,
+	E_INVALID_ASSIGN_MODE,
+	E_INVALID_MAX_LOAD,
+	E_STREAM_REPLACE,
+	E_INVALID_TRACK_USERS,
+	E_INVALID_PARALLEL_SYNC,
 	E_LONG_LINE,
 	E_TOO_FEW_FIELDS,
 	E_USERID_EMPTY,
@@ -43,6 +51,27 @@ enum err_code {
 	E_BPF_GET_NEXT_KEY_FAIL,
 	E_BPF_LOOKUP_ELEM_FAIL,
 	E_BPF_DELETE_ELEM_FAIL,
+	E_BPF_LOOKUP_BATCH_FAIL,
+	E_BPF_MAP_CREATE_FAIL,
+	E_BPF_OBJ_PIN_FAIL,
+	E_BPF_NO_MAP_SETS,
+	E_DUPLICATE_ADDR,
+	E_CONFLICTING_ADDRS,
+	E_INVALID_SNAPSHOT,
+	E_STREAM_SNAPSHOT,
+	E_INVALID_DELTA_OP,
+	E_DELTA_OPTION,
+	E_DELTA_ADDR_EXISTS,
+	E_DELTA_ADDR_MISSING,
+	E_DELTA_ADDR_MISMATCH,
+	E_DELTA_ADDR_NO_OWNER,
+	E_DELTA_UNKNOWN_USER,
+	E_NO_USER_STATE,
+	E_DAEMON_OPTION,
+	E_WATCH_FAIL,
+	E_INVALID_CONTROL,
+	E_CONTROL_FAIL,
+	E_DUMP_OPTION,
 	E_MAX,
 };
 
@@ -58,4 +87,8 @@ error_t *error(enum err_code code);
 // Sets and returns the global error with a message.
 error_t *errorf(enum err_code code, const char *fmt, ...);
 
+// Sets the global error to a copy of err (e.g. from another thread) and
+// returns it.
+error_t *copy_error(const error_t *err);
+
 #endif
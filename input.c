@@ -2,78 +2,245 @@
 #include <string.h>
 #include <ctype.h>
 #include <stdbool.h>
+#include <errno.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 
 #include "input.h"
 #include "limits.h"
+#include "snapshot.h"
 
-#define ENTRY_DELIMS " ,;"
 #define MAX_LINE (2 * (MAX_USERID_STRLEN + 1 + MAX_ADDR_STRLEN + 2))
+#define READ_BLOCK (1 << 20)
+#define MIN_CHUNK (1 << 20)
 
-static void trim_tr(char *s)
+// A chunk of mapped input, parsed by one thread into its own slice of the
+// entries array.
+typedef struct {
+	input in;
+	entries es;
+	unsigned long lines;
+	const char *line;
+	size_t len;
+	error_t err;
+	bool failed;
+	bool started;
+	pthread_t thread;
+} chunk;
+
+// Returns true if c is an entry delimiter (space, comma or semicolon).
+static bool is_delim(const char c)
 {
-	int i;
+	return c == ' ' || c == ',' || c == ';';
+}
 
-	for (i = strlen(s)-1; i >= 0; i--) {
-		if (isspace(s[i])) {
-			s[i] = '\0';
-		} else {
-			break;
+static size_t trim_tr(const char *s, size_t len)
+{
+	while (len > 0 && isspace((unsigned char) s[len-1])) {
+		len--;
+	}
+
+	return len;
+}
+
+error_t *open_input(const char *path, input *in)
+{
+	struct stat st;
+
+	*in = (const input){0};
+	if (!path || !strcmp(path, "-")) {
+		in->fd = STDIN_FILENO;
+	} else if ((in->fd = open(path, O_RDONLY)) == -1) {
+		return errorf(E_OPEN_INPUT_FILE_FAILED, "'%s', %s", path, strerror(errno));
+	}
+
+	if (fstat(in->fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+		in->buf = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, in->fd, 0);
+		if (in->buf != MAP_FAILED) {
+			madvise(in->buf, st.st_size, MADV_SEQUENTIAL);
+			in->len = st.st_size;
+			in->mapped = true;
+			return NULL;
 		}
 	}
+
+	in->cap = READ_BLOCK;
+	in->buf = malloc(in->cap);
+
+	return NULL;
 }
 
-static error_t *read_line(FILE *fp, char *line)
+void close_input(input *in)
 {
-	if (!fgets(line, MAX_LINE+1, fp)) {
-		return error(E_EOF);
+	if (in->mapped) {
+		munmap(in->buf, in->len);
+	} else {
+		free(in->buf);
 	}
-	if (strlen(line) >= MAX_LINE) {
-		return error(E_LONG_LINE);
+	if (in->fd > STDIN_FILENO) {
+		close(in->fd);
+	}
+	*in = (const input){0};
+}
+
+// Reads the next block from a stream, keeping any unconsumed data.
+static error_t *read_block(input *in)
+{
+	ssize_t r;
+
+	memmove(in->buf, in->buf + in->pos, in->len - in->pos);
+	in->len -= in->pos;
+	in->pos = 0;
+
+	do {
+		r = read(in->fd, in->buf + in->len, in->cap - in->len);
+	} while (r == -1 && errno == EINTR);
+	if (r == -1) {
+		return errorf(E_READ_INPUT_FAILED, "%s", strerror(errno));
+	}
+	if (r == 0) {
+		in->eof = true;
+	}
+	in->len += r;
+
+	return NULL;
+}
+
+// Reads from a stream until at least n bytes are buffered, or EOF.
+static error_t *fill_input(input *in, const size_t n)
+{
+	error_t *err;
+
+	while (!in->mapped && !in->eof && in->len - in->pos < n) {
+		if ((err = read_block(in))) {
+			return err;
+		}
 	}
-	trim_tr(line);
 
 	return NULL;
 }
 
-static error_t *parse_userid(const char *s, char *userid)
+// Reads the rest of a stream into memory.
+static error_t *read_all(input *in)
 {
-	if (strlen(s) == 0) {
+	error_t *err;
+
+	while (!in->mapped && !in->eof) {
+		if (in->len == in->cap) {
+			in->cap *= 2;
+			in->buf = realloc(in->buf, in->cap);
+		}
+		if ((err = read_block(in))) {
+			return err;
+		}
+	}
+
+	return NULL;
+}
+
+// Returns the next line in place, without its line terminator.
+static error_t *next_line(input *in, const char **line, size_t *len)
+{
+	const char *nl;
+	error_t *err;
+
+	for (;;) {
+		if ((nl = memchr(in->buf + in->pos, '\n', in->len - in->pos))) {
+			*line = in->buf + in->pos;
+			*len = nl - *line;
+			in->pos += *len + 1;
+			return NULL;
+		}
+		if (in->mapped || in->eof || in->len - in->pos >= MAX_LINE) {
+			if (in->pos == in->len) {
+				return error(E_EOF);
+			}
+			*line = in->buf + in->pos;
+			*len = in->len - in->pos;
+			in->pos = in->len;
+			return NULL;
+		}
+		if ((err = read_block(in))) {
+			return err;
+		}
+	}
+}
+
+// Returns the next field from *s up to end, or NULL if there are no more.
+static const char *next_field(const char **s, const char *end, size_t *len)
+{
+	const char *p = *s;
+	const char *f;
+
+	while (p < end && is_delim(*p)) {
+		p++;
+	}
+	if (p == end) {
+		return NULL;
+	}
+	f = p;
+	while (p < end && !is_delim(*p)) {
+		p++;
+	}
+	*len = p - f;
+	*s = p;
+
+	return f;
+}
+
+// Returns true if a line is a comment.
+static bool is_comment(const char *line, const size_t len)
+{
+	return len > 0 && line[0] == '#';
+}
+
+static error_t *parse_userid(const char *s, const size_t len, userids *us,
+	uint32_t *uid)
+{
+	bool added;
+
+	if (len == 0) {
 		return error(E_USERID_EMPTY);
 	}
-	if (strlen(s) > MAX_USERID_STRLEN) {
+	if (len > MAX_USERID_STRLEN) {
 		return error(E_USERID_LONG);
 	}
-	strncpy(userid, s, MAX_USERID_STRLEN+1);
+	*uid = intern_userid(us, s, len, &added);
 
 	return NULL;
 }
 
-static error_t *parse_entry(FILE *fp, char *line, entry *e)
+static error_t *parse_entry(const char *line, const size_t len, userids *us,
+	entry *e)
 {
-	char tline[MAX_LINE+1];
+	const char *end = line + len;
+	const char *p = line;
+	const char *t;
 	error_t *err;
-	char *t, *p;
+	size_t tlen;
 
-	if ((err = read_line(fp, line))) {
-		return err;
+	if (len >= MAX_LINE) {
+		return error(E_LONG_LINE);
 	}
-	strncpy(tline, line, MAX_LINE+1);
 
-	if ((t = strtok_r(tline, ENTRY_DELIMS, &p)) == NULL) {
+	if ((t = next_field(&p, end, &tlen)) == NULL) {
 		return error(E_TOO_FEW_FIELDS);
 	}
-	if ((err = parse_userid(t, e->userid))) {
+	if ((err = parse_userid(t, tlen, us, &e->uid))) {
 		return err;
 	}
 
-	if ((t = strtok_r(NULL, ENTRY_DELIMS, &p)) == NULL) {
+	if ((t = next_field(&p, end, &tlen)) == NULL) {
 		return error(E_TOO_FEW_FIELDS);
 	}
-	if ((err = parse_addr(t, &e->addr))) {
+	if ((err = parse_addrn(t, tlen, &e->addr))) {
 		return err;
 	}
 
-	if ((t = strtok_r(NULL, ENTRY_DELIMS, &p)) != NULL) {
+	if (next_field(&p, end, &tlen) != NULL) {
 		return error(E_TOO_MANY_FIELDS);
 	}
 
@@ -83,29 +250,304 @@ static error_t *parse_entry(FILE *fp, char *line, entry *e)
 	return NULL;
 }
 
-error_t *parse_input(FILE *fp, entries *es)
+// Parses lines until EOF, counting them in *n. If an entry fails to parse,
+// *line and *len are set to the offending line, which is line number *n.
+static error_t *parse_lines(input *in, entries *es, unsigned long *n,
+	const char **line, size_t *len)
 {
-	char line[MAX_LINE+1];
-	bool done = false;
 	error_t *err;
 	entry e;
-	int n;
 
-	n = 1;
-	do {
-		if ((err = parse_entry(fp, line, &e))) {
-			if (err->code != E_EOF) {
-				return errorf(err->code, "on line #%d, full line: '%s'", n, line);
+	for (*n = 0; ; ) {
+		if ((err = next_line(in, line, len))) {
+			return (err->code == E_EOF ? NULL : err);
+		}
+		(*n)++;
+		*len = trim_tr(*line, *len);
+		if (is_comment(*line, *len)) {
+			continue;
+		}
+		if ((err = parse_entry(*line, *len, es->us, &e))) {
+			return err;
+		}
+		append_entry(es, &e);
+	}
+}
+
+// Returns an error for line n.
+static error_t *line_error(const error_t *err, const unsigned long n, const char *line,
+	const size_t len)
+{
+	return errorf(err->code, "on line #%lu, full line: '%.*s'", n,
+		(int) (len < MAX_LINE ? len : MAX_LINE), line);
+}
+
+// Parser thread main.
+static void *parse_chunk(void *arg)
+{
+	chunk *c = arg;
+	error_t *err;
+
+	if ((err = parse_lines(&c->in, &c->es, &c->lines, &c->line, &c->len))) {
+		c->err = *err;
+		c->failed = true;
+	}
+
+	return NULL;
+}
+
+// Returns the number of lines in a buffer.
+static unsigned long count_lines(const char *buf, const size_t len)
+{
+	const char *p = buf, *end = buf + len;
+	unsigned long n = 0;
+
+	while (p < end && (p = memchr(p, '\n', end - p))) {
+		p++;
+		n++;
+	}
+	if (len > 0 && buf[len-1] != '\n') {
+		n++;
+	}
+
+	return n;
+}
+
+// Interns a chunk's user IDs into the entries, and renumbers its entries' uids.
+static void merge_userids(entries *es, chunk *c)
+{
+	uint32_t *remap = malloc(c->es.us->len * sizeof(uint32_t));
+	const char *s;
+	unsigned long i;
+	bool added;
+	uint32_t u;
+
+	for (u = 0; u < c->es.us->len; u++) {
+		s = userid_str(c->es.us, u);
+		remap[u] = intern_userid(es->us, s, strlen(s), &added);
+	}
+	for (i = 0; i < c->es.len; i++) {
+		c->es.arr[i].uid = remap[c->es.arr[i].uid];
+	}
+
+	free(remap);
+}
+
+// Splits mapped input into chunks at line boundaries and parses them in
+// parallel. Each chunk parses directly into a slice of the entries array sized
+// by its line count, and the slices are moved together afterwards if comment
+// lines left gaps. Each chunk interns user IDs into its own table, which is
+// merged afterwards.
+static error_t *parse_chunks(input *in, const unsigned int nchunks, entries *es)
+{
+	chunk *chunks = calloc(nchunks, sizeof(chunk));
+	unsigned long lines = 0;
+	error_t *err = NULL;
+	size_t start, end;
+	const char *nl;
+	unsigned int i;
+	chunk *c;
+
+	for (i = 0, start = 0; i < nchunks; i++, start = end) {
+		end = (i == nchunks-1 ? in->len : in->len / nchunks * (i+1));
+		if (end < start) {
+			end = start;
+		} else if (end < in->len && (nl = memchr(in->buf + end, '\n', in->len - end))) {
+			end = nl - in->buf + 1;
+		} else {
+			end = in->len;
+		}
+		c = &chunks[i];
+		c->in.buf = in->buf + start;
+		c->in.len = end - start;
+		c->in.mapped = true;
+		c->es.cap = count_lines(c->in.buf, c->in.len);
+		lines += c->es.cap;
+	}
+
+	reserve_entries(es, lines);
+	for (i = 0, lines = 0; i < nchunks; i++) {
+		c = &chunks[i];
+		c->es.arr = &es->arr[es->len + lines];
+		c->es.us = new_userids();
+		lines += c->es.cap;
+		c->started = (pthread_create(&c->thread, NULL, parse_chunk, c) == 0);
+		if (!c->started) {
+			parse_chunk(c);
+		}
+	}
+
+	for (i = 0; i < nchunks; i++) {
+		c = &chunks[i];
+		if (c->started) {
+			pthread_join(c->thread, NULL);
+		}
+	}
+
+	for (i = 0, lines = 0; i < nchunks; i++) {
+		c = &chunks[i];
+		if (c->failed && !err) {
+			err = line_error(&c->err, lines + c->lines, c->line, c->len);
+		}
+		lines += c->lines;
+	}
+	if (!err) {
+		for (i = 0; i < nchunks; i++) {
+			c = &chunks[i];
+			merge_userids(es, c);
+			if (c->es.arr != &es->arr[es->len]) {
+				memmove(&es->arr[es->len], c->es.arr, c->es.len * sizeof(entry));
 			}
-			if (es->len == 0) {
-				return errorf(E_NO_INPUT, "%s", (fp == stdin ? "stdin" : "file"));
+			es->len += c->es.len;
+		}
+	}
+
+	for (i = 0; i < nchunks; i++) {
+		free_userids(chunks[i].es.us);
+	}
+
+	free(chunks);
+	return err;
+}
+
+error_t *parse_batch(input *in, entries *es, const unsigned long max)
+{
+	const char *line;
+	unsigned long n;
+	error_t *err;
+	size_t len;
+	entry e;
+
+	if (in->line == 0 && in->pos == 0) {
+		if ((err = fill_input(in, SNAP_MAGIC_LEN))) {
+			return err;
+		}
+		if (is_snapshot(in->buf, in->len)) {
+			return error(E_STREAM_SNAPSHOT);
+		}
+	}
+
+	for (n = 0; n < max; n++) {
+		if (n > 0 && !in->mapped && !in->eof &&
+			!memchr(in->buf + in->pos, '\n', in->len - in->pos)) {
+			break;
+		}
+		if ((err = next_line(in, &line, &len))) {
+			if (err->code == E_EOF && n > 0) {
+				break;
 			}
-			done = true;
-		} else {
-			append_entry(es, &e);
-			n++;
+			return err;
+		}
+		in->line++;
+		len = trim_tr(line, len);
+		if (is_comment(line, len)) {
+			continue;
 		}
-	} while (!done);
+		if ((err = parse_entry(line, len, es->us, &e))) {
+			return line_error(err, in->line, line, len);
+		}
+		append_entry(es, &e);
+	}
+
+	return NULL;
+}
+
+// Returns true if c is a delta operation.
+static bool is_delta_op(const char c)
+{
+	return c == '+' || c == '-' || c == '=' || c == '>';
+}
+
+error_t *parse_delta_line(const char *line, size_t len, userids *us, char *op,
+	entry *e)
+{
+	len = trim_tr(line, len);
+	if (len == 0 || !is_delta_op(line[0])) {
+		return error(E_INVALID_DELTA_OP);
+	}
+	*op = line[0];
+
+	return parse_entry(line + 1, len - 1, us, e);
+}
+
+error_t *parse_delta(input *in, entries *es, char **ops)
+{
+	unsigned long cap = 0;
+	const char *line;
+	error_t *err;
+	size_t len;
+	entry e;
+	char op;
+
+	*ops = NULL;
+	for (;;) {
+		if ((err = next_line(in, &line, &len))) {
+			if (err->code == E_EOF) {
+				return NULL;
+			}
+			return err;
+		}
+		in->line++;
+		if (is_comment(line, len)) {
+			continue;
+		}
+		if ((err = parse_delta_line(line, len, es->us, &op, &e))) {
+			return line_error(err, in->line, line, trim_tr(line, len));
+		}
+		if (es->len == cap) {
+			cap = (cap ? cap * 2 : INITCAP_ENTRIES);
+			*ops = realloc(*ops, cap);
+		}
+		(*ops)[es->len] = op;
+		append_entry(es, &e);
+	}
+}
+
+error_t *parse_input(input *in, const unsigned int threads, entries *es)
+{
+	unsigned long nchunks = 1;
+	const char *line = NULL;
+	size_t len = 0;
+	unsigned long n;
+	error_t *err;
+
+	if (in->mapped && threads > 1) {
+		nchunks = in->len / MIN_CHUNK;
+		if (nchunks > threads) {
+			nchunks = threads;
+		}
+	}
+
+	if ((err = fill_input(in, SNAP_MAGIC_LEN))) {
+		return err;
+	}
+
+	if (is_snapshot(in->buf + in->pos, in->len - in->pos)) {
+		if ((err = read_all(in))) {
+			return err;
+		}
+		if ((err = load_snapshot(in->buf + in->pos, in->len - in->pos, es))) {
+			return err;
+		}
+	} else if (nchunks > 1) {
+		if ((err = parse_chunks(in, nchunks, es))) {
+			return err;
+		}
+	} else {
+		if (in->mapped) {
+			reserve_entries(es, count_lines(in->buf + in->pos, in->len - in->pos));
+		}
+		if ((err = parse_lines(in, es, &n, &line, &len))) {
+			if (err->code == E_READ_INPUT_FAILED) {
+				return err;
+			}
+			return line_error(err, n, line, len);
+		}
+	}
+
+	if (es->len == 0) {
+		return errorf(E_NO_INPUT, "%s", (in->fd == STDIN_FILENO ? "stdin" : "file"));
+	}
 
 	return NULL;
 }
@@ -1,11 +1,48 @@
 #ifndef __PARSE_INPUT_H
 #define __PARSE_INPUT_H
 
-#include <stdio.h>
+#include <stdbool.h>
+#include <stddef.h>
 
 #include "entry.h"
+#include "error.h"
 
-// Parses all entries from input.
-error_t *parse_input(FILE *fp, entries *es);
+// Input, either a memory mapped regular file or a stream read in blocks.
+typedef struct {
+	int fd;
+	char *buf;
+	size_t len;
+	size_t pos;
+	size_t cap;
+	unsigned long line;
+	bool mapped;
+	bool eof;
+} input;
+
+// Opens input from a file, or from stdin if path is NULL or "-".
+error_t *open_input(const char *path, input *in);
+
+// Closes input.
+void close_input(input *in);
+
+// Parses all entries from input, in either text or binary snapshot format.
+// Mapped text input is split into chunks that are parsed by up to threads
+// threads.
+error_t *parse_input(input *in, const unsigned int threads, entries *es);
+
+// Parses one line of delta input, without its line terminator, setting *op to
+// its operation and *e to its entry, with its user ID interned in us.
+error_t *parse_delta_line(const char *line, size_t len, userids *us, char *op,
+	entry *e);
+
+// Parses all lines of delta input, each an operation ('+', '-', '=' or '>')
+// followed by an entry, appending the entries to es and their operations to
+// *ops, which is allocated with es->len elements and must be freed.
+error_t *parse_delta(input *in, entries *es, char **ops);
+
+// Parses up to max more entries from text input, returning E_EOF when there
+// are no more. Returns early with fewer entries rather than blocking on a
+// stream, so that entries can be processed as soon as they arrive.
+error_t *parse_batch(input *in, entries *es, const unsigned long max);
 
 #endif
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+
+#include "load.h"
+#include "log.h"
+
+// Weight of the latest rate in the EWMA is 1/2^LOAD_EWMA_SHIFT.
+#define LOAD_EWMA_SHIFT 2
+
+error_t *read_classid_loads(const bpf_handle *hnd, const config *cfg, uint64_t *loads)
+{
+	uint32_t n = u16_range_size(&cfg->user_flows);
+	classid_stats *ss = malloc(n * sizeof(classid_stats));
+	classid_load *ls = malloc(n * sizeof(classid_load));
+	uint64_t now = (uint64_t) (mono_time() * 1e9);
+	uint64_t delta, rate;
+	error_t *err = NULL;
+	classid_stats *s;
+	classid_load *l;
+	uint32_t i;
+
+	if ((err = bpf_read_stats(hnd, cfg->user_flows.lo, n, ss)) ||
+		(err = bpf_read_loads(hnd, cfg->user_flows.lo, n, ls))) {
+		goto out;
+	}
+
+	for (i = 0; i < n; i++) {
+		s = &ss[i];
+		l = &ls[i];
+		if (l->time != 0 && now > l->time) {
+			// counters restart from zero if the maps were recreated
+			delta = (s->bytes >= l->bytes ? s->bytes - l->bytes : s->bytes);
+			rate = (uint64_t) ((double) delta * 1e9 / (now - l->time));
+			if (l->ewma == 0) {
+				l->ewma = rate;
+			} else if (rate >= l->ewma) {
+				l->ewma += (rate - l->ewma) >> LOAD_EWMA_SHIFT;
+			} else {
+				l->ewma -= (l->ewma - rate) >> LOAD_EWMA_SHIFT;
+			}
+		}
+		l->bytes = s->bytes;
+		l->time = now;
+		loads[i] = l->ewma;
+
+		if (cfg->log >= LOG_VERBOSE && loads[i] > 0) {
+			logv(cfg, "Load: classid %u %lu bytes/s\n", cfg->user_flows.lo + i,
+				(unsigned long) loads[i]);
+		}
+	}
+
+	if (!cfg->noop) {
+		err = bpf_write_loads(hnd, cfg->user_flows.lo, n, ls);
+	}
+
+out:
+	free(ls);
+	free(ss);
+	return err;
+}
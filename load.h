@@ -0,0 +1,17 @@
+#ifndef __LOAD_H
+#define __LOAD_H
+
+#include <stdint.h>
+
+#include "bpf.h"
+#include "config.h"
+#include "error.h"
+
+// Reads the traffic counters of the classids in the user flows range and
+// updates the EWMA of their byte rates, setting loads (indexed by classid
+// minus user_flows.lo) to the EWMAs in bytes/s. The first run for a classid
+// only records its counters, so its load is zero, and the first measured rate
+// seeds the EWMA. The updated state is not written in no-op mode.
+error_t *read_classid_loads(const bpf_handle *hnd, const config *cfg, uint64_t *loads);
+
+#endif
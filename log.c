@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdarg.h>
+#include <time.h>
 
 #include "log.h"
 #include "config.h"
@@ -25,3 +26,45 @@ void logv(const config *cfg, const char *fmt, ...)
 		va_end(a);
 	}
 }
+
+void flogn(const config *cfg, FILE *fp, const char *fmt, ...)
+{
+	va_list a;
+
+	if (cfg->log != LOG_QUIET) {
+		va_start(a, fmt);
+		vfprintf(fp, fmt, a);
+		va_end(a);
+	}
+}
+
+void flogv(const config *cfg, FILE *fp, const char *fmt, ...)
+{
+	va_list a;
+
+	if (cfg->log == LOG_VERBOSE) {
+		va_start(a, fmt);
+		vfprintf(fp, fmt, a);
+		va_end(a);
+	}
+}
+
+void logw(const config *cfg, const char *fmt, ...)
+{
+	va_list a;
+
+	fflush(stdout);
+	fprintf(stderr, "Warning: ");
+	va_start(a, fmt);
+	vfprintf(stderr, fmt, a);
+	va_end(a);
+}
+
+double mono_time()
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
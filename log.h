@@ -1,6 +1,8 @@
 #ifndef __LOG_H
 #define __LOG_H
 
+#include <stdio.h>
+
 #include "config.h"
 
 // Logs a normal message.
@@ -9,4 +11,16 @@ void logn(const config *cfg, const char *fmt, ...);
 // Logs a verbose message.
 void logv(const config *cfg, const char *fmt, ...);
 
+// Logs a normal message to fp.
+void flogn(const config *cfg, FILE *fp, const char *fmt, ...);
+
+// Logs a verbose message to fp.
+void flogv(const config *cfg, FILE *fp, const char *fmt, ...);
+
+// Logs a warning to stderr, regardless of the log level.
+void logw(const config *cfg, const char *fmt, ...);
+
+// Returns the monotonic clock time in seconds.
+double mono_time();
+
 #endif
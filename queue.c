@@ -0,0 +1,96 @@
+#include <stdlib.h>
+
+#include "queue.h"
+
+queue *new_queue(const unsigned int cap)
+{
+	queue *q = malloc(sizeof(queue));
+	*q = (const queue){0};
+	q->cap = cap;
+	q->items = malloc(cap * sizeof(void *));
+	pthread_mutex_init(&q->mu, NULL);
+	pthread_cond_init(&q->nonempty, NULL);
+	pthread_cond_init(&q->nonfull, NULL);
+
+	return q;
+}
+
+bool queue_push(queue *q, void *item)
+{
+	bool pushed = false;
+
+	pthread_mutex_lock(&q->mu);
+	while (q->len == q->cap && !q->closed) {
+		pthread_cond_wait(&q->nonfull, &q->mu);
+	}
+	if (!q->closed) {
+		q->items[(q->head + q->len) % q->cap] = item;
+		q->len++;
+		pushed = true;
+		pthread_cond_signal(&q->nonempty);
+	}
+	pthread_mutex_unlock(&q->mu);
+
+	return pushed;
+}
+
+// Removes the head item (q->mu must be held and q->len > 0).
+static void *take(queue *q)
+{
+	void *item = q->items[q->head];
+
+	q->head = (q->head + 1) % q->cap;
+	q->len--;
+	pthread_cond_signal(&q->nonfull);
+
+	return item;
+}
+
+void *queue_pop(queue *q)
+{
+	void *item = NULL;
+
+	pthread_mutex_lock(&q->mu);
+	while (q->len == 0 && !q->closed) {
+		pthread_cond_wait(&q->nonempty, &q->mu);
+	}
+	if (q->len > 0) {
+		item = take(q);
+	}
+	pthread_mutex_unlock(&q->mu);
+
+	return item;
+}
+
+void *queue_trypop(queue *q)
+{
+	void *item = NULL;
+
+	pthread_mutex_lock(&q->mu);
+	if (q->len > 0) {
+		item = take(q);
+	}
+	pthread_mutex_unlock(&q->mu);
+
+	return item;
+}
+
+void queue_close(queue *q)
+{
+	pthread_mutex_lock(&q->mu);
+	q->closed = true;
+	pthread_cond_broadcast(&q->nonempty);
+	pthread_cond_broadcast(&q->nonfull);
+	pthread_mutex_unlock(&q->mu);
+}
+
+void free_queue(queue *q)
+{
+	if (q) {
+		pthread_cond_destroy(&q->nonfull);
+		pthread_cond_destroy(&q->nonempty);
+		pthread_mutex_destroy(&q->mu);
+		free(q->items);
+	}
+	free(q);
+}
@@ -0,0 +1,39 @@
+#ifndef __QUEUE_H
+#define __QUEUE_H
+
+#include <stdbool.h>
+#include <pthread.h>
+
+// Bounded, blocking FIFO queue of pointers, for passing work between threads.
+typedef struct {
+	void **items;
+	unsigned int cap;
+	unsigned int head;
+	unsigned int len;
+	bool closed;
+	pthread_mutex_t mu;
+	pthread_cond_t nonempty;
+	pthread_cond_t nonfull;
+} queue;
+
+// Creates a new queue holding at most cap items.
+queue *new_queue(const unsigned int cap);
+
+// Pushes an item, blocking while the queue is full. Returns false if the
+// queue was closed, in which case the item was not pushed.
+bool queue_push(queue *q, void *item);
+
+// Pops an item, blocking while the queue is empty. Returns NULL once the queue
+// is closed and empty.
+void *queue_pop(queue *q);
+
+// Pops an item if one is available without blocking, or returns NULL.
+void *queue_trypop(queue *q);
+
+// Closes the queue, waking up all waiting threads.
+void queue_close(queue *q);
+
+// Frees a queue (any remaining items are not freed).
+void free_queue(queue *q);
+
+#endif
@@ -0,0 +1,127 @@
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+
+#include "radix.h"
+
+// A slice of rows, counted and scattered by one thread in each pass.
+typedef struct {
+	const uint8_t *src;
+	uint8_t *dst;
+	size_t rlen;
+	int byte;
+	unsigned long start;
+	unsigned long end;
+	unsigned long counts[256];
+	unsigned long offs[256];
+	pthread_t thread;
+} radix_part;
+
+// Counts the values of the current byte in a part's rows.
+static void *count_part(void *arg)
+{
+	radix_part *p = arg;
+	const uint8_t *r = p->src + p->start * p->rlen + p->byte;
+	unsigned long i;
+
+	memset(p->counts, 0, sizeof(p->counts));
+	for (i = p->start; i < p->end; i++, r += p->rlen) {
+		p->counts[*r]++;
+	}
+
+	return NULL;
+}
+
+// Scatters a part's rows to their offsets in the destination.
+static void *scatter_part(void *arg)
+{
+	radix_part *p = arg;
+	const uint8_t *r = p->src + p->start * p->rlen;
+	unsigned long i;
+
+	for (i = p->start; i < p->end; i++, r += p->rlen) {
+		memcpy(p->dst + p->offs[r[p->byte]]++ * p->rlen, r, p->rlen);
+	}
+
+	return NULL;
+}
+
+// Runs fn on all parts, on threads for all but the first.
+static void run_parts(radix_part *parts, const unsigned int nparts,
+	void *(*fn)(void *))
+{
+	bool started[nparts];
+	unsigned int i;
+
+	for (i = 1; i < nparts; i++) {
+		started[i] = (pthread_create(&parts[i].thread, NULL, fn, &parts[i]) == 0);
+		if (!started[i]) {
+			fn(&parts[i]);
+		}
+	}
+	fn(&parts[0]);
+	for (i = 1; i < nparts; i++) {
+		if (started[i]) {
+			pthread_join(parts[i].thread, NULL);
+		}
+	}
+}
+
+uint8_t *radix_sort(uint8_t *rows, uint8_t *tmp, const size_t rlen, const int klen,
+	const unsigned long n, unsigned int threads)
+{
+	radix_part *parts;
+	unsigned long off;
+	unsigned int i;
+	uint8_t *swap;
+	int b, d;
+
+	if (threads > n / RADIX_MIN_PER_THREAD) {
+		threads = n / RADIX_MIN_PER_THREAD;
+	}
+	if (threads < 1) {
+		threads = 1;
+	}
+
+	parts = calloc(threads, sizeof(radix_part));
+	for (i = 0; i < threads; i++) {
+		parts[i].rlen = rlen;
+		parts[i].start = n / threads * i;
+		parts[i].end = (i == threads-1 ? n : n / threads * (i+1));
+	}
+
+	for (b = klen - 1; b >= 0; b--) {
+		for (i = 0; i < threads; i++) {
+			parts[i].src = rows;
+			parts[i].dst = tmp;
+			parts[i].byte = b;
+		}
+		run_parts(parts, threads, count_part);
+
+		// skip the pass if all rows have the same value for this byte
+		for (d = 0, off = 0; d < 256 && off == 0; d++) {
+			for (i = 0; i < threads; i++) {
+				off += parts[i].counts[d];
+			}
+		}
+		if (off == n) {
+			continue;
+		}
+
+		for (d = 0, off = 0; d < 256; d++) {
+			for (i = 0; i < threads; i++) {
+				parts[i].offs[d] = off;
+				off += parts[i].counts[d];
+			}
+		}
+		run_parts(parts, threads, scatter_part);
+
+		swap = rows;
+		rows = tmp;
+		tmp = swap;
+	}
+
+	free(parts);
+	return rows;
+}
@@ -0,0 +1,16 @@
+#ifndef __RADIX_H
+#define __RADIX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+// Minimum number of rows per thread for a multi-threaded radix sort.
+#define RADIX_MIN_PER_THREAD (1 << 16)
+
+// Sorts n rows of rlen bytes by their first klen bytes in lexicographic byte
+// order, using a stable LSD radix sort with up to threads threads. tmp must
+// have room for n rows. Returns whichever of rows or tmp holds the result.
+uint8_t *radix_sort(uint8_t *rows, uint8_t *tmp, const size_t rlen, const int klen,
+	const unsigned long n, unsigned int threads);
+
+#endif
@@ -0,0 +1,214 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+#include "addrtab.h"
+#include "snapshot.h"
+
+// Returns n rounded up to a multiple of 4.
+static size_t pad4(const size_t n)
+{
+	return (n + 3) & ~(size_t) 3;
+}
+
+// Returns the size of the keys and userid indexes for one address type.
+static size_t records_size(const addr_type t, const uint32_t count)
+{
+	return pad4((size_t) count * addr_len(t)) + (size_t) count * sizeof(uint32_t);
+}
+
+bool is_snapshot(const char *buf, const size_t len)
+{
+	return len >= SNAP_MAGIC_LEN && !memcmp(buf, SNAP_MAGIC, SNAP_MAGIC_LEN);
+}
+
+// Validates the header and string table, and returns the offset of the
+// first records section.
+static error_t *validate_header(const char *buf, const size_t len, size_t *off)
+{
+	const snap_header *h = (const snap_header *) buf;
+	const uint32_t *offs;
+	const char *strtab;
+	size_t need, l;
+	addr_type t;
+	uint32_t i;
+
+	if (len < sizeof(snap_header) || !is_snapshot(buf, len)) {
+		return errorf(E_INVALID_SNAPSHOT, "truncated header");
+	}
+	if (h->version != SNAP_VERSION) {
+		return errorf(E_INVALID_SNAPSHOT, "unsupported version %u", h->version);
+	}
+
+	need = sizeof(snap_header) + (size_t) h->nuserids * sizeof(uint32_t);
+	need += pad4(h->strtab_len);
+	*off = need;
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		need += records_size(t, h->counts[t]);
+	}
+	if (len != need) {
+		return errorf(E_INVALID_SNAPSHOT, "size %zu, expected %zu", len, need);
+	}
+
+	offs = (const uint32_t *) (buf + sizeof(snap_header));
+	strtab = (const char *) (offs + h->nuserids);
+	for (i = 0; i < h->nuserids; i++) {
+		if (offs[i] >= h->strtab_len) {
+			return errorf(E_INVALID_SNAPSHOT, "userid %u offset out of range", i);
+		}
+		l = strnlen(strtab + offs[i], h->strtab_len - offs[i]);
+		if (l == 0 || l > MAX_USERID_STRLEN || offs[i] + l == h->strtab_len) {
+			return errorf(E_INVALID_SNAPSHOT, "userid %u invalid", i);
+		}
+	}
+
+	return NULL;
+}
+
+error_t *load_snapshot(const char *buf, const size_t len, entries *es)
+{
+	const snap_header *h = (const snap_header *) buf;
+	const uint32_t *offs, *uids;
+	uint32_t *remap = NULL;
+	const uint8_t *keys;
+	const char *strtab;
+	error_t *err = NULL;
+	unsigned long n;
+	uint32_t i, c;
+	size_t off = 0;
+	bool added;
+	addr_type t;
+	int klen;
+	entry *e;
+
+	if ((err = validate_header(buf, len, &off))) {
+		return err;
+	}
+	offs = (const uint32_t *) (buf + sizeof(snap_header));
+	strtab = (const char *) (offs + h->nuserids);
+
+	remap = malloc(h->nuserids * sizeof(uint32_t));
+	for (i = 0; i < h->nuserids; i++) {
+		remap[i] = intern_userid(es->us, strtab + offs[i], strlen(strtab + offs[i]),
+			&added);
+	}
+
+	for (t = 0, n = 0; t < MAX_ADDR_TYPE; t++) {
+		n += h->counts[t];
+	}
+	reserve_entries(es, n);
+	es->sorted = (es->len == 0);
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		c = h->counts[t];
+		klen = addr_len(t);
+		keys = (const uint8_t *) (buf + off);
+		uids = (const uint32_t *) (buf + off + pad4((size_t) c * klen));
+		for (i = 0; i < c; i++) {
+			if (uids[i] >= h->nuserids) {
+				err = errorf(E_INVALID_SNAPSHOT, "userid index %u out of range", uids[i]);
+				goto out;
+			}
+			if (i > 0 && memcmp(&keys[(i-1) * klen], &keys[i * klen], klen) >= 0) {
+				err = errorf(E_INVALID_SNAPSHOT, "addresses not sorted and unique");
+				goto out;
+			}
+			e = &es->arr[es->len++];
+			*e = (const entry){{0}};
+			e->addr.type = t;
+			memcpy(&e->addr.val, &keys[i * klen], klen);
+			e->uid = remap[uids[i]];
+		}
+		off += records_size(t, c);
+	}
+
+out:
+	free(remap);
+	return err;
+}
+
+// Writes n bytes to fp, padded with zeros to a multiple of 4.
+static bool write_pad4(FILE *fp, const void *p, const size_t n)
+{
+	static const char zeros[4] = {0};
+
+	return fwrite(p, 1, n, fp) == n &&
+		fwrite(zeros, 1, pad4(n) - n, fp) == pad4(n) - n;
+}
+
+error_t *write_snapshot(const char *path, entries *es, const unsigned int threads)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	addr_table *tab = NULL;
+	uint32_t *offs = NULL;
+	char *strtab = NULL;
+	error_t *err = NULL;
+	addr_column *c;
+	bool tostdout;
+	unsigned long i;
+	FILE *fp = NULL;
+	addr_type t;
+	snap_header h;
+	size_t l;
+	addr a;
+
+	// the table's sorted columns are the records sections
+	tab = new_addr_table_from(es);
+	sort_addr_table(tab, threads);
+	h = (const snap_header){SNAP_MAGIC, SNAP_VERSION};
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		c = &tab->cols[t];
+		for (i = 1; i < c->len; i++) {
+			if (!memcmp(col_key(c, i), col_key(c, i-1), c->klen)) {
+				col_addr(c, t, i, &a);
+				err = errorf(E_DUPLICATE_ADDR, "%s", addr_str(&a, astr));
+				goto out;
+			}
+		}
+		h.counts[t] = c->len;
+	}
+
+	// userid indexes are the interned uids
+	h.nuserids = es->us->len;
+	offs = malloc(h.nuserids * sizeof(uint32_t));
+	strtab = malloc(h.nuserids * (MAX_USERID_STRLEN+1));
+	for (i = 0; i < h.nuserids; i++) {
+		l = strlen(userid_str(es->us, i)) + 1;
+		offs[i] = h.strtab_len;
+		memcpy(strtab + h.strtab_len, userid_str(es->us, i), l);
+		h.strtab_len += l;
+	}
+
+	tostdout = !strcmp(path, "-");
+	if ((fp = (tostdout ? stdout : fopen(path, "w"))) == NULL) {
+		err = errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", path, strerror(errno));
+		goto out;
+	}
+	if (fwrite(&h, sizeof(h), 1, fp) != 1 ||
+		fwrite(offs, sizeof(uint32_t), h.nuserids, fp) != h.nuserids ||
+		!write_pad4(fp, strtab, h.strtab_len)) {
+		goto fail;
+	}
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		c = &tab->cols[t];
+		if (!write_pad4(fp, c->keys, c->len * c->klen) ||
+			fwrite(c->uids, sizeof(uint32_t), c->len, fp) != c->len) {
+			goto fail;
+		}
+	}
+	if (fflush(fp) == 0) {
+		goto out;
+	}
+
+fail:
+	err = errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", path, strerror(errno));
+out:
+	if (fp && !tostdout && fclose(fp) && !err) {
+		err = errorf(E_WRITE_OUTPUT_FAILED, "'%s', %s", path, strerror(errno));
+	}
+	free(strtab);
+	free(offs);
+	free_addr_table(tab);
+	return err;
+}
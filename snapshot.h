@@ -0,0 +1,42 @@
+#ifndef __SNAPSHOT_H
+#define __SNAPSHOT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "addr.h"
+#include "entry.h"
+#include "error.h"
+
+#define SNAP_MAGIC "TCUSNAP"
+#define SNAP_MAGIC_LEN 8
+#define SNAP_VERSION 1
+
+// Binary snapshot of a user table. All integers are in host byte order, and
+// the header is followed by:
+//
+// - uint32_t userid offsets into the string table, one per userid
+// - the string table, with null terminated userids
+// - for each address type, padded to 4 bytes, the keys sorted by address
+//   (counts[type] * address length bytes), then the uint32_t userid index
+//   of each key
+typedef struct {
+	char magic[SNAP_MAGIC_LEN];
+	uint32_t version;
+	uint32_t nuserids;
+	uint32_t strtab_len;
+	uint32_t counts[MAX_ADDR_TYPE];
+} snap_header;
+
+// Returns true if buf starts with the snapshot magic.
+bool is_snapshot(const char *buf, const size_t len);
+
+// Validates a snapshot and loads its entries, which are sorted by address.
+error_t *load_snapshot(const char *buf, const size_t len, entries *es);
+
+// Writes entries to a snapshot file, or stdout if path is "-", sorting them
+// with up to threads threads.
+error_t *write_snapshot(const char *path, entries *es, const unsigned int threads);
+
+#endif
@@ -0,0 +1,275 @@
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <linux/bpf.h>
+
+#include "addrmap.h"
+#include "classify.h"
+#include "log.h"
+#include "queue.h"
+#include "stream.h"
+
+#define STREAM_BATCH 1024
+#define STREAM_QUEUE_LEN 8
+#define SEEN (1 << 16)
+
+// Pipeline state shared by the stages.
+typedef struct {
+	const bpf_handle *hnd;
+	const config *cfg;
+	input *in;
+	queue *parsed;
+	queue *classified;
+	unsigned long nents;
+	pthread_mutex_t mu;
+	error_t err;
+	bool failed;
+} pipeline;
+
+// Records the first error and closes both queues, stopping all stages.
+static void fail(pipeline *p, const error_t *err)
+{
+	pthread_mutex_lock(&p->mu);
+	if (!p->failed) {
+		p->err = *err;
+		p->failed = true;
+	}
+	pthread_mutex_unlock(&p->mu);
+	queue_close(p->parsed);
+	queue_close(p->classified);
+}
+
+// Frees all entries remaining in a queue.
+static void drain(queue *q)
+{
+	entries *es;
+
+	while ((es = queue_trypop(q))) {
+		free_entries(es);
+	}
+}
+
+// Parse stage main.
+static void *parse_stage(void *arg)
+{
+	pipeline *p = arg;
+	error_t *err;
+	entries *es;
+
+	for (;;) {
+		es = new_entries();
+		if ((err = parse_batch(p->in, es, STREAM_BATCH))) {
+			free_entries(es);
+			if (err->code != E_EOF) {
+				fail(p, err);
+			}
+			break;
+		}
+		p->nents += es->len;
+		if (!queue_push(p->parsed, es)) {
+			free_entries(es);
+			break;
+		}
+	}
+	queue_close(p->parsed);
+
+	return NULL;
+}
+
+// Classify stage main.
+static void *classify_stage(void *arg)
+{
+	pipeline *p = arg;
+	classifier *c = new_classifier(p->cfg);
+	unsigned long i;
+	entries *es;
+
+	while ((es = queue_pop(p->parsed))) {
+		for (i = 0; i < es->len; i++) {
+			classify_entry(c, es->us, &es->arr[i]);
+		}
+		if (!queue_push(p->classified, es)) {
+			free_entries(es);
+			break;
+		}
+	}
+	queue_close(p->classified);
+
+	free_classifier(c);
+	return NULL;
+}
+
+// Reads the current BPF map contents into an address map.
+static error_t *read_bpf_map(const bpf_handle *hnd, addr_map *m)
+{
+	addr_slot *s;
+	uint16_t classid;
+	error_t *err;
+	bool added;
+	bpf_it *it;
+	addr a;
+
+	it = bpf_new_it(hnd);
+	while ((err = bpf_next(it, &a, &classid)) == NULL && !it->done) {
+		s = addr_map_put(m, &a, &added);
+		s->val = classid;
+	}
+
+	free(it);
+	return err;
+}
+
+// Applies pending adds and updates.
+static error_t *flush(bpf_batch *upds, bpf_batch *adds)
+{
+	error_t *err;
+
+	if ((err = bpf_batch_apply(upds))) {
+		return err;
+	}
+	return bpf_batch_apply(adds);
+}
+
+// Returns the number of elements in a batch.
+static unsigned long batch_len(const bpf_batch *b)
+{
+	unsigned long n = 0;
+	addr_type t;
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		n += b->len[t];
+	}
+
+	return n;
+}
+
+// Sync stage, which diffs entries against the BPF map contents as they arrive,
+// then deletes whatever was not seen in the input.
+static error_t *sync_stage(pipeline *p, addr_map *m)
+{
+	const config *cfg = p->cfg;
+	char astr[MAX_ADDR_STRLEN+1];
+	bpf_batch *upds, *adds, *dels;
+	error_t *err = NULL;
+	unsigned long i;
+	entries *es;
+	bool added;
+	addr_slot *s;
+	entry *e;
+
+	upds = bpf_new_update_batch(p->hnd, BPF_EXIST);
+	adds = bpf_new_update_batch(p->hnd, BPF_NOEXIST);
+	dels = bpf_new_delete_batch(p->hnd);
+
+	for (;;) {
+		if ((es = queue_trypop(p->classified)) == NULL) {
+			// idle, so apply what we have before waiting for more
+			if ((err = flush(upds, adds))) {
+				goto out;
+			}
+			if ((es = queue_pop(p->classified)) == NULL) {
+				break;
+			}
+		}
+		for (i = 0; i < es->len; i++) {
+			e = &es->arr[i];
+			s = addr_map_put(m, &e->addr, &added);
+			if (!added && (s->val & SEEN)) {
+				err = errorf(E_DUPLICATE_ADDR, "%s", addr_str(&e->addr, astr));
+				free_entries(es);
+				goto out;
+			}
+			if (added) {
+				logn(cfg, "Sync: add %s %u\n", addr_str(&e->addr, astr), e->classid);
+				if (!cfg->noop) {
+					bpf_batch_add(adds, &e->addr, e->classid);
+				}
+			} else if (s->val != e->classid) {
+				logn(cfg, "Sync: update %s %u\n", addr_str(&e->addr, astr), e->classid);
+				if (!cfg->noop) {
+					bpf_batch_add(upds, &e->addr, e->classid);
+				}
+			} else {
+				logv(cfg, "Sync: leave %s %u\n", addr_str(&e->addr, astr), e->classid);
+			}
+			s->val = SEEN | e->classid;
+		}
+		free_entries(es);
+		if (batch_len(upds) + batch_len(adds) >= BPF_BATCH_LEN &&
+			(err = flush(upds, adds))) {
+			goto out;
+		}
+	}
+
+	pthread_mutex_lock(&p->mu);
+	if (p->failed) {
+		err = copy_error(&p->err);
+	} else if (p->nents == 0) {
+		err = errorf(E_NO_INPUT, "%s", (p->in->fd == STDIN_FILENO ? "stdin" : "file"));
+	}
+	pthread_mutex_unlock(&p->mu);
+	if (err) {
+		goto out;
+	}
+
+	for (i = 0; i < m->cap; i++) {
+		s = &m->slots[i];
+		if (s->used && !(s->val & SEEN)) {
+			logn(cfg, "Sync: delete %s %u\n", addr_str(&s->addr, astr), s->val);
+			if (!cfg->noop) {
+				bpf_batch_add(dels, &s->addr, 0);
+			}
+		}
+	}
+	err = bpf_batch_apply(dels);
+
+out:
+	bpf_free_batch(dels);
+	bpf_free_batch(adds);
+	bpf_free_batch(upds);
+	return err;
+}
+
+error_t *stream_bpf(const bpf_handle *hnd, const config *cfg, input *in,
+	unsigned long *nents)
+{
+	pthread_t pthr, cthr;
+	addr_map *m = NULL;
+	error_t *err;
+	pipeline p;
+
+	p = (const pipeline){0};
+	p.hnd = hnd;
+	p.cfg = cfg;
+	p.in = in;
+
+	m = new_addr_map(0);
+	if ((err = read_bpf_map(hnd, m))) {
+		free_addr_map(m);
+		return err;
+	}
+
+	p.parsed = new_queue(STREAM_QUEUE_LEN);
+	p.classified = new_queue(STREAM_QUEUE_LEN);
+	pthread_mutex_init(&p.mu, NULL);
+	pthread_create(&pthr, NULL, parse_stage, &p);
+	pthread_create(&cthr, NULL, classify_stage, &p);
+
+	if ((err = sync_stage(&p, m))) {
+		fail(&p, err);
+	}
+
+	pthread_join(pthr, NULL);
+	pthread_join(cthr, NULL);
+	drain(p.parsed);
+	drain(p.classified);
+	*nents = p.nents;
+
+	pthread_mutex_destroy(&p.mu);
+	free_queue(p.classified);
+	free_queue(p.parsed);
+	free_addr_map(m);
+	return (p.failed ? copy_error(&p.err) : NULL);
+}
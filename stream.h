@@ -0,0 +1,17 @@
+#ifndef __STREAM_H
+#define __STREAM_H
+
+#include "bpf.h"
+#include "config.h"
+#include "error.h"
+#include "input.h"
+
+// Parses, classifies and syncs input to the BPF maps in a pipeline of
+// concurrent stages connected by bounded queues, so that map updates start
+// before all input is read. Memory use is bounded by the size of the BPF maps
+// and the number of users, not the size of the input. *nents is set to the
+// number of entries read.
+error_t *stream_bpf(const bpf_handle *hnd, const config *cfg, input *in,
+	unsigned long *nents);
+
+#endif
@@ -2,89 +2,433 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <linux/bpf.h>
 
 #include "bpf.h"
 #include "addr.h"
+#include "addrtab.h"
+#include "cache.h"
 #include "sync.h"
 #include "limits.h"
 #include "log.h"
 
-static int cmp_ents_by_addr(const void *p1, const void *p2)
+// Work for one address type of a parallel read or sync.
+typedef struct {
+	const bpf_handle *hnd;
+	const config *cfg;
+	addr_type t;
+	addr_column *ic;
+	addr_column *bc;
+	bpf_batch *adds;
+	bpf_batch *upds;
+	bpf_batch *dels;
+	uint8_t *moved;
+	char *logbuf;
+	size_t loglen;
+	pthread_t thread;
+	bool started;
+	bool failed;
+	error_t err;
+} type_work;
+
+// Runs fn for each address type on its own thread, and returns the first error
+// by address type.
+static error_t *run_types(type_work *ws, void *(*fn)(void *))
+{
+	error_t *err = NULL;
+	addr_type t;
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		ws[t].started = (pthread_create(&ws[t].thread, NULL, fn, &ws[t]) == 0);
+		if (!ws[t].started) {
+			fn(&ws[t]);
+		}
+	}
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		if (ws[t].started) {
+			pthread_join(ws[t].thread, NULL);
+		}
+	}
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		if (ws[t].failed && !err) {
+			err = copy_error(&ws[t].err);
+		}
+	}
+
+	return err;
+}
+
+// Records an error for a type's work.
+static void fail_type(type_work *w, const error_t *err)
+{
+	w->failed = true;
+	w->err = *err;
+}
+
+// Reads and sorts the BPF map for one address type.
+static void *read_type(void *arg)
 {
-	return cmp_addr(&((entry *) p1)->addr, &((entry *) p2)->addr);
+	type_work *w = arg;
+	uint16_t classid;
+	error_t *err;
+	bpf_it *it;
+	addr a;
+
+	it = bpf_new_type_it(w->hnd, w->t);
+	while ((err = bpf_next(it, &a, &classid)) == NULL && !it->done) {
+		col_append(w->bc, (const uint8_t *) &a.val, &classid, 1);
+	}
+	free(it);
+
+	if (err) {
+		fail_type(w, err);
+	} else {
+		sort_col(w->bc, w->t, w->cfg->threads);
+	}
+
+	return NULL;
 }
 
-static error_t *read_bpf_entries(const bpf_handle *hnd, entries *es)
+error_t *read_bpf_table(const bpf_handle *hnd, const config *cfg, addr_table *t)
 {
+	type_work ws[MAX_ADDR_TYPE] = {{0}};
+	uint16_t classid;
 	error_t *err;
+	addr_type at;
 	bpf_it *it;
-	entry e;
+	addr a;
+
+	if (cfg->parallel_sync) {
+		for (at = 0; at < MAX_ADDR_TYPE; at++) {
+			ws[at] = (const type_work){hnd, cfg, at, NULL, &t->cols[at]};
+		}
+		err = run_types(ws, read_type);
+		t->sorted = (err == NULL);
+		return err;
+	}
 
-	e = (const entry){{0}};
 	it = bpf_new_it(hnd);
-	while ((err = bpf_next(it, &e.addr, &e.classid)) == NULL && !it->done) {
-		append_entry(es, &e);
+	while ((err = bpf_next(it, &a, &classid)) == NULL && !it->done) {
+		addr_table_add(t, &a, classid, 0);
 	}
 
 	free(it);
 	return err;
 }
 
-error_t *sync_bpf(const bpf_handle *hnd, const config *cfg, entries *ies)
+// Reads and sorts the BPF maps for a bpf_reader.
+static void *read_bpf(void *arg)
 {
-	entries *bes = new_entries();
-	char astr[MAX_ADDR_STRLEN+1];
-	ents_it *iit, *bit;
-	entry *be, *ie;
+	bpf_reader *r = arg;
+	double start = mono_time();
 	error_t *err;
-	int c;
 
-	if ((err = read_bpf_entries(hnd, bes))) {
-		return err;
+	if (!(r->cached = load_cache(r->hnd->generation, r->t))) {
+		if ((err = read_bpf_table(r->hnd, r->cfg, r->t))) {
+			r->failed = true;
+			r->err = *err;
+			return NULL;
+		}
 	}
-	sort_entries(bes, cmp_ents_by_addr);
+	sort_addr_table(r->t, r->cfg->threads);
+	r->secs = mono_time() - start;
 
-	sort_entries(ies, cmp_ents_by_addr);
+	return NULL;
+}
+
+void start_read_bpf(bpf_reader *r, const bpf_handle *hnd, const config *cfg,
+	addr_table *t)
+{
+	*r = (const bpf_reader){hnd, cfg, t};
+	r->started = (pthread_create(&r->thread, NULL, read_bpf, r) == 0);
+	if (!r->started) {
+		read_bpf(r);
+	}
+}
+
+void stop_read_bpf(bpf_reader *r)
+{
+	if (r->started) {
+		pthread_join(r->thread, NULL);
+		r->started = false;
+	}
+}
+
+error_t *join_read_bpf(bpf_reader *r)
+{
+	stop_read_bpf(r);
+	if (r->failed) {
+		return copy_error(&r->err);
+	}
+	logv(r->cfg, "Read %lu addresses from %s in %.3fs\n", addr_table_len(r->t),
+		(r->cached ? "cache" : "BPF maps"), r->secs);
 
-	iit = new_ents_it(ies);
-	bit = new_ents_it(bes);
-	ie = es_next(iit);
-	be = es_next(bit);
+	return NULL;
+}
+
+// Merge joins the input and BPF columns for one address type, adding the
+// differences to the batches, marking the uids of updated addresses in moved,
+// and logging to log.
+static error_t *sync_col(const config *cfg, const addr_type t, const addr_column *ic,
+	const addr_column *bc, bpf_batch *adds, bpf_batch *upds, bpf_batch *dels,
+	uint8_t *moved, FILE *log)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	int klen = ic->klen;
+	unsigned long i, j;
+	addr a;
+	int c;
 
-	while (ie || be) {
-		if ((c = cmp_ents_by_addr(ie, be)) == 0) {
-			if (ie->classid != be->classid) {
-				logn(cfg, "Sync: update %s %u\n", addr_str(&ie->addr, astr), ie->classid);
-				if (!cfg->noop &&
-					(err = bpf_update(hnd, &ie->addr, ie->classid, BPF_EXIST))) {
-					goto out;
+	for (i = 0, j = 0; i < ic->len || j < bc->len; ) {
+		if (i > 0 && i < ic->len && !memcmp(col_key(ic, i), col_key(ic, i-1), klen)) {
+			col_addr(ic, t, i, &a);
+			return errorf(E_DUPLICATE_ADDR, "%s", addr_str(&a, astr));
+		}
+		if (i == ic->len) {
+			c = 1;
+		} else if (j == bc->len) {
+			c = -1;
+		} else {
+			c = memcmp(col_key(ic, i), col_key(bc, j), klen);
+		}
+		if (c == 0) {
+			if (ic->classids[i] != bc->classids[j]) {
+				col_addr(ic, t, i, &a);
+				flogn(cfg, log, "Sync: update %s %u\n", addr_str(&a, astr),
+					ic->classids[i]);
+				moved[ic->uids[i]] = 1;
+				if (!cfg->noop) {
+					bpf_batch_add_key(upds, t, col_key(ic, i), ic->classids[i]);
 				}
-			} else {
-				logv(cfg, "Sync: leave %s %u\n", addr_str(&ie->addr, astr), ie->classid);
+			} else if (cfg->log >= LOG_VERBOSE) {
+				col_addr(ic, t, i, &a);
+				flogv(cfg, log, "Sync: leave %s %u\n", addr_str(&a, astr),
+					ic->classids[i]);
 			}
-			ie = es_next(iit);
-			be = es_next(bit);
+			i++;
+			j++;
 		} else if (c < 0) {
-			logn(cfg, "Sync: add %s %u\n", addr_str(&ie->addr, astr), ie->classid);
-			if (!cfg->noop &&
-				(err = bpf_update(hnd, &ie->addr, ie->classid, BPF_NOEXIST))) {
-				goto out;
+			col_addr(ic, t, i, &a);
+			flogn(cfg, log, "Sync: add %s %u\n", addr_str(&a, astr), ic->classids[i]);
+			if (!cfg->noop) {
+				bpf_batch_add_key(adds, t, col_key(ic, i), ic->classids[i]);
 			}
-			ie = es_next(iit);
+			i++;
 		} else {
-			logn(cfg, "Sync: delete %s %u\n", addr_str(&be->addr, astr), be->classid);
-			if (!cfg->noop && (err = bpf_delete(hnd, &be->addr))) {
-				goto out;
+			col_addr(bc, t, j, &a);
+			flogn(cfg, log, "Sync: delete %s %u\n", addr_str(&a, astr),
+				bc->classids[j]);
+			if (!cfg->noop) {
+				bpf_batch_add_key(dels, t, col_key(bc, j), 0);
 			}
-			be = es_next(bit);
+			j++;
+		}
+	}
+
+	return NULL;
+}
+
+error_t *replace_bpf(bpf_handle *hnd, const config *cfg, const entries *es,
+	bpf_config *bcfg)
+{
+	char astr[MAX_ADDR_STRLEN+1];
+	bpf_batch *b = NULL;
+	bpf_handle nh;
+	error_t *err;
+	entry *e;
+	unsigned long i;
+
+	if ((err = bpf_new_set(hnd, &nh))) {
+		goto out;
+	}
+
+	b = bpf_new_update_batch(&nh, BPF_NOEXIST);
+	for (i = 0; i < es->len; i++) {
+		e = &es->arr[i];
+		if (cfg->log >= LOG_VERBOSE) {
+			logv(cfg, "Replace: add %s %u\n", addr_str(&e->addr, astr), e->classid);
 		}
+		bpf_batch_add(b, &e->addr, e->classid);
+	}
+	if ((err = bpf_batch_apply(b))) {
+		goto out;
 	}
 
+	if ((err = bpf_activate_set(hnd, &nh, bcfg))) {
+		goto out;
+	}
+	logn(cfg, "Replace: loaded %lu addresses into map set %u\n", es->len,
+		hnd->active_set);
+
 out:
-	free(bit);
-	free(iit);
-	free_entries(bes);
+	bpf_free_batch(b);
+	bpf_close(&nh);
+	return err;
+}
+
+// Logs the number of users moved to a new classid.
+static void log_moved(const config *cfg, const uint8_t *moved, const uint32_t nusers)
+{
+	uint32_t nmoved = 0;
+	uint32_t u;
+
+	for (u = 0; u < nusers; u++) {
+		nmoved += moved[u];
+	}
+	logn(cfg, "Sync: %u of %u users moved to a new classid\n", nmoved, nusers);
+}
+
+// Merge joins the input and BPF columns for one address type, logging to a
+// buffer so the logs of all types can be written in order.
+static void *join_type(void *arg)
+{
+	type_work *w = arg;
+	error_t *err;
+	FILE *log;
+
+	sort_col(w->ic, w->t, w->cfg->threads);
+
+	if ((log = open_memstream(&w->logbuf, &w->loglen)) == NULL) {
+		log = stdout;
+	}
+	if ((err = sync_col(w->cfg, w->t, w->ic, w->bc, w->adds, w->upds, w->dels,
+		w->moved, log))) {
+		fail_type(w, err);
+	}
+	if (log != stdout) {
+		fclose(log);
+	}
+
+	return NULL;
+}
+
+// Applies the changes for one address type.
+static void *apply_type(void *arg)
+{
+	type_work *w = arg;
+	error_t *err;
+
+	if ((err = bpf_batch_apply(w->dels)) ||
+		(err = bpf_batch_apply(w->upds)) ||
+		(err = bpf_batch_apply(w->adds))) {
+		fail_type(w, err);
+	}
+
+	return NULL;
+}
+
+// Syncs each address type on its own thread. All types are merge joined before
+// any changes are applied, so an error in the input leaves the maps unchanged.
+static error_t *sync_types(const bpf_handle *hnd, const config *cfg, addr_table *it,
+	addr_table *bt, uint8_t *moved, const uint32_t nusers)
+{
+	type_work ws[MAX_ADDR_TYPE] = {{0}};
+	type_work *w;
+	error_t *err;
+	addr_type t;
+	uint32_t u;
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		w = &ws[t];
+		*w = (const type_work){hnd, cfg, t, &it->cols[t], &bt->cols[t]};
+		w->adds = bpf_new_update_batch(hnd, BPF_NOEXIST);
+		w->upds = bpf_new_update_batch(hnd, BPF_EXIST);
+		w->dels = bpf_new_delete_batch(hnd);
+		w->moved = calloc(nusers, 1);
+	}
+	if (!bt->sorted) {
+		sort_addr_table(bt, cfg->threads);
+	}
+
+	err = run_types(ws, join_type);
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		fwrite(ws[t].logbuf, 1, ws[t].loglen, stdout);
+		for (u = 0; u < nusers; u++) {
+			moved[u] |= ws[t].moved[u];
+		}
+	}
+	if (!err) {
+		log_moved(cfg, moved, nusers);
+		it->sorted = true;
+		err = run_types(ws, apply_type);
+	}
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		w = &ws[t];
+		free(w->logbuf);
+		free(w->moved);
+		bpf_free_batch(w->dels);
+		bpf_free_batch(w->upds);
+		bpf_free_batch(w->adds);
+	}
+	return err;
+}
+
+// Syncs all address types on the calling thread.
+static error_t *sync_serial(const bpf_handle *hnd, const config *cfg, addr_table *it,
+	addr_table *bt, uint8_t *moved, const uint32_t nusers)
+{
+	bpf_batch *adds, *upds, *dels;
+	error_t *err;
+	addr_type t;
+
+	sort_addr_table(bt, cfg->threads);
+	sort_addr_table(it, cfg->threads);
+
+	adds = bpf_new_update_batch(hnd, BPF_NOEXIST);
+	upds = bpf_new_update_batch(hnd, BPF_EXIST);
+	dels = bpf_new_delete_batch(hnd);
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		if ((err = sync_col(cfg, t, &it->cols[t], &bt->cols[t], adds, upds, dels,
+			moved, stdout))) {
+			goto out;
+		}
+	}
+	log_moved(cfg, moved, nusers);
+
+	if ((err = bpf_batch_apply(dels))) {
+		goto out;
+	}
+	if ((err = bpf_batch_apply(upds))) {
+		goto out;
+	}
+	err = bpf_batch_apply(adds);
+
+out:
+	bpf_free_batch(dels);
+	bpf_free_batch(upds);
+	bpf_free_batch(adds);
+	return err;
+}
+
+error_t *sync_bpf(const bpf_handle *hnd, const config *cfg, entries *ies,
+	addr_table *bt)
+{
+	uint32_t nusers = ies->us->len;
+	addr_table *it;
+	addr_table tmp;
+	uint8_t *moved;
+	error_t *err;
+
+	it = new_addr_table_from(ies);
+	moved = malloc(nusers);
+	memset(moved, 0, nusers);
+
+	if (cfg->parallel_sync) {
+		err = sync_types(hnd, cfg, it, bt, moved, nusers);
+	} else {
+		err = sync_serial(hnd, cfg, it, bt, moved, nusers);
+	}
+	free(moved);
+
+	if (!err && !cfg->noop) {
+		tmp = *bt;
+		*bt = *it;
+		*it = tmp;
+	}
+	free_addr_table(it);
 	return err;
 }
@@ -1,12 +1,59 @@
 #ifndef __SYNC_H
 #define __SYNC_H
 
+#include <pthread.h>
+#include <stdbool.h>
+
+#include "addrtab.h"
 #include "bpf.h"
 #include "config.h"
 #include "entry.h"
 #include "error.h"
 
-// Syncs eBPF map with entries.
-error_t *sync_bpf(const bpf_handle *hnd, const config *cfg, entries *ies);
+// Reads the contents of the BPF maps into an empty address table. With
+// cfg->parallel_sync, each map is read and sorted on its own thread.
+error_t *read_bpf_table(const bpf_handle *hnd, const config *cfg, addr_table *t);
+
+// Background read of the BPF maps, from the cache if it's valid.
+typedef struct {
+	const bpf_handle *hnd;
+	const config *cfg;
+	addr_table *t;
+	bool cached;
+	double secs;
+	pthread_t thread;
+	bool started;
+	bool failed;
+	error_t err;
+} bpf_reader;
+
+// Starts reading the BPF maps into the empty table t on a background thread,
+// from the cache if its generation matches or with read_bpf_table if not, then
+// sorting it. Only the table may be modified until the read is joined. The
+// read's map iterators keep their own batch fallback state, so the maps may
+// be read on other threads meanwhile.
+void start_read_bpf(bpf_reader *r, const bpf_handle *hnd, const config *cfg,
+	addr_table *t);
+
+// Waits for a read started with start_read_bpf, logs it and returns its error.
+error_t *join_read_bpf(bpf_reader *r);
+
+// Waits for a read started with start_read_bpf, if still running, discarding
+// its result (e.g. when another error has occurred).
+void stop_read_bpf(bpf_reader *r);
+
+// Syncs eBPF map with entries, given the BPF map contents read with
+// read_bpf_table or load_cache. On success, bt is replaced with the synced
+// contents, sorted, unless cfg->noop is set. With cfg->parallel_sync, each
+// address type is merge joined and then applied on its own thread, and the
+// logs are written in type order.
+error_t *sync_bpf(const bpf_handle *hnd, const config *cfg, entries *ies,
+	addr_table *bt);
+
+// Replaces the contents of the BPF address maps with the entries, by loading
+// them into a new map set and activating it with one update of the BPF config
+// (bcfg), so the datapath never sees a partial table.
+error_t *replace_bpf(bpf_handle *hnd, const config *cfg, const entries *es,
+	bpf_config *bcfg);
 
 #endif
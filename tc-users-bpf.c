@@ -11,13 +11,17 @@
 #include <iproute2/bpf_elf.h>
 
 #include "bpf_config.h"
+#include "bpf_stats.h"
 
 //#define TCU_DEBUG 1
 
 #define DEFAULT_CLASS 1
-#define MAX_ELEM 65536*4
+#define MAX_ELEM BPF_MAP_MAX_ELEM
 #define IP4_ALEN 4
 #define IP6_ALEN 16
+#define MAC_MAP_ID 1
+#define IP4_MAP_ID 2
+#define IP6_MAP_ID 3
 
 #define SEC(NAME) __attribute__((section(NAME), used))
 
@@ -49,35 +53,76 @@ struct hdrs {
 	struct iphdr *ip4;
 };
 
+// Address maps of the active set, looked up once per packet for the headers
+// it has (NULL otherwise).
+struct amaps {
+	void *mac;
+	void *ip4;
+	void *ip6;
+};
+
 static void *BPF_FUNC(map_lookup_elem, void *map, const void *key);
 
 struct bpf_elf_map tc_users_mac SEC(ELF_SECTION_MAPS) = {
     .type           = BPF_MAP_TYPE_HASH,
     .size_key       = ETH_ALEN,
     .size_value     = sizeof(uint16_t),
+    .id             = MAC_MAP_ID,
+    .inner_idx      = 0,
     .pinning        = PIN_GLOBAL_NS,
     .max_elem       = MAX_ELEM,
     .flags          = BPF_F_NO_PREALLOC,
 };
 
+struct bpf_elf_map tc_users_mac_sets SEC(ELF_SECTION_MAPS) = {
+    .type           = BPF_MAP_TYPE_ARRAY_OF_MAPS,
+    .size_key       = sizeof(uint32_t),
+    .size_value     = sizeof(uint32_t),
+    .inner_id       = MAC_MAP_ID,
+    .pinning        = PIN_GLOBAL_NS,
+    .max_elem       = BPF_MAP_SETS,
+};
+
 struct bpf_elf_map tc_users_ip4 SEC(ELF_SECTION_MAPS) = {
     .type           = BPF_MAP_TYPE_HASH,
     .size_key       = IP4_ALEN,
     .size_value     = sizeof(uint16_t),
+    .id             = IP4_MAP_ID,
+    .inner_idx      = 0,
     .pinning        = PIN_GLOBAL_NS,
     .max_elem       = MAX_ELEM,
     .flags          = BPF_F_NO_PREALLOC,
 };
 
+struct bpf_elf_map tc_users_ip4_sets SEC(ELF_SECTION_MAPS) = {
+    .type           = BPF_MAP_TYPE_ARRAY_OF_MAPS,
+    .size_key       = sizeof(uint32_t),
+    .size_value     = sizeof(uint32_t),
+    .inner_id       = IP4_MAP_ID,
+    .pinning        = PIN_GLOBAL_NS,
+    .max_elem       = BPF_MAP_SETS,
+};
+
 struct bpf_elf_map tc_users_ip6 SEC(ELF_SECTION_MAPS) = {
     .type           = BPF_MAP_TYPE_HASH,
     .size_key       = IP6_ALEN,
     .size_value     = sizeof(uint16_t),
+    .id             = IP6_MAP_ID,
+    .inner_idx      = 0,
     .pinning        = PIN_GLOBAL_NS,
     .max_elem       = MAX_ELEM,
     .flags          = BPF_F_NO_PREALLOC,
 };
 
+struct bpf_elf_map tc_users_ip6_sets SEC(ELF_SECTION_MAPS) = {
+    .type           = BPF_MAP_TYPE_ARRAY_OF_MAPS,
+    .size_key       = sizeof(uint32_t),
+    .size_value     = sizeof(uint32_t),
+    .inner_id       = IP6_MAP_ID,
+    .pinning        = PIN_GLOBAL_NS,
+    .max_elem       = BPF_MAP_SETS,
+};
+
 struct bpf_elf_map tc_users_config SEC(ELF_SECTION_MAPS) = {
     .type           = BPF_MAP_TYPE_HASH,
     .size_key       = sizeof(uint8_t),
@@ -86,11 +131,32 @@ struct bpf_elf_map tc_users_config SEC(ELF_SECTION_MAPS) = {
     .max_elem       = 1,
 };
 
+struct bpf_elf_map tc_users_stats SEC(ELF_SECTION_MAPS) = {
+    .type           = BPF_MAP_TYPE_ARRAY,
+    .size_key       = sizeof(uint32_t),
+    .size_value     = sizeof(classid_stats),
+    .pinning        = PIN_GLOBAL_NS,
+    .max_elem       = BPF_STATS_LEN,
+};
+
+struct bpf_elf_map tc_users_load SEC(ELF_SECTION_MAPS) = {
+    .type           = BPF_MAP_TYPE_ARRAY,
+    .size_key       = sizeof(uint32_t),
+    .size_value     = sizeof(classid_load),
+    .pinning        = PIN_GLOBAL_NS,
+    .max_elem       = BPF_STATS_LEN,
+};
+
 __attribute__((always_inline))
-inline uint16_t classify_mac(const unsigned char mac[ETH_ALEN], enum cstat *cstat) {
+inline uint16_t classify_mac(void *map, const unsigned char mac[ETH_ALEN],
+	enum cstat *cstat)
+{
 	uint16_t *match;
 
-	if ((match = map_lookup_elem(&tc_users_mac, mac)) == NULL) {
+	if (map == NULL) {
+		return 0;
+	}
+	if ((match = map_lookup_elem(map, mac)) == NULL) {
 		return 0;
 	}
 
@@ -99,10 +165,15 @@ inline uint16_t classify_mac(const unsigned char mac[ETH_ALEN], enum cstat *csta
 }
 
 __attribute__((always_inline))
-inline uint16_t classify_ip4(const void *ip4addr, enum cstat *cstat) {
+inline uint16_t classify_ip4(void *map, const void *ip4addr,
+	enum cstat *cstat)
+{
 	uint16_t *match;
 
-	if ((match = map_lookup_elem(&tc_users_ip4, ip4addr)) == NULL) {
+	if (map == NULL) {
+		return 0;
+	}
+	if ((match = map_lookup_elem(map, ip4addr)) == NULL) {
 		return 0;
 	}
 
@@ -111,10 +182,15 @@ inline uint16_t classify_ip4(const void *ip4addr, enum cstat *cstat) {
 }
 
 __attribute__((always_inline))
-inline uint16_t classify_ip6(const void *ip6addr, enum cstat *cstat) {
+inline uint16_t classify_ip6(void *map, const void *ip6addr,
+	enum cstat *cstat)
+{
 	uint16_t *match;
 
-	if ((match = map_lookup_elem(&tc_users_ip6, ip6addr)) == NULL) {
+	if (map == NULL) {
+		return 0;
+	}
+	if ((match = map_lookup_elem(map, ip6addr)) == NULL) {
 		return 0;
 	}
 
@@ -123,8 +199,8 @@ inline uint16_t classify_ip6(const void *ip6addr, enum cstat *cstat) {
 }
 
 __attribute__((always_inline))
-inline uint16_t classify_by_addr(const classify_addr caddr, const struct hdrs *h,
-	enum cstat *cstat)
+inline uint16_t classify_by_addr(const struct amaps *m, const classify_addr caddr,
+	const struct hdrs *h, enum cstat *cstat)
 {
 	uint8_t ip4addr[IP4_ALEN];
 	uint8_t ip6addr[IP6_ALEN];
@@ -137,30 +213,30 @@ inline uint16_t classify_by_addr(const classify_addr caddr, const struct hdrs *h
 		break;
 	case SRC_MAC:
 		if (h->eth) {
-			classid = classify_mac(h->eth->h_source, cstat);
+			classid = classify_mac(m->mac, h->eth->h_source, cstat);
 		}
 		break;
 	case DST_MAC:
 		if (h->eth) {
-			classid = classify_mac(h->eth->h_dest, cstat);
+			classid = classify_mac(m->mac, h->eth->h_dest, cstat);
 		}
 		break;
 	case SRC_IP:
 		if (h->ip4) {
 			__builtin_memcpy(ip4addr, &h->ip4->saddr, IP4_ALEN);
-			classid = classify_ip4(ip4addr, cstat);
+			classid = classify_ip4(m->ip4, ip4addr, cstat);
 		} else if (h->ip6) {
 			__builtin_memcpy(ip6addr, &h->ip6->saddr, IP6_ALEN);
-			classid = classify_ip6(ip6addr, cstat);
+			classid = classify_ip6(m->ip6, ip6addr, cstat);
 		}
 		break;
 	case DST_IP:
 		if (h->ip4) {
 			__builtin_memcpy(ip4addr, &h->ip4->daddr, IP4_ALEN);
-			classid = classify_ip4(ip4addr, cstat);
+			classid = classify_ip4(m->ip4, ip4addr, cstat);
 		} else if (h->ip6) {
 			__builtin_memcpy(ip6addr, &h->ip6->daddr, IP6_ALEN);
-			classid = classify_ip6(ip6addr, cstat);
+			classid = classify_ip6(m->ip6, ip6addr, cstat);
 		}
 		break;
 	default:
@@ -172,24 +248,36 @@ inline uint16_t classify_by_addr(const classify_addr caddr, const struct hdrs *h
 }
 
 __attribute__((always_inline))
-inline uint16_t classify(const classify_by clby, const struct hdrs *h,
-	enum cstat *cstat)
+inline uint16_t classify(const struct amaps *m, const classify_by clby,
+	const struct hdrs *h, enum cstat *cstat)
 {
 	uint16_t classid;
 
-	classid = classify_by_addr(clby[0], h, cstat);
+	classid = classify_by_addr(m, clby[0], h, cstat);
 	if (*cstat) {
 		return classid;
 	}
-	classid = classify_by_addr(clby[1], h, cstat);
+	classid = classify_by_addr(m, clby[1], h, cstat);
 	if (*cstat) {
 		return classid;
 	}
-	classid = classify_by_addr(clby[2], h, cstat);
+	classid = classify_by_addr(m, clby[2], h, cstat);
 	if (*cstat) {
 		return classid;
 	}
-	return classify_by_addr(clby[3], h, cstat);
+	return classify_by_addr(m, clby[3], h, cstat);
+}
+
+__attribute__((always_inline))
+inline void count_traffic(const struct __sk_buff *skb, const uint16_t classid)
+{
+	uint32_t key = classid;
+	classid_stats *s;
+
+	if ((s = map_lookup_elem(&tc_users_stats, &key)) != NULL) {
+		__sync_fetch_and_add(&s->bytes, skb->len);
+		__sync_fetch_and_add(&s->packets, 1);
+	}
 }
 
 __attribute__((always_inline))
@@ -228,10 +316,12 @@ SEC(ELF_SECTION_ACTION)
 int act_main(struct __sk_buff *skb)
 {
 	struct hdrs h = (const struct hdrs){0};
+	struct amaps m = (const struct amaps){0};
 	uint8_t ck = BPF_CONFIG_KEY;
 	enum cstat cstat = NOMATCH;
 	uint16_t classid;
 	bpf_config *cfg;
+	uint32_t set;
 
 #ifdef TCU_DEBUG
 	//printk("act_main\n");
@@ -243,12 +333,25 @@ int act_main(struct __sk_buff *skb)
 
 	find_headers(skb, &h);
 
-	classid = classify(cfg->classify_by, &h, &cstat);
+	set = cfg->active_set;
+	if (h.eth) {
+		m.mac = map_lookup_elem(&tc_users_mac_sets, &set);
+	}
+	if (h.ip4) {
+		m.ip4 = map_lookup_elem(&tc_users_ip4_sets, &set);
+	} else if (h.ip6) {
+		m.ip6 = map_lookup_elem(&tc_users_ip6_sets, &set);
+	}
+
+	classid = classify(&m, cfg->classify_by, &h, &cstat);
 
 out:
 
 	if (cstat == MATCH) {
 		skb->tc_classid = TC_H_MAKE(TC_H_MAJ(classid<<16), 0);
+		if (cfg->count_traffic) {
+			count_traffic(skb, classid);
+		}
 #ifdef TCU_DEBUG
 		printk("tc_classid: %u\n", skb->tc_classid);
 #endif
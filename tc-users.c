@@ -4,14 +4,25 @@
 #include <string.h>
 #include <getopt.h>
 #include <errno.h>
+#include <signal.h>
 
 #include "config.h"
 #include "bpf_config.h"
+#include "load.h"
 #include "bpf.h"
+#include "bpflib.h"
+#include "cache.h"
+#include "check.h"
 #include "log.h"
 #include "input.h"
 #include "classify.h"
+#include "control.h"
+#include "delta.h"
+#include "dump.h"
 #include "sync.h"
+#include "snapshot.h"
+#include "stream.h"
+#include "watch.h"
 #include "error.h"
 #include "version.h"
 
@@ -19,6 +30,21 @@
 #define O_UNCL_FLOWS "unclassified-flows"
 #define O_FLOWS_PER_USER "flows-per-user"
 #define O_CLASSIFY_BY "classify-by"
+#define O_ASSIGN "assign"
+#define O_MAX_LOAD "max-load"
+#define O_MAX_MOVES "max-moves"
+#define O_THREADS "threads"
+#define O_COMPILE "compile"
+#define O_DUMP "dump"
+#define O_STREAM "stream"
+#define O_REPLACE "replace"
+#define O_DELTA "delta"
+#define O_TRACK_USERS "track-users"
+#define O_PARALLEL_SYNC "parallel-sync"
+#define O_DAEMON "daemon"
+#define O_DEBOUNCE "debounce"
+#define O_MIN_INTERVAL "min-interval"
+#define O_CONTROL "control"
 #define O_NOOP "no-op"
 #define O_QUIET "quiet"
 #define O_VERBOSE "verbose"
@@ -32,6 +58,7 @@ static void print_help(FILE *fp, char *cmd)
 	classify_by dcb = D_CLASSIFY_BY;
 
 	fprintf(fp, "Usage: %s [options] file\n", cmd);
+	fprintf(fp, "       %s --%s OUTPUT\n", cmd, O_DUMP);
 	fprintf(fp, "\n");
 	fprintf(fp, "file must conform to Input Format below, may be '-' for stdin\n");
 	fprintf(fp, "\n");
@@ -56,6 +83,79 @@ static void print_help(FILE *fp, char *cmd)
 	fprintf(fp, "	dstip: destination IP address\n");
 	fprintf(fp, "	srcmac: source MAC address\n");
 	fprintf(fp, "	dstmac: destination MAC address\n");
+	fprintf(fp, "--%s MODE (default %s)\n", O_ASSIGN, assign_mode_str(D_ASSIGN));
+	fprintf(fp, "	how to assign classids to indirectly classified users:\n");
+	fprintf(fp, "	balanced: spread all users evenly over --%s\n", O_USER_FLOWS);
+	fprintf(fp, "	sticky: users found in the BPF maps keep their classids, and only\n");
+	fprintf(fp, "	new users are assigned the least used classids (not with -s)\n");
+	fprintf(fp, "	hash: classids are a consistent hash of the userid, so hosts with\n");
+	fprintf(fp, "	the same input agree without sharing state, and adding or removing\n");
+	fprintf(fp, "	users moves no other users (unless --%s is used)\n", O_MAX_LOAD);
+	fprintf(fp, "	traffic: like sticky, but users are moved off the classids with\n");
+	fprintf(fp, "	the most traffic, and new users assigned to those with the least,\n");
+	fprintf(fp, "	by an EWMA of the byte rate counted by the BPF program since the\n");
+	fprintf(fp, "	last run (not with -s)\n");
+	fprintf(fp, "--%s PCT (default %d, unbounded)\n", O_MAX_LOAD, D_MAX_LOAD);
+	fprintf(fp, "	with --%s hash, limits users per classid to PCT percent of the\n", O_ASSIGN);
+	fprintf(fp, "	average (>= 100), moving users from full classids by rehashing\n");
+	fprintf(fp, "	in userid order (not with -s)\n");
+	fprintf(fp, "--%s N (default %d)\n", O_MAX_MOVES, D_MAX_MOVES);
+	fprintf(fp, "	with --%s traffic, maximum number of users to move per run\n", O_ASSIGN);
+	fprintf(fp, "--%s N (default %d)\n", O_THREADS, D_THREADS);
+	fprintf(fp, "	number of threads to parse input files with\n");
+	fprintf(fp, "	stdin is always parsed by a single thread\n");
+	fprintf(fp, "-c|--%s OUTPUT\n", O_COMPILE);
+	fprintf(fp, "	compile input to a binary snapshot file (may be '-' for stdout)\n");
+	fprintf(fp, "	and exit, snapshots are accepted as input in place of text\n");
+	fprintf(fp, "--%s OUTPUT\n", O_DUMP);
+	fprintf(fp, "	write the contents of the BPF maps in the input format to OUTPUT\n");
+	fprintf(fp, "	(may be '-' for stdout) and exit, with the BPF config as comments.\n");
+	fprintf(fp, "	The user ID of each address is its classid, so the output\n");
+	fprintf(fp, "	classifies the same as the maps with the same --%s.\n",
+		O_USER_FLOWS);
+	fprintf(fp, "-s|--%s\n", O_STREAM);
+	fprintf(fp, "	parse, classify and sync input concurrently, so BPF map updates\n");
+	fprintf(fp, "	start before all input is read, using memory bounded by the map\n");
+	fprintf(fp, "	size and number of users rather than the input size. Indirect\n");
+	fprintf(fp, "	classids are assigned by first appearance, so may differ from the\n");
+	fprintf(fp, "	default mode. Text input only. If the input has an error, changes\n");
+	fprintf(fp, "	already made are kept, but no addresses are deleted.\n");
+	fprintf(fp, "-r|--%s\n", O_REPLACE);
+	fprintf(fp, "	replace the BPF maps instead of syncing changes to them, by loading\n");
+	fprintf(fp, "	a new set of maps and switching the datapath to it in one update,\n");
+	fprintf(fp, "	so it never sees a partly updated table. Uses memory for two sets\n");
+	fprintf(fp, "	of maps while loading. Not with -s.\n");
+	fprintf(fp, "-d|--%s\n", O_DELTA);
+	fprintf(fp, "	apply delta input (see Delta Format below) to the BPF maps with\n");
+	fprintf(fp, "	one map operation per line, instead of syncing the whole table.\n");
+	fprintf(fp, "	Requires user state saved by a previous run with --%s.\n",
+		O_TRACK_USERS);
+	fprintf(fp, "	Text input and --%s balanced only.\n", O_ASSIGN);
+	fprintf(fp, "--%s\n", O_TRACK_USERS);
+	fprintf(fp, "	save the classid and address count of each user, the user of each\n");
+	fprintf(fp, "	address, and the number of users per classid, for later runs with\n");
+	fprintf(fp, "	-d. Runs without this option remove any saved state. Not with -s.\n");
+	fprintf(fp, "--%s\n", O_PARALLEL_SYNC);
+	fprintf(fp, "	read, compare and update the MAC, IPv4 and IPv6 maps each on its\n");
+	fprintf(fp, "	own thread. Not with -s or -d.\n");
+	fprintf(fp, "--%s\n", O_DAEMON);
+	fprintf(fp, "	after syncing, keep running and sync again each time the input\n");
+	fprintf(fp, "	file is written, comparing it with the synced contents kept in\n");
+	fprintf(fp, "	memory instead of reading the BPF maps. Write the input to another\n");
+	fprintf(fp, "	file and rename it over the input, so it's never read partly\n");
+	fprintf(fp, "	written. Stops on SIGINT or SIGTERM. Not with -c, -s, -d or stdin.\n");
+	fprintf(fp, "--%s MS (default %d)\n", O_DEBOUNCE, D_DEBOUNCE);
+	fprintf(fp, "	with --%s, milliseconds without writes to the input to wait\n",
+		O_DAEMON);
+	fprintf(fp, "	for before syncing\n");
+	fprintf(fp, "--%s SECS (default %d)\n", O_MIN_INTERVAL, D_MIN_INTERVAL);
+	fprintf(fp, "	with --%s, minimum seconds between the starts of syncs\n", O_DAEMON);
+	fprintf(fp, "--%s PATH\n", O_CONTROL);
+	fprintf(fp, "	with --%s, listen on a Unix socket at PATH for commands that\n",
+		O_DAEMON);
+	fprintf(fp, "	change single addresses immediately (see Control Commands below).\n");
+	fprintf(fp, "	The next sync of the input undoes any changes not also made to it.\n");
+	fprintf(fp, "	Requires --%s, and --%s balanced.\n", O_TRACK_USERS, O_ASSIGN);
 	fprintf(fp, "-n|--%s\n", O_NOOP);
 	fprintf(fp, "	read input and classify, but don't sync changes to BPF map\n");
 	fprintf(fp, "	allows previewing changes before actually making them\n");
@@ -68,6 +168,15 @@ static void print_help(FILE *fp, char *cmd)
 	fprintf(fp, "-h|--%s\n", O_HELP);
 	fprintf(fp, "	shows help\n");
 	fprintf(fp, "\n");
+	fprintf(fp, "Environment:\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "%s=DIR\n", BPF_MOCK_ENV);
+	fprintf(fp, "	use in-memory mock BPF maps, kept in files in DIR between runs,\n");
+	fprintf(fp, "	for testing and benchmarking without privileges or pinned maps\n");
+	fprintf(fp, "%s=N (default %d)\n", BPF_MOCK_MAX_ELEM_ENV, BPF_MAP_MAX_ELEM);
+	fprintf(fp, "	with %s, maximum entries of each mock address map\n",
+		BPF_MOCK_ENV);
+	fprintf(fp, "\n");
 	fprintf(fp, "Input Format:\n");
 	fprintf(fp, "\n");
 	fprintf(fp, "The input must contain two fields per line, and the delimiter may\n");
@@ -78,6 +187,31 @@ static void print_help(FILE *fp, char *cmd)
 		O_USER_FLOWS);
 	fprintf(fp, "2) An IPv4/6 address or MAC address.\n");
 	fprintf(fp, "\n");
+	fprintf(fp, "Lines starting with # are comments.\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "A binary snapshot written by --%s is also accepted.\n", O_COMPILE);
+	fprintf(fp, "\n");
+	fprintf(fp, "Delta Format:\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "Each line is an input line prefixed by an operation:\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "+ adds the address, which must not be in the BPF maps\n");
+	fprintf(fp, "- removes the address, which must belong to the user\n");
+	fprintf(fp, "= adds the address, or moves it from the user it belongs to\n");
+	fprintf(fp, "> moves the address, which must be in the BPF maps, to the user\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "Users keep their classid while they have addresses, and new users\n");
+	fprintf(fp, "are assigned the least used classid. Example: +Wilma,2001:db8::44\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "Control Commands:\n");
+	fprintf(fp, "\n");
+	fprintf(fp, "Each command is a line of delta input, which is applied as with -d,\n");
+	fprintf(fp, "or '?' followed by an address to look up. Each gets a reply line, in\n");
+	fprintf(fp, "order, after its map writes: 'OK', with the classid except for '-',\n");
+	fprintf(fp, "or 'ERR' and a message. Commands may be sent without waiting for\n");
+	fprintf(fp, "replies. Example: =Wilma,2001:db8::44 -> OK 17, then moving the\n");
+	fprintf(fp, "address to another user: >Fred,2001:db8::44 -> OK 3\n");
+	fprintf(fp, "\n");
 	fprintf(fp, "Example Input:\n");
 	fprintf(fp, "\n");
 	fprintf(fp, "10 12:34:56:ab:cd:ef\n");
@@ -113,6 +247,21 @@ static error_t *parse_cmdline(int argc, char **argv, config *cfg)
 		{O_UNCL_FLOWS,             required_argument, 0,  0  },
 		{O_FLOWS_PER_USER,         required_argument, 0,  0  },
 		{O_CLASSIFY_BY,            required_argument, 0,  0  },
+		{O_ASSIGN,                 required_argument, 0,  0  },
+		{O_MAX_LOAD,               required_argument, 0,  0  },
+		{O_MAX_MOVES,              required_argument, 0,  0  },
+		{O_THREADS,                required_argument, 0,  0  },
+		{O_COMPILE,                required_argument, 0, 'c' },
+		{O_DUMP,                   required_argument, 0,  0  },
+		{O_STREAM,                 no_argument,       0, 's' },
+		{O_REPLACE,                no_argument,       0, 'r' },
+		{O_DELTA,                  no_argument,       0, 'd' },
+		{O_TRACK_USERS,            no_argument,       0,  0  },
+		{O_PARALLEL_SYNC,          no_argument,       0,  0  },
+		{O_DAEMON,                 no_argument,       0,  0  },
+		{O_DEBOUNCE,               required_argument, 0,  0  },
+		{O_MIN_INTERVAL,           required_argument, 0,  0  },
+		{O_CONTROL,                required_argument, 0,  0  },
 		{O_NOOP,                   no_argument,       0, 'n' },
 		{O_QUIET,                  no_argument,       0, 'q' },
 		{O_VERBOSE,                no_argument,       0, 'v' },
@@ -121,7 +270,7 @@ static error_t *parse_cmdline(int argc, char **argv, config *cfg)
 		{0,                        0,                 0,  0  },
 	};
 
-	while ((c = getopt_long(argc, argv, "nqvVh", long_opts, &oidx)) != -1) {
+	while ((c = getopt_long(argc, argv, "c:srdnqvVh", long_opts, &oidx)) != -1) {
 		switch (c) {
 		case 0:
 			lopt = long_opts[oidx].name;
@@ -141,12 +290,60 @@ static error_t *parse_cmdline(int argc, char **argv, config *cfg)
 				if ((err = parse_classify_by(optarg, cfg->classify_by))) {
 					return err;
 				}
+			} else if (!strcmp(lopt, O_ASSIGN)) {
+				if ((err = parse_assign_mode(optarg, &cfg->assign))) {
+					return err;
+				}
+			} else if (!strcmp(lopt, O_MAX_LOAD)) {
+				if ((err = parse_u16(optarg, &cfg->max_load))) {
+					return err;
+				}
+			} else if (!strcmp(lopt, O_MAX_MOVES)) {
+				if ((err = parse_u16(optarg, &cfg->max_moves))) {
+					return err;
+				}
+			} else if (!strcmp(lopt, O_THREADS)) {
+				if ((err = parse_u16(optarg, &cfg->threads))) {
+					return err;
+				}
+			} else if (!strcmp(lopt, O_TRACK_USERS)) {
+				cfg->track_users = true;
+			} else if (!strcmp(lopt, O_PARALLEL_SYNC)) {
+				cfg->parallel_sync = true;
+			} else if (!strcmp(lopt, O_DAEMON)) {
+				cfg->daemon = true;
+			} else if (!strcmp(lopt, O_DEBOUNCE)) {
+				if ((err = parse_u16(optarg, &cfg->debounce))) {
+					return err;
+				}
+			} else if (!strcmp(lopt, O_MIN_INTERVAL)) {
+				if ((err = parse_u16(optarg, &cfg->min_interval))) {
+					return err;
+				}
+			} else if (!strcmp(lopt, O_CONTROL)) {
+				cfg->control = optarg;
+			} else if (!strcmp(lopt, O_DUMP)) {
+				cfg->mode = DUMP;
+				cfg->output = optarg;
 			} else {
 				fprintf(stderr, "\n");
 				print_help(stderr, argv[0]);
 				return errorf(E_UNKNOWN_OPT, "--%s", lopt);
 			}
 			break;
+		case 'c':
+			cfg->mode = COMPILE;
+			cfg->output = optarg;
+			break;
+		case 's':
+			cfg->stream = true;
+			break;
+		case 'r':
+			cfg->replace = true;
+			break;
+		case 'd':
+			cfg->delta = true;
+			break;
 		case 'n':
 			cfg->noop = true;
 			break;
@@ -175,6 +372,13 @@ static error_t *parse_cmdline(int argc, char **argv, config *cfg)
 		return NULL;
 	}
 
+	if (cfg->mode == DUMP) {
+		if (argc > optind) {
+			return error(E_TOO_MANY_ARGS);
+		}
+		return validate_config(cfg);
+	}
+
 	if (argc == optind) {
 		return error(E_FILE_ARG_REQUIRED);
 	}
@@ -192,59 +396,444 @@ static error_t *parse_cmdline(int argc, char **argv, config *cfg)
 	return NULL;
 }
 
-// Runs the program.
-static error_t *run(config *cfg)
+// Applies delta input.
+static error_t *run_delta(const config *cfg, input *in)
 {
-	char cbstr[MAX_CLASSIFY_BY_STRLEN+1];
-	char rstr[MAX_RANGE_STRLEN+1];
-	entries *es = new_entries();
-	FILE *in = stdin;
+	bpf_handle hnd = {{0}};
+	entries *es = NULL;
+	char *ops = NULL;
 	bpf_config bcfg;
-	bpf_handle hnd;
 	error_t *err;
+	double start;
 
-	if (cfg->noop) {
-		logn(cfg, "NO-OP MODE: BPF will not be updated\n");
+	es = new_entries();
+	start = mono_time();
+	if ((err = parse_delta(in, es, &ops))) {
+		goto out;
 	}
-
-	if (cfg->input && strcmp(cfg->input, "-") && (in = fopen(cfg->input, "r")) == NULL) {
-		err = errorf(E_OPEN_INPUT_FILE_FAILED, "'%s', %s", cfg->input, strerror(errno));
+	logv(cfg, "Parsed %lu delta entries in %.3fs\n", es->len, mono_time() - start);
+	if ((err = bpf_open(&hnd))) {
 		goto out;
 	}
-	if ((err = parse_input(in, es))) {
+	if ((err = bpf_open_state(&hnd))) {
 		goto out;
 	}
-
-	if ((err = bpf_open(&hnd))) {
+	if (!cfg->noop) {
+		remove_cache();
+	}
+	start = mono_time();
+	if ((err = apply_delta(&hnd, cfg, es, ops))) {
 		goto out;
 	}
+	logv(cfg, "Applied delta in %.3fs\n", mono_time() - start);
 
-	finalize_config(cfg, es->len);
+	// the maps no longer match any generation, e.g. of a daemon's mirror
+	if (!cfg->noop && !(err = bpf_read_config(&hnd, &bcfg)) && bcfg.generation) {
+		bcfg.generation = 0;
+		err = bpf_update_config(&hnd, &bcfg);
+	}
 
-	init_bpf_config(cfg, &bcfg);
+out:
+	free(ops);
+	free_entries(es);
+	bpf_close(&hnd);
+	return err;
+}
+
+// Prints the configuration used for a run.
+static void print_config(const config *cfg, const bpf_config *bcfg)
+{
+	char cbstr[MAX_CLASSIFY_BY_STRLEN+1];
+	char rstr[MAX_RANGE_STRLEN+1];
 
 	printf("user flows: %s\n", u16_range_str(&cfg->user_flows, rstr));
 	printf("uncl flows: %s\n", u16_range_str(&cfg->uncl_flows, rstr));
 	printf("flows per user: %s\n", u16_range_str(&cfg->fpu_range, rstr));
 	printf("classify by addresses: %s\n", classify_by_str(cfg->classify_by, cbstr));
-	printf("bpf flows per user: %u\n", bcfg.flows_per_user);
+	printf("assign mode: %s\n", assign_mode_str(cfg->assign));
+	if (cfg->max_load) {
+		printf("max load: %u%%\n", cfg->max_load);
+	}
+	if (cfg->assign == ASSIGN_TRAFFIC) {
+		printf("max moves: %u\n", cfg->max_moves);
+	}
+	printf("bpf flows per user: %u\n", bcfg->flows_per_user);
+}
 
-	classify(&hnd, cfg, es);
+// Streams input to the BPF maps.
+static error_t *run_stream(config *cfg, input *in)
+{
+	bpf_handle hnd = {{0}};
+	unsigned long nents;
+	bpf_config bcfg;
+	error_t *err;
+	double start;
 
-	if ((err = sync_bpf(&hnd, cfg, es))) {
+	start = mono_time();
+	if ((err = bpf_open(&hnd))) {
 		goto out;
 	}
+	if (!cfg->noop) {
+		remove_cache();
+	}
+	if ((err = stream_bpf(&hnd, cfg, in, &nents))) {
+		goto out;
+	}
+	if (!cfg->noop) {
+		bpf_remove_state();
+	}
+	logv(cfg, "Streamed %lu entries in %.3fs\n", nents, mono_time() - start);
+
+	finalize_config(cfg, nents);
+	init_bpf_config(cfg, &bcfg);
+	bcfg.active_set = hnd.active_set;
+	print_config(cfg, &bcfg);
 
 	if (!cfg->noop) {
 		err = bpf_update_config(&hnd, &bcfg);
 	}
 
 out:
+	bpf_close(&hnd);
+	return err;
+}
+
+// Writes the synced contents of the BPF maps to the cache, with the generation
+// in bcfg, or sets the generation to 0 if that fails, so it's only a warning.
+static void update_cache(const config *cfg, const addr_table *bt, bpf_config *bcfg)
+{
+	error_t *err;
+
+	if ((err = write_cache(bcfg->generation, bt))) {
+		logw(cfg, "unable to write cache: %s\n", err->message);
+		bcfg->generation = 0;
+	}
+}
+
+// Syncs input with the BPF maps. *bt holds the synced contents of the maps, and
+// is read from them (or the cache) if NULL. On return, *bt holds the synced
+// contents again, or is NULL if they're unknown after an error.
+static error_t *run_full(config *cfg, bpf_handle *hnd, input *in, addr_table **bt)
+{
+	bpf_reader rd = {0};
+	uint64_t *loads = NULL;
+	entries *es = NULL;
+	bool fresh, dirty = false;
+	bpf_config bcfg;
+	error_t *err;
+	double start;
+	bool sticky;
+
+	start = mono_time();
+	if ((fresh = (*bt == NULL))) {
+		*bt = new_addr_table();
+		start_read_bpf(&rd, hnd, cfg, *bt);
+	}
+	es = new_entries();
+	if ((err = parse_input(in, cfg->threads, es))) {
+		goto out;
+	}
+	if ((err = check_entries(cfg, es))) {
+		goto out;
+	}
+	logv(cfg, "Parsed %lu entries in %.3fs\n", es->len, mono_time() - start);
+
+	finalize_config(cfg, es->len);
+	init_bpf_config(cfg, &bcfg);
+	bcfg.active_set = hnd->active_set;
+	print_config(cfg, &bcfg);
+
+	// sticky classids need the BPF maps, other modes classify while they're read
+	sticky = (cfg->assign == ASSIGN_STICKY || cfg->assign == ASSIGN_TRAFFIC);
+	if (fresh && sticky && (err = join_read_bpf(&rd))) {
+		goto out;
+	}
+
+	if (cfg->assign == ASSIGN_TRAFFIC) {
+		loads = calloc(u16_range_size(&cfg->user_flows), sizeof(uint64_t));
+		if (!hnd->sfd && (err = bpf_open_stats(hnd))) {
+			goto out;
+		}
+		if ((err = read_classid_loads(hnd, cfg, loads))) {
+			goto out;
+		}
+	}
+
+	classify(hnd, cfg, es, *bt, loads);
+	if (fresh && !sticky && (err = join_read_bpf(&rd))) {
+		goto out;
+	}
+
+	// the cache is invalid once the maps change, until it's rewritten
+	if (!cfg->noop) {
+		remove_cache();
+		bcfg.generation = hnd->generation + 1;
+		if (bcfg.generation == 0) {
+			bcfg.generation = 1;
+		}
+	}
+
+	dirty = !cfg->noop;
+	if (cfg->replace && !cfg->noop) {
+		if (!(err = replace_bpf(hnd, cfg, es, &bcfg))) {
+			free_addr_table(*bt);
+			*bt = new_addr_table_from(es);
+			sort_addr_table(*bt, cfg->threads);
+		}
+	} else {
+		err = sync_bpf(hnd, cfg, es, *bt);
+	}
+	if (err) {
+		goto out;
+	}
+
+	if (!cfg->noop) {
+		update_cache(cfg, *bt, &bcfg);
+		if (cfg->track_users) {
+			err = save_user_state(hnd, cfg, es);
+		} else {
+			bpf_remove_state();
+		}
+		if (err) {
+			goto out;
+		}
+		if ((err = bpf_update_config(hnd, &bcfg))) {
+			goto out;
+		}
+		hnd->generation = bcfg.generation;
+	}
+
+out:
+	stop_read_bpf(&rd);
+	if (err && (fresh || dirty)) {
+		free_addr_table(*bt);
+		*bt = NULL;
+	}
+	free(loads);
 	free_entries(es);
+	return err;
+}
+
+// Set by SIGINT or SIGTERM to stop the daemon.
+static volatile sig_atomic_t g_stop;
+
+// Handles SIGINT and SIGTERM in the daemon.
+static void handle_stop(int sig)
+{
+	g_stop = 1;
+}
+
+// Opens the BPF maps again if their generation has changed (or is 0), as
+// another run of tc-users may have changed or replaced them, dropping the synced
+// contents *bt and the control socket's user counts, so they're read again.
+static error_t *check_generation(const config *cfg, bpf_handle *hnd,
+	addr_table **bt, control *ctl)
+{
+	uint32_t gen = hnd->generation;
+	bpf_config bcfg;
+
+	if (!bpf_read_config(hnd, &bcfg) && gen != 0 && hnd->generation == gen) {
+		return NULL;
+	}
+	logv(cfg, "Daemon: reopening BPF maps, generation %u was %u\n",
+		hnd->generation, gen);
+	free_addr_table(*bt);
+	*bt = NULL;
+	reset_control(ctl);
+	bpf_close(hnd);
+
+	return bpf_open(hnd);
+}
+
+// Syncs the input with the BPF maps again in the daemon.
+static error_t *reload(config *cfg, bpf_handle *hnd, addr_table **bt,
+	control *ctl)
+{
+	error_t *err;
+	input in;
+
+	if ((err = check_generation(cfg, hnd, bt, ctl))) {
+		return err;
+	}
+	if ((err = open_input(cfg->input, &in))) {
+		return err;
+	}
+	err = run_full(cfg, hnd, &in, bt);
+	close_input(&in);
+	// the user state was replaced
+	reset_control(ctl);
+
+	return err;
+}
+
+// Syncs the input with the BPF maps each time it changes, until stopped by
+// SIGINT or SIGTERM. Changes are debounced, and syncs are at least
+// cfg->min_interval seconds apart. The synced contents are kept in *bt, so
+// usually only the input is parsed again. Sync errors are logged, and the
+// daemon waits for the next change. With cfg->control, commands on the control
+// socket are run between syncs.
+static error_t *run_daemon(config *cfg, bpf_handle *hnd, addr_table **bt)
+{
+	struct pollfd fds[1 + CONTROL_POLLFDS];
+	struct sigaction sa = {0};
+	control ctl = {0};
+	double last, start;
+	error_t *err = NULL;
+	int timeout, nfds;
+	bool changed;
+	watch w;
+
+	if ((err = open_watch(cfg->input, &w))) {
+		return err;
+	}
+	nfds = 1;
+	if (cfg->control) {
+		if ((err = open_control(cfg->control, &ctl))) {
+			close_watch(&w);
+			return err;
+		}
+		nfds += CONTROL_POLLFDS;
+	}
+	sa.sa_handler = handle_stop;
+	sigaction(SIGINT, &sa, NULL);
+	sigaction(SIGTERM, &sa, NULL);
+	logn(cfg, "Daemon: watching '%s'\n", cfg->input);
+	if (cfg->control) {
+		logn(cfg, "Daemon: control socket '%s'\n", cfg->control);
+	}
+
+	for (last = mono_time(); !g_stop; ) {
+		fflush(stdout);
+		if ((timeout = watch_timeout(&w, cfg->debounce, last + cfg->min_interval)) == 0) {
+			reset_watch(&w);
+			last = start = mono_time();
+			logn(cfg, "Daemon: '%s' changed, syncing\n", cfg->input);
+			if ((err = reload(cfg, hnd, bt, &ctl))) {
+				logw(cfg, "sync failed, waiting for next change: %s\n", err->message);
+				err = NULL;
+				continue;
+			}
+			logn(cfg, "Daemon: synced in %.3fs\n", mono_time() - start);
+			continue;
+		}
+
+		fds[0] = (const struct pollfd){w.fd, POLLIN, 0};
+		if (cfg->control) {
+			control_pollfds(&ctl, &fds[1]);
+		}
+		if (poll(fds, nfds, timeout) == -1) {
+			if (errno == EINTR) {
+				continue;
+			}
+			err = errorf(E_WATCH_FAIL, "'%s', %s", cfg->input, strerror(errno));
+			break;
+		}
+		if (fds[0].revents && (err = read_watch(&w))) {
+			break;
+		}
+		if (cfg->control && control_ready(&fds[1])) {
+			if ((err = check_generation(cfg, hnd, bt, &ctl))) {
+				logw(cfg, "control socket: %s\n", err->message);
+				err = NULL;
+			}
+			serve_control(&ctl, &fds[1], hnd, cfg, &changed);
+			if (changed) {
+				// the maps no longer match the synced contents
+				free_addr_table(*bt);
+				*bt = NULL;
+			}
+		}
+	}
+	if (g_stop) {
+		logn(cfg, "Daemon: stopped\n");
+	}
+
+	close_control(&ctl);
+	close_watch(&w);
+	return err;
+}
+
+// Runs the program.
+static error_t *run(config *cfg)
+{
+	bpf_handle hnd = {{0}};
+	addr_table *bt = NULL;
+	error_t *err;
+	input in;
+
+	if (cfg->noop) {
+		logn(cfg, "NO-OP MODE: BPF will not be updated\n");
+	}
+
+	if ((err = open_input(cfg->input, &in))) {
+		return err;
+	}
+	if (cfg->delta) {
+		err = run_delta(cfg, &in);
+	} else if (cfg->stream) {
+		err = run_stream(cfg, &in);
+	} else if (!(err = bpf_open(&hnd))) {
+		err = run_full(cfg, &hnd, &in, &bt);
+	}
+	close_input(&in);
+
+	if (!err && cfg->daemon) {
+		err = run_daemon(cfg, &hnd, &bt);
+	}
+	free_addr_table(bt);
 	bpf_close(&hnd);
-	if (in) {
-		fclose(in);
+	return err;
+}
+
+// Compiles the input to a binary snapshot.
+static error_t *compile(config *cfg)
+{
+	entries *es = new_entries();
+	error_t *err;
+	double start;
+	input in;
+
+	if ((err = open_input(cfg->input, &in))) {
+		goto out;
+	}
+	start = mono_time();
+	if ((err = parse_input(&in, cfg->threads, es))) {
+		goto out;
 	}
+	if ((err = check_entries(cfg, es))) {
+		goto out;
+	}
+	if ((err = write_snapshot(cfg->output, es, cfg->threads))) {
+		goto out;
+	}
+	if (strcmp(cfg->output, "-")) {
+		logn(cfg, "Compiled %lu entries to %s in %.3fs\n", es->len, cfg->output,
+			mono_time() - start);
+	}
+
+out:
+	free_entries(es);
+	close_input(&in);
+	return err;
+}
+
+// Dumps the BPF maps in the input format.
+static error_t *dump(config *cfg)
+{
+	bpf_handle hnd;
+	unsigned long n;
+	error_t *err;
+	double start;
+
+	start = mono_time();
+	if ((err = bpf_open(&hnd))) {
+		return err;
+	}
+	if (!(err = dump_bpf(&hnd, cfg->output, &n)) && strcmp(cfg->output, "-")) {
+		logn(cfg, "Dumped %lu entries to %s in %.3fs\n", n, cfg->output,
+			mono_time() - start);
+	}
+	bpf_close(&hnd);
 	return err;
 }
 
@@ -276,6 +865,18 @@ int main(int argc, char **argv)
 			return EXIT_FAILURE;
 		}
 		break;
+	case COMPILE:
+		if ((err = compile(&cfg))) {
+			print_error(argv[0], err);
+			return EXIT_FAILURE;
+		}
+		break;
+	case DUMP:
+		if ((err = dump(&cfg))) {
+			print_error(argv[0], err);
+			return EXIT_FAILURE;
+		}
+		break;
 	}
 
 	return EXIT_SUCCESS;
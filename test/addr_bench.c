@@ -0,0 +1,80 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "ref_addr.h"
+#include "test.h"
+
+#define DEFAULT_ITERS 2000000
+#define NADDRS 64
+
+// Address strings of one type, parsed in turn.
+typedef struct {
+	const char *name;
+	char strs[NADDRS][MAX_ADDR_STRLEN+1];
+} addr_set;
+
+// Fills the sets with random addresses of each type.
+static void gen_sets(addr_set *sets)
+{
+	uint64_t r = 0x2545f4914f6cdd1d;
+	uint64_t v;
+	int i;
+
+	sets[MAC].name = "mac";
+	sets[IP4].name = "ip4";
+	sets[IP6].name = "ip6";
+	for (i = 0; i < NADDRS; i++) {
+		v = rand64(&r);
+		snprintf(sets[MAC].strs[i], MAX_ADDR_STRLEN+1,
+			"%02x:%02x:%02x:%02x:%02x:%02x",
+			(uint8_t) v, (uint8_t) (v >> 8), (uint8_t) (v >> 16),
+			(uint8_t) (v >> 24), (uint8_t) (v >> 32), (uint8_t) (v >> 40));
+		snprintf(sets[IP4].strs[i], MAX_ADDR_STRLEN+1, "%u.%u.%u.%u",
+			10 + (uint8_t) v % 200, (uint8_t) (v >> 8), (uint8_t) (v >> 16),
+			(uint8_t) (v >> 24));
+		snprintf(sets[IP6].strs[i], MAX_ADDR_STRLEN+1, "2001:db8:%x:%x::%x:%x",
+			(uint16_t) v, (uint16_t) (v >> 16), (uint16_t) (v >> 32),
+			(uint16_t) (v >> 48));
+	}
+}
+
+// Returns the nanoseconds per address to parse iters addresses from a set.
+static double time_parse(error_t *(*parse)(const char *, addr *),
+	const addr_set *set, const unsigned long iters)
+{
+	unsigned long i, bad = 0;
+	double start;
+	addr a;
+
+	start = mono_time();
+	for (i = 0; i < iters; i++) {
+		bad += (parse(set->strs[i % NADDRS], &a) != NULL);
+	}
+	if (bad) {
+		fprintf(stderr, "addr_bench: %lu parse errors\n", bad);
+		exit(EXIT_FAILURE);
+	}
+
+	return (mono_time() - start) / iters * 1e9;
+}
+
+// Prints the time per address for parse_addr and the reference parser, for
+// each address type.
+int main(int argc, char *argv[])
+{
+	unsigned long iters = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ITERS);
+	addr_set sets[MAX_ADDR_TYPE];
+	double ns, rns;
+	addr_type t;
+
+	gen_sets(sets);
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		rns = time_parse(ref_parse_addr, &sets[t], iters);
+		ns = time_parse(parse_addr, &sets[t], iters);
+		printf("addr_bench: %s: %.1f ns/addr, reference %.1f ns/addr (%.1fx)\n",
+			sets[t].name, ns, rns, rns / ns);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,172 @@
+#include <ctype.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "ref_addr.h"
+#include "test.h"
+
+#define DEFAULT_CASES 1000000
+#define MAX_DIFFS 20
+
+// Characters used to mutate generated addresses.
+static const char mut_chars[] = "0123456789abcdefABCDEFgx:.-+ ";
+
+// Inputs that exercise the edges of each format.
+static const char *edge_cases[] = {
+	"", ":", "::", ":::", "1::", "::1", "1:2:3:4:5:6:7:8", "1:2:3:4:5:6:7:8:9",
+	"1:2:3:4:5:6:7::", "::1:2:3:4:5:6:7", "1:2:3:4:5:6:7:8::",
+	"12:34:56:78:9a:bc", "12:34:56:78:9a.bc", "12-34-56-78-9a-bc",
+	"12:34:56:78:9a:bcd", "12:34:56:78:9a:b ", "12::34:56:78:9abc",
+	"1.2.3.4", "01.2.3.4", "256.1.1.1", "1.2.3", "1.2.3.4.", "0.0.0.0",
+	"255.255.255.255", "::1.2.3.4", "1::1.2.3.4.5", "::ffff:1.2.3.4",
+	"1:2:3:4:5:6:1.2.3.4", "1:2:3:4:5:6:7:1.2.3.4", "fe80::1%eth0",
+	"2001:db8::1:2:3:4", "abcd", "1234567890abcdefg", "00000:1::", "1:00001::",
+};
+
+// Writes a random valid address of a random type to s.
+static void gen_addr(uint64_t *r, char *s)
+{
+	uint8_t b[IP6_LEN];
+	char v4[INET_ADDRSTRLEN];
+	int i, n;
+
+	for (i = 0; i < IP6_LEN; i++) {
+		b[i] = randn(r, 4) ? rand64(r) : 0;
+	}
+	switch (randn(r, 8)) {
+	case 0:
+	case 1:
+		for (i = 0, n = 0; i < MAC_LEN; i++) {
+			n += sprintf(s + n, (randn(r, 2) ? "%s%02x" : "%s%02X"),
+				(i ? ":" : ""), b[i]);
+		}
+		break;
+	case 2:
+	case 3:
+		inet_ntop(AF_INET, b, s, INET_ADDRSTRLEN);
+		break;
+	case 4:
+		for (i = 0; i < IP6_LEN; i += 2) {
+			b[i] = b[i+1] = (randn(r, 2) ? b[i] : 0);
+		}
+		inet_ntop(AF_INET6, b, s, INET6_ADDRSTRLEN);
+		break;
+	case 5:
+		for (i = 0, n = 0; i < IP6_LEN; i += 2) {
+			n += sprintf(s + n, "%s%02x%02x", (i ? ":" : ""), b[i], b[i+1]);
+		}
+		break;
+	case 6:
+		inet_ntop(AF_INET6, b, s, INET6_ADDRSTRLEN);
+		for (i = 0; s[i]; i++) {
+			s[i] = toupper((unsigned char) s[i]);
+		}
+		break;
+	default:
+		inet_ntop(AF_INET, b, v4, INET_ADDRSTRLEN);
+		sprintf(s, (randn(r, 2) ? "::ffff:%s" : "64:ff9b::%s"), v4);
+		break;
+	}
+}
+
+// Replaces, inserts or deletes one to three characters in s.
+static void mutate(uint64_t *r, char *s)
+{
+	size_t len, i;
+	int k, n;
+	char c;
+
+	for (k = 0, n = 1 + randn(r, 3); k < n; k++) {
+		len = strlen(s);
+		i = randn(r, len + 1);
+		c = mut_chars[randn(r, sizeof(mut_chars) - 1)];
+		switch (randn(r, 3)) {
+		case 0:
+			if (i < len) {
+				s[i] = c;
+			}
+			break;
+		case 1:
+			memmove(s + i + 1, s + i, len - i + 1);
+			s[i] = c;
+			break;
+		default:
+			if (i < len) {
+				memmove(s + i, s + i + 1, len - i);
+			}
+			break;
+		}
+	}
+}
+
+// Returns true if parse_addr gives the same result as the reference parser for
+// s, and if s is valid, that the address's string parses back to it. MAC
+// octets that sscanf accepted with a sign, space or 0x ("+f", " e", "0x") are
+// rejected on purpose, and counted in *lenient.
+static bool check(const char *s, bool *valid, bool *lenient)
+{
+	char str[MAX_ADDR_STRLEN+1];
+	error_t *err, *rerr;
+	addr a, ra, sa;
+
+	memset(&a, 0, sizeof(a));
+	memset(&ra, 0, sizeof(ra));
+	err = parse_addr(s, &a);
+	rerr = ref_parse_addr(s, &ra);
+	*valid = false;
+	if ((*lenient = (err && err->code == E_INVALID_MAC && !rerr && ra.type == MAC &&
+		strpbrk(s, "+- xX")))) {
+		return true;
+	}
+	if (!err != !rerr || (err && err->code != rerr->code)) {
+		return false;
+	}
+	if ((*valid = !err)) {
+		if (a.type != ra.type || cmp_addr(&a, &ra)) {
+			return false;
+		}
+		memset(&sa, 0, sizeof(sa));
+		if (parse_addr(addr_str(&a, str), &sa) || cmp_addr(&a, &sa)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+// Compares parse_addr with the reference parser on edge cases, then on random
+// addresses of each type, about half of them mutated to be invalid.
+int main(int argc, char *argv[])
+{
+	unsigned long n = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_CASES);
+	unsigned long i, nvalid = 0, nlenient = 0, ndiff = 0;
+	char s[MAX_ADDR_STRLEN+1];
+	uint64_t r = 0x9e3779b97f4a7c15;
+	bool valid, lenient;
+
+	for (i = 0; i < n; i++) {
+		if (i < sizeof(edge_cases) / sizeof(*edge_cases)) {
+			strcpy(s, edge_cases[i]);
+		} else {
+			gen_addr(&r, s);
+			if (randn(&r, 2)) {
+				mutate(&r, s);
+			}
+		}
+		if (!check(s, &valid, &lenient)) {
+			if (ndiff++ < MAX_DIFFS) {
+				fprintf(stderr, "addr_test: differs from reference: '%s'\n", s);
+			}
+			continue;
+		}
+		nvalid += valid;
+		nlenient += lenient;
+	}
+	printf("addr_test: %lu addresses, %lu valid, %lu invalid, %lu sscanf MACs, "
+		"%lu differences\n", n, nvalid, n - nvalid - nlenient, nlenient, ndiff);
+
+	return (ndiff ? EXIT_FAILURE : EXIT_SUCCESS);
+}
@@ -0,0 +1,171 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "addrtab.h"
+#include "log.h"
+#include "test.h"
+
+// Sets a to a pseudo-random address for index i, of type i % MAX_ADDR_TYPE.
+static void gen_addr(const unsigned long i, addr *a)
+{
+	uint64_t r = (i + 1) * 0x9e3779b97f4a7c15;
+
+	memset(a, 0, sizeof(*a));
+	a->type = i % MAX_ADDR_TYPE;
+	rand64(&r);
+	memcpy(&a->val, &r, sizeof(r));
+	if (a->type == IP6) {
+		rand64(&r);
+		memcpy(a->val.ip6 + sizeof(r), &r, sizeof(r));
+	}
+}
+
+// Returns entries with the addresses for indexes from start to start+n.
+static entries *gen_entries(const unsigned long start, const unsigned long n)
+{
+	entries *es = new_entries();
+	unsigned long i;
+	entry e = {0};
+
+	reserve_entries(es, n);
+	for (i = start; i < start + n; i++) {
+		gen_addr(i, &e.addr);
+		e.uid = i / 3;
+		append_entry(es, &e);
+	}
+
+	return es;
+}
+
+static int cmp_ents_by_addr(const void *p1, const void *p2)
+{
+	return cmp_addr(&((const entry *) p1)->addr, &((const entry *) p2)->addr);
+}
+
+// Returns the number of addresses in both sorted entries.
+static unsigned long join_entries(const entries *a, const entries *b)
+{
+	unsigned long i = 0, j = 0, n = 0;
+	int d;
+
+	while (i < a->len && j < b->len) {
+		if ((d = cmp_addr(&a->arr[i].addr, &b->arr[j].addr)) == 0) {
+			n++;
+			i++;
+			j++;
+		} else if (d < 0) {
+			i++;
+		} else {
+			j++;
+		}
+	}
+
+	return n;
+}
+
+// Returns the number of addresses in both sorted tables.
+static unsigned long join_tables(const addr_table *a, const addr_table *b)
+{
+	const addr_column *ca, *cb;
+	unsigned long i, j, n = 0;
+	addr_type t;
+	int d;
+
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		ca = &a->cols[t];
+		cb = &b->cols[t];
+		for (i = 0, j = 0; i < ca->len && j < cb->len; ) {
+			if ((d = memcmp(col_key(ca, i), col_key(cb, j), ca->klen)) == 0) {
+				n++;
+				i++;
+				j++;
+			} else if (d < 0) {
+				i++;
+			} else {
+				j++;
+			}
+		}
+	}
+
+	return n;
+}
+
+// Returns the bytes used by a table's columns.
+static size_t table_size(const addr_table *t)
+{
+	size_t n = 0;
+	addr_type at;
+
+	for (at = 0; at < MAX_ADDR_TYPE; at++) {
+		n += t->cols[at].len * (t->cols[at].klen + sizeof(uint16_t) +
+			sizeof(uint32_t));
+	}
+
+	return n;
+}
+
+// Sorts and joins two sets of n addresses, about half of them in both, as an
+// array of entries and as address tables, printing the time and memory of each.
+static int bench(const unsigned long n)
+{
+	entries *a = gen_entries(0, n), *b = gen_entries(n / 2, n);
+	addr_table *ta, *tb;
+	double start, tsort, tjoin;
+	unsigned long m, tm;
+
+	start = mono_time();
+	sort_entries(a, cmp_ents_by_addr);
+	sort_entries(b, cmp_ents_by_addr);
+	tsort = mono_time() - start;
+	start = mono_time();
+	m = join_entries(a, b);
+	tjoin = mono_time() - start;
+	printf("addrtab_bench: %luk entries: sort %.3fs, join %.3fs, %.1f MB "
+		"(%zu bytes/addr)\n", n / 1000, tsort, tjoin,
+		2.0 * n * sizeof(entry) / 1e6, sizeof(entry));
+
+	start = mono_time();
+	ta = new_addr_table_from(a);
+	tb = new_addr_table_from(b);
+	ta->sorted = tb->sorted = false;
+	sort_addr_table(ta, 1);
+	sort_addr_table(tb, 1);
+	tsort = mono_time() - start;
+	start = mono_time();
+	tm = join_tables(ta, tb);
+	tjoin = mono_time() - start;
+	printf("addrtab_bench: %luk columns: sort %.3fs, join %.3fs, %.1f MB "
+		"(%.1f bytes/addr)\n", n / 1000, tsort, tjoin,
+		(table_size(ta) + table_size(tb)) / 1e6, (double) table_size(ta) / n);
+
+	free_addr_table(ta);
+	free_addr_table(tb);
+	free_entries(a);
+	free_entries(b);
+
+	if (m != tm) {
+		fprintf(stderr, "addrtab_bench: joins found %lu and %lu addresses\n",
+			m, tm);
+		return EXIT_FAILURE;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Compares sorting and merge joining addresses stored as entries and as
+// address tables, with the sizes in thousands of entries given as arguments.
+int main(int argc, char *argv[])
+{
+	int i;
+
+	if (argc < 2) {
+		return bench(1000000) || bench(10000000);
+	}
+	for (i = 1; i < argc; i++) {
+		if (bench(strtoul(argv[i], NULL, 10) * 1000)) {
+			return EXIT_FAILURE;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,132 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "classify.h"
+#include "test.h"
+
+#define DEFAULT_USERS 20000
+#define ROUNDS 20
+#define CHURN 100
+
+// An assign mode to simulate.
+typedef struct {
+	const char *name;
+	assign_mode assign;
+	uint16_t max_load;
+} churn_mode;
+
+static const churn_mode modes[] = {
+	{"balanced", ASSIGN_BALANCED, 0},
+	{"sticky", ASSIGN_STICKY, 0},
+	{"hash", ASSIGN_HASH, 0},
+	{"hash, max 125%", ASSIGN_HASH, 125},
+	{"hash, max 110%", ASSIGN_HASH, 110},
+};
+
+// Classifies users, each with one IPv4 address from its number, given the
+// previous contents of the maps in bt. Returns the new contents, and sets
+// classids[user] to each user's classid.
+static addr_table *run(const config *cfg, const uint32_t *users, const uint32_t n,
+	const addr_table *bt, uint16_t *classids)
+{
+	entries *es = new_entries();
+	char userid[MAX_USERID_STRLEN+1];
+	addr_table *t;
+	entry e = {0};
+	uint32_t i, u;
+	bool added;
+
+	e.addr.type = IP4;
+	for (i = 0; i < n; i++) {
+		snprintf(userid, sizeof(userid), "user%u", users[i]);
+		memcpy(e.addr.val.ip4, &users[i], IP4_LEN);
+		e.uid = intern_userid(es->us, userid, strlen(userid), &added);
+		append_entry(es, &e);
+	}
+	classify(NULL, cfg, es, bt, NULL);
+	for (i = 0; i < es->len; i++) {
+		memcpy(&u, es->arr[i].addr.val.ip4, IP4_LEN);
+		classids[u] = es->arr[i].classid;
+	}
+
+	t = new_addr_table_from(es);
+	t->sorted = false;
+	sort_addr_table(t, 1);
+	free_entries(es);
+
+	return t;
+}
+
+// Simulates ROUNDS rounds of removing CHURN random users and adding CHURN new
+// ones, in one assign mode, printing the users moved to a new classid per
+// round and the range of users per classid at the end.
+static void simulate(const churn_mode *m, const uint32_t nusers)
+{
+	uint32_t maxusers = nusers + ROUNDS * CHURN, next = nusers;
+	uint16_t *prev = malloc(maxusers * sizeof(uint16_t));
+	uint16_t *cur = malloc(maxusers * sizeof(uint16_t));
+	uint32_t *users = malloc(nusers * sizeof(uint32_t));
+	uint32_t *counts, i, r, k, lo = UINT32_MAX, hi = 0;
+	uint64_t rnd = 0xbb67ae8584caa73b;
+	unsigned long moved = 0;
+	addr_table *bt, *t;
+	config cfg;
+
+	init_config(&cfg);
+	cfg.log = LOG_QUIET;
+	cfg.assign = m->assign;
+	cfg.max_load = m->max_load;
+
+	for (i = 0; i < nusers; i++) {
+		users[i] = i;
+	}
+	bt = new_addr_table();
+	t = run(&cfg, users, nusers, bt, prev);
+	free_addr_table(bt);
+	bt = t;
+
+	for (r = 0; r < ROUNDS; r++) {
+		// replacing random users with new ones removes and adds CHURN users
+		for (k = 0; k < CHURN; k++) {
+			users[randn(&rnd, nusers)] = next++;
+		}
+		t = run(&cfg, users, nusers, bt, cur);
+		for (i = 0; i < nusers; i++) {
+			moved += (users[i] < next - CHURN && cur[users[i]] != prev[users[i]]);
+		}
+		memcpy(prev, cur, maxusers * sizeof(uint16_t));
+		free_addr_table(bt);
+		bt = t;
+	}
+
+	counts = calloc(u16_range_size(&cfg.user_flows), sizeof(uint32_t));
+	for (i = 0; i < nusers; i++) {
+		counts[cur[users[i]] - cfg.user_flows.lo]++;
+	}
+	for (i = 0; i < u16_range_size(&cfg.user_flows); i++) {
+		lo = (counts[i] < lo ? counts[i] : lo);
+		hi = (counts[i] > hi ? counts[i] : hi);
+	}
+	printf("churn_bench: %-16s %8.1f moved/round, %u-%u users per classid\n",
+		m->name, (double) moved / ROUNDS, lo, hi);
+
+	free(counts);
+	free_addr_table(bt);
+	free(users);
+	free(cur);
+	free(prev);
+}
+
+// Simulates churn in each assign mode, given the number of users.
+int main(int argc, char *argv[])
+{
+	uint32_t nusers = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_USERS);
+	size_t i;
+
+	for (i = 0; i < sizeof(modes) / sizeof(*modes); i++) {
+		simulate(&modes[i], nusers);
+	}
+
+	return EXIT_SUCCESS;
+}
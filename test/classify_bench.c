@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "classify.h"
+#include "log.h"
+#include "test.h"
+
+#define DEFAULT_USERS 1000000
+#define ADDRS_PER_USER 3
+
+// Entry as stored before user IDs were interned, with its own user ID string.
+typedef struct {
+	addr addr;
+	char userid[MAX_USERID_STRLEN+1];
+	uint16_t classid;
+	bool classified;
+} ref_entry;
+
+static int cmp_ref_ents(const void *p1, const void *p2)
+{
+	const ref_entry *e1 = p1, *e2 = p2;
+	int cld;
+
+	if ((cld = e1->classified - e2->classified) == 0) {
+		return strncmp(e1->userid, e2->userid, MAX_USERID_STRLEN+1);
+	}
+	return cld;
+}
+
+// Classifies entries the way classify_indirect did before the per-uid table:
+// sorting by user ID, then giving each run of a user ID the next classid.
+static void ref_classify(const config *cfg, ref_entry *arr, const unsigned long n)
+{
+	uint32_t nc = u16_range_size(&cfg->user_flows), next = 0;
+	unsigned long i;
+
+	qsort(arr, n, sizeof(ref_entry), cmp_ref_ents);
+	for (i = 0; i < n && !arr[i].classified; i++) {
+		if (i > 0 && !strncmp(arr[i-1].userid, arr[i].userid, MAX_USERID_STRLEN+1)) {
+			arr[i].classid = arr[i-1].classid;
+		} else {
+			arr[i].classid = cfg->user_flows.lo + next++ % nc;
+		}
+		arr[i].classified = true;
+	}
+}
+
+// Returns entries for nusers users with ADDRS_PER_USER addresses each, in user
+// order or a random order, and sets *ref to the same entries as reference
+// entries.
+static entries *gen_entries(const unsigned long nusers, const bool shuffle,
+	ref_entry **ref)
+{
+	unsigned long i, j, n = nusers * ADDRS_PER_USER;
+	entries *es = new_entries();
+	uint64_t r = 0x6a09e667f3bcc909;
+	char userid[MAX_USERID_STRLEN+1];
+	uint32_t *order = malloc(n * sizeof(uint32_t));
+	entry e = {0};
+	bool added;
+	uint32_t t;
+
+	for (i = 0; i < n; i++) {
+		order[i] = i;
+	}
+	for (i = n - 1; shuffle && i > 0; i--) {
+		j = randn(&r, i + 1);
+		t = order[i];
+		order[i] = order[j];
+		order[j] = t;
+	}
+
+	*ref = malloc(n * sizeof(ref_entry));
+	reserve_entries(es, n);
+	for (i = 0; i < n; i++) {
+		snprintf(userid, sizeof(userid), "user%u", order[i] / ADDRS_PER_USER);
+		e.addr.type = IP4;
+		memcpy(e.addr.val.ip4, &order[i], IP4_LEN);
+		e.uid = intern_userid(es->us, userid, strlen(userid), &added);
+		append_entry(es, &e);
+		(*ref)[i] = (const ref_entry){e.addr, "", 0, false};
+		strcpy((*ref)[i].userid, userid);
+	}
+	free(order);
+
+	return es;
+}
+
+// Times classifying users with the previous sort-based grouping and with
+// classify().
+static void bench(const unsigned long nusers, const bool shuffle)
+{
+	const char *order = (shuffle ? "random order" : "user order");
+	addr_table *bt = new_addr_table();
+	ref_entry *ref;
+	double start;
+	entries *es;
+	config cfg;
+
+	init_config(&cfg);
+	cfg.log = LOG_QUIET;
+	es = gen_entries(nusers, shuffle, &ref);
+
+	start = mono_time();
+	ref_classify(&cfg, ref, es->len);
+	printf("classify_bench: %lu users x %d, %s: sort by userid %.3fs\n", nusers,
+		ADDRS_PER_USER, order, mono_time() - start);
+
+	start = mono_time();
+	classify(NULL, &cfg, es, bt, NULL);
+	printf("classify_bench: %lu users x %d, %s: classify     %.3fs\n", nusers,
+		ADDRS_PER_USER, order, mono_time() - start);
+
+	free(ref);
+	free_entries(es);
+	free_addr_table(bt);
+}
+
+// Runs the benchmark with input in user order and in a random order, given the
+// number of users, which have three addresses each.
+int main(int argc, char *argv[])
+{
+	unsigned long nusers = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_USERS);
+
+	bench(nusers, false);
+	bench(nusers, true);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,262 @@
+#include <dirent.h>
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "bpf_config.h"
+#include "bpflib.h"
+#include "control.h"
+#include "delta.h"
+#include "log.h"
+
+#define DEFAULT_COMMANDS 20000
+#define PIPELINE 1000
+
+// Mock BPF directory, removed at exit.
+static char g_dir[] = "/tmp/control_bench.XXXXXX";
+
+// Control socket server, run on its own thread like the daemon's poll loop.
+typedef struct {
+	control c;
+	bpf_handle hnd;
+	config cfg;
+} server;
+
+// Removes the mock BPF directory. Registered before the mock backend saves
+// its maps at exit, so it runs after.
+static void remove_dir()
+{
+	char path[sizeof(g_dir) + 256];
+	struct dirent *d;
+	DIR *dir;
+
+	if ((dir = opendir(g_dir))) {
+		while ((d = readdir(dir))) {
+			snprintf(path, sizeof(path), "%s/%s", g_dir, d->d_name);
+			unlink(path);
+		}
+		closedir(dir);
+	}
+	rmdir(g_dir);
+}
+
+// Exits with an error message.
+static void fail(const char *what, const error_t *err)
+{
+	fprintf(stderr, "control_bench: %s: %s\n", what,
+		(err ? err->message : strerror(errno)));
+	exit(EXIT_FAILURE);
+}
+
+// Serves the control socket until its first client has disconnected.
+static void *serve(void *arg)
+{
+	struct pollfd fds[CONTROL_POLLFDS];
+	bool changed, connected = false;
+	server *s = arg;
+
+	for (;;) {
+		control_pollfds(&s->c, fds);
+		if (poll(fds, CONTROL_POLLFDS, -1) > 0) {
+			serve_control(&s->c, fds, &s->hnd, &s->cfg, &changed);
+		}
+		if (s->c.clients[0].fd) {
+			connected = true;
+		} else if (connected) {
+			break;
+		}
+	}
+
+	return NULL;
+}
+
+// Writes all of buf to fd.
+static void write_all(const int fd, const char *buf, size_t len)
+{
+	ssize_t n;
+
+	while (len > 0) {
+		if ((n = write(fd, buf, len)) == -1) {
+			fail("write", NULL);
+		}
+		buf += n;
+		len -= n;
+	}
+}
+
+// Reads n reply lines from fd, failing on any that isn't OK.
+static void read_replies(const int fd, unsigned long n)
+{
+	static char buf[65536];
+	static size_t len;
+	char *p, *nl;
+	ssize_t r;
+
+	while (n > 0) {
+		if (!(nl = memchr(buf, '\n', len))) {
+			if ((r = read(fd, buf + len, sizeof(buf) - len)) <= 0) {
+				fail("read", NULL);
+			}
+			len += r;
+			continue;
+		}
+		if (strncmp(buf, "OK", 2)) {
+			*nl = '\0';
+			fprintf(stderr, "control_bench: reply: %s\n", buf);
+			exit(EXIT_FAILURE);
+		}
+		p = nl + 1;
+		len -= p - buf;
+		memmove(buf, p, len);
+		n--;
+	}
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+
+	return (x > y) - (x < y);
+}
+
+// Formats command i of an operation into buf, returning its length. Each
+// user has one IPv4 address from its number, and with pair set, the command is
+// for the other user of its pair, so '>' moves the address between them.
+static int format_command(char *buf, const size_t size, const char op,
+	const unsigned long i, const bool pair)
+{
+	unsigned long a = i + 1;
+
+	if (op == '?') {
+		return snprintf(buf, size, "?10.%lu.%lu.%lu\n",
+			(a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff);
+	}
+	return snprintf(buf, size, "%cuser%lu,10.%lu.%lu.%lu\n", op,
+		(pair ? i ^ 1 : i), (a >> 16) & 0xff, (a >> 8) & 0xff, a & 0xff);
+}
+
+// Sends n commands of an operation one at a time, waiting for each reply, and
+// prints the round trip latencies.
+static void bench_latency(const int fd, const char op, const unsigned long n,
+	const bool pair)
+{
+	double *lat = malloc(n * sizeof(double));
+	double start;
+	unsigned long i;
+	char line[64];
+	int len;
+
+	for (i = 0; i < n; i++) {
+		len = format_command(line, sizeof(line), op, i, pair);
+		start = mono_time();
+		write_all(fd, line, len);
+		read_replies(fd, 1);
+		lat[i] = mono_time() - start;
+	}
+	qsort(lat, n, sizeof(double), cmp_double);
+	printf("control_bench: '%c' round trip %7.1f us p50, %7.1f us p99, "
+		"%7.1f us max\n", op, lat[n / 2] * 1e6, lat[n * 99 / 100] * 1e6,
+		lat[n - 1] * 1e6);
+
+	free(lat);
+}
+
+// Sends n commands of an operation PIPELINE at a time, reading their replies
+// after each write, and prints the command rate.
+static void bench_pipelined(const int fd, const char op, const unsigned long n,
+	const bool pair)
+{
+	char *buf = malloc(PIPELINE * 64);
+	unsigned long i, j;
+	double start;
+	size_t len;
+
+	start = mono_time();
+	for (i = 0; i < n; i += j) {
+		len = 0;
+		for (j = 0; j < PIPELINE && i + j < n; j++) {
+			len += format_command(buf + len, 64, op, i + j, pair);
+		}
+		write_all(fd, buf, len);
+		read_replies(fd, j);
+	}
+	printf("control_bench: '%c' pipelined by %u %9.0f commands/s\n", op,
+		PIPELINE, n / (mono_time() - start));
+
+	free(buf);
+}
+
+// Benchmarks the control socket with the mock BPF backend, given the number
+// of commands per run.
+int main(int argc, char *argv[])
+{
+	unsigned long n = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_COMMANDS);
+	server *s = calloc(1, sizeof(server));
+	struct sockaddr_un sa = {0};
+	bpf_config bcfg;
+	pthread_t thread;
+	error_t *err;
+	entries *es;
+	int fd;
+
+	if (!mkdtemp(g_dir)) {
+		fail(g_dir, NULL);
+	}
+	atexit(remove_dir);
+	setenv(BPF_MOCK_ENV, g_dir, 1);
+
+	init_config(&s->cfg);
+	s->cfg.log = LOG_QUIET;
+	s->cfg.track_users = true;
+	if ((err = bpf_open(&s->hnd))) {
+		fail("bpf_open", err);
+	}
+	// as after a full sync with --track-users and no users
+	init_bpf_config(&s->cfg, &bcfg);
+	if ((err = bpf_update_config(&s->hnd, &bcfg))) {
+		fail("bpf_update_config", err);
+	}
+	es = new_entries();
+	if ((err = save_user_state(&s->hnd, &s->cfg, es))) {
+		fail("save_user_state", err);
+	}
+	free_entries(es);
+
+	snprintf(sa.sun_path, sizeof(sa.sun_path), "%s/control", g_dir);
+	sa.sun_family = AF_UNIX;
+	if ((err = open_control(sa.sun_path, &s->c))) {
+		fail("open_control", err);
+	}
+	pthread_create(&thread, NULL, serve, s);
+	if ((fd = socket(AF_UNIX, SOCK_STREAM, 0)) == -1 ||
+		connect(fd, (struct sockaddr *) &sa, sizeof(sa)) == -1) {
+		fail(sa.sun_path, NULL);
+	}
+
+	// each '>' run moves the addresses to the other users of their pairs, and
+	// the next moves them back
+	bench_latency(fd, '+', n, false);
+	bench_latency(fd, '?', n, false);
+	bench_latency(fd, '>', n, true);
+	bench_latency(fd, '>', n, false);
+	bench_latency(fd, '-', n, false);
+	bench_pipelined(fd, '+', n, false);
+	bench_pipelined(fd, '?', n, false);
+	bench_pipelined(fd, '>', n, true);
+	bench_pipelined(fd, '>', n, false);
+	bench_pipelined(fd, '-', n, false);
+
+	close(fd);
+	pthread_join(thread, NULL);
+	close_control(&s->c);
+	bpf_close(&s->hnd);
+	free(s);
+
+	return EXIT_SUCCESS;
+}
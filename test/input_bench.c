@@ -0,0 +1,222 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "input.h"
+#include "log.h"
+#include "test.h"
+
+#define DEFAULT_LINES 1000000
+#define ENTRY_DELIMS " ,;"
+#define MAX_LINE (2 * (MAX_USERID_STRLEN + 1 + MAX_ADDR_STRLEN + 2))
+
+// Writes n lines of users with a MAC, IPv4 and IPv6 address each, using all
+// three delimiters, to a new temporary file, returning its path.
+static char *write_input(const unsigned long n)
+{
+	static char path[] = "/tmp/tc-users-bench-XXXXXX";
+	const char delims[] = ENTRY_DELIMS;
+	uint64_t r = 0x853c49e6748fea9b;
+	unsigned long i, u;
+	uint64_t v;
+	char d;
+	FILE *fp;
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1 || (fp = fdopen(fd, "w")) == NULL) {
+		perror("input_bench");
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++) {
+		u = i / 3;
+		v = rand64(&r);
+		d = delims[v % 3];
+		switch (i % 3) {
+		case 0:
+			fprintf(fp, "user%lu%c%02x:%02x:%02x:%02x:%02x:%02x\n", u, d,
+				(uint8_t) (v >> 8), (uint8_t) (v >> 16), (uint8_t) (v >> 24),
+				(uint8_t) (v >> 32), (uint8_t) (v >> 40), (uint8_t) (v >> 48));
+			break;
+		case 1:
+			fprintf(fp, "user%lu%c10.%lu.%lu.%lu\n", u, d, (u >> 16) & 0xff,
+				(u >> 8) & 0xff, u & 0xff);
+			break;
+		default:
+			fprintf(fp, "user%lu%c2001:db8::%lx:%lx\n", u, d, u >> 16, u & 0xffff);
+			break;
+		}
+	}
+	fclose(fp);
+
+	return path;
+}
+
+// Parses one line the way parse_input did before in-place parsing: fgets into
+// a line buffer, a copy for strtok_r, and a copy of each field. The user ID is
+// interned like parse_input does, so only the line handling differs.
+static error_t *ref_parse_entry(FILE *fp, char *line, userids *us, entry *e)
+{
+	char userid[MAX_USERID_STRLEN+1];
+	char tline[MAX_LINE+1];
+	error_t *err;
+	char *t, *p;
+	bool added;
+	int i;
+
+	if (!fgets(line, MAX_LINE+1, fp)) {
+		return error(E_EOF);
+	}
+	if (strlen(line) >= MAX_LINE) {
+		return error(E_LONG_LINE);
+	}
+	for (i = strlen(line)-1; i >= 0 && isspace((unsigned char) line[i]); i--) {
+		line[i] = '\0';
+	}
+	strncpy(tline, line, MAX_LINE+1);
+
+	if ((t = strtok_r(tline, ENTRY_DELIMS, &p)) == NULL) {
+		return error(E_TOO_FEW_FIELDS);
+	}
+	if (strlen(t) == 0 || strlen(t) > MAX_USERID_STRLEN) {
+		return error(E_USERID_LONG);
+	}
+	strncpy(userid, t, MAX_USERID_STRLEN+1);
+	e->uid = intern_userid(us, userid, strlen(userid), &added);
+	if ((t = strtok_r(NULL, ENTRY_DELIMS, &p)) == NULL) {
+		return error(E_TOO_FEW_FIELDS);
+	}
+	if ((err = parse_addr(t, &e->addr))) {
+		return err;
+	}
+	if (strtok_r(NULL, ENTRY_DELIMS, &p) != NULL) {
+		return error(E_TOO_MANY_FIELDS);
+	}
+
+	e->classid = 0;
+	e->classified = false;
+
+	return NULL;
+}
+
+// Parses a file with the reference parser, returning the number of entries.
+static unsigned long ref_parse(const char *path)
+{
+	entries *es = new_entries();
+	char line[MAX_LINE+1];
+	unsigned long n;
+	error_t *err;
+	FILE *fp;
+	entry e;
+
+	if ((fp = fopen(path, "r")) == NULL) {
+		perror("input_bench");
+		exit(EXIT_FAILURE);
+	}
+	while (!(err = ref_parse_entry(fp, line, es->us, &e))) {
+		append_entry(es, &e);
+	}
+	if (err->code != E_EOF) {
+		fprintf(stderr, "input_bench: %s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	fclose(fp);
+	n = es->len;
+	free_entries(es);
+
+	return n;
+}
+
+// Parses input with parse_input, returning the number of entries. If stream is
+// true, the file is written to a pipe by a child process and read as stdin.
+static unsigned long parse(const char *path, const unsigned int threads,
+	const bool stream)
+{
+	entries *es = new_entries();
+	unsigned long n;
+	int fds[2] = {0};
+	error_t *err;
+	pid_t pid = 0;
+	input in;
+
+	if (stream) {
+		if (pipe(fds) == -1 || (pid = fork()) == -1) {
+			perror("input_bench");
+			exit(EXIT_FAILURE);
+		}
+		if (pid == 0) {
+			close(fds[0]);
+			dup2(fds[1], STDOUT_FILENO);
+			execlp("cat", "cat", path, NULL);
+			_exit(EXIT_FAILURE);
+		}
+		close(fds[1]);
+		dup2(fds[0], STDIN_FILENO);
+		close(fds[0]);
+		path = "-";
+	}
+	if ((err = open_input(path, &in)) || (err = parse_input(&in, threads, es))) {
+		fprintf(stderr, "input_bench: %s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	close_input(&in);
+	if (stream) {
+		waitpid(pid, NULL, 0);
+	}
+	n = es->len;
+	free_entries(es);
+
+	return n;
+}
+
+// Prints the time and throughput of one parse of size bytes.
+static void report(const char *name, const double t, const unsigned long n,
+	const size_t size)
+{
+	printf("input_bench: %-16s %.3fs, %.1f MB/s, %.2fM lines/s\n", name, t,
+		size / t / 1e6, n / t / 1e6);
+}
+
+// Compares the reference fgets/strtok_r parser with in-place parsing of a
+// mapped file, on one and all cores, and of a stream.
+int main(int argc, char *argv[])
+{
+	unsigned long lines = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_LINES);
+	unsigned int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	char name[32];
+	unsigned long n;
+	const char *path;
+	double start;
+	FILE *fp;
+	long size;
+
+	path = write_input(lines);
+	fp = fopen(path, "r");
+	fseek(fp, 0, SEEK_END);
+	size = ftell(fp);
+	fclose(fp);
+
+	start = mono_time();
+	n = ref_parse(path);
+	report("fgets/strtok_r", mono_time() - start, n, size);
+
+	start = mono_time();
+	n = parse(path, 1, false);
+	report("mmap", mono_time() - start, n, size);
+
+	if (ncpu > 1) {
+		snprintf(name, sizeof(name), "mmap %u threads", ncpu);
+		start = mono_time();
+		n = parse(path, ncpu, false);
+		report(name, mono_time() - start, n, size);
+	}
+
+	start = mono_time();
+	n = parse(path, 1, true);
+	report("stream", mono_time() - start, n, size);
+
+	unlink(path);
+	return (n == lines ? EXIT_SUCCESS : EXIT_FAILURE);
+}
@@ -0,0 +1,102 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "input.h"
+#include "test.h"
+
+#define DEFAULT_LINES 400000
+#define THREADS 4
+#define MAX_DIFFS 20
+
+// Writes n input lines to a new temporary file, about 40% of them
+// comments, in runs of one to eight, and returns the number of entries.
+static unsigned long gen_input(char *path, const unsigned long n)
+{
+	uint64_t r = 0x510e527fade682d1;
+	unsigned long i, k, nents = 0;
+	FILE *fp;
+	int fd;
+
+	if ((fd = mkstemp(path)) == -1 || !(fp = fdopen(fd, "w"))) {
+		perror(path);
+		exit(EXIT_FAILURE);
+	}
+	for (i = 0; i < n; i++) {
+		if (randn(&r, 8) == 0) {
+			for (k = randn(&r, 8); k > 0 && i < n - 1; k--, i++) {
+				fprintf(fp, "# comment %lu\n", i);
+			}
+			fprintf(fp, "#\n");
+			continue;
+		}
+		fprintf(fp, "user%lu,10.%lu.%lu.%lu\n", randn(&r, n / 4),
+			(nents >> 16) & 0xff, (nents >> 8) & 0xff, nents & 0xff);
+		nents++;
+	}
+	fclose(fp);
+
+	return nents;
+}
+
+// Parses the input file with the given number of threads.
+static entries *parse(const char *path, const unsigned int threads)
+{
+	error_t *err;
+	entries *es;
+	input in;
+
+	if ((err = open_input(path, &in))) {
+		fprintf(stderr, "input_test: %s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	es = new_entries();
+	if ((err = parse_input(&in, threads, es))) {
+		fprintf(stderr, "input_test: %s\n", err->message);
+		exit(EXIT_FAILURE);
+	}
+	close_input(&in);
+
+	return es;
+}
+
+// Checks that parsing input with comment lines gives the same entries with
+// one thread and with several, which parse it in chunks.
+int main(int argc, char *argv[])
+{
+	unsigned long n = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_LINES);
+	char path[] = "/tmp/input_test.XXXXXX";
+	unsigned long i, nents, ndiff = 0;
+	entries *es1, *esn;
+	entry *e1, *en;
+
+	nents = gen_input(path, n);
+	es1 = parse(path, 1);
+	esn = parse(path, THREADS);
+	unlink(path);
+
+	if (es1->len != nents || esn->len != nents) {
+		fprintf(stderr, "input_test: %lu entries expected, %lu with 1 thread, "
+			"%lu with %u\n", nents, es1->len, esn->len, THREADS);
+		return EXIT_FAILURE;
+	}
+	for (i = 0; i < nents; i++) {
+		e1 = &es1->arr[i];
+		en = &esn->arr[i];
+		if (cmp_addr(&e1->addr, &en->addr) ||
+			strcmp(entry_userid(es1, e1), entry_userid(esn, en))) {
+			if (ndiff++ < MAX_DIFFS) {
+				fprintf(stderr, "input_test: entry %lu differs with %u threads\n",
+					i, THREADS);
+			}
+		}
+	}
+	printf("input_test: %lu lines, %lu entries, %u threads, %lu differences\n",
+		n, nents, THREADS, ndiff);
+
+	free_entries(esn);
+	free_entries(es1);
+
+	return (ndiff ? EXIT_FAILURE : EXIT_SUCCESS);
+}
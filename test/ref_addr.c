@@ -0,0 +1,87 @@
+#include <stdio.h>
+#include <string.h>
+#include <arpa/inet.h>
+
+#include "ref_addr.h"
+
+#define MAC_DELIM ":"
+#define LAST_MAC_COLON_POS 14
+
+static addr_type detect_addr_type(const char *s)
+{
+	addr_type t = -1;
+	int len;
+	int i;
+
+	len = strlen(s);
+	if (len == MAC_STRLEN) {
+		t = MAC;
+	}
+	for (i = 0; i < len; i++) {
+		if (s[i] == '.') {
+			t = IP4;
+			break;
+		}
+		if (s[i] == ':') {
+			if (t != MAC || i > LAST_MAC_COLON_POS || ((i - 2) % 3 != 0)) {
+				t = IP6;
+				break;
+			}
+		}
+	}
+
+	return t;
+}
+
+// The original also passed a NULL token to sscanf for MACs with empty fields.
+static error_t *parse_mac(const char *s, mac_addr mac)
+{
+	char ts[MAC_STRLEN+1];
+	char *t, *p, *ss;
+	int i, r;
+	char x;
+
+	if (strlen(s) != MAC_STRLEN) {
+		return error(E_INVALID_MAC);
+	}
+	strncpy(ts, s, MAC_STRLEN+1);
+	ss = ts;
+	for (i = 0; i < MAC_LEN; i++, ss = NULL) {
+		if ((t = strtok_r(ss, MAC_DELIM, &p)) == NULL) {
+			return error(E_INVALID_MAC);
+		}
+		r = sscanf(t, "%"SCNx8 "%c", &mac[i], &x);
+		if (r != 1) {
+			return error(E_INVALID_MAC);
+		}
+	}
+	if (strtok_r(NULL, MAC_DELIM, &p)) {
+		return error(E_INVALID_MAC);
+	}
+
+	return NULL;
+}
+
+error_t *ref_parse_addr(const char *s, addr *a)
+{
+	if ((a->type = detect_addr_type(s)) == -1) {
+		return errorf(E_UNKNOWN_ADDR_FORMAT, "%s", s);
+	}
+
+	switch (a->type) {
+	case MAC:
+		return parse_mac(s, a->val.mac);
+	case IP4:
+		if (inet_pton(AF_INET, s, a->val.ip4) == 0) {
+			return errorf(E_INVALID_IP4_ADDR, "%s", s);
+		}
+		return NULL;
+	case IP6:
+		if (inet_pton(AF_INET6, s, a->val.ip6) == 0) {
+			return errorf(E_INVALID_IP6_ADDR, "%s", s);
+		}
+		return NULL;
+	default:
+		return errorf(E_UNKNOWN_ADDR_TYPE, "%d", a->type);
+	}
+}
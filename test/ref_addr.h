@@ -0,0 +1,10 @@
+#ifndef __REF_ADDR_H
+#define __REF_ADDR_H
+
+#include "addr.h"
+
+// Parses an address the way parse_addr did before the single-pass parser:
+// detecting the type with a scan, then sscanf for MACs and inet_pton for IPs.
+error_t *ref_parse_addr(const char *s, addr *a);
+
+#endif
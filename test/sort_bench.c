@@ -0,0 +1,113 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "addr.h"
+#include "log.h"
+#include "radix.h"
+#include "test.h"
+
+#define MIN_ROWS 16
+#define DEFAULT_MAX_ROWS (1 << 20)
+#define ROWS_PER_RUN (1 << 20)
+
+static int klen;
+
+static int cmp_rows(const void *p1, const void *p2)
+{
+	return memcmp(p1, p2, klen);
+}
+
+// Fills n rows of an address key of type t and a 4 byte index, like the rows
+// sorted by sort_col. IPv4 and IPv6 keys share a prefix, as in real networks.
+static void gen_rows(uint8_t *rows, const addr_type t, const unsigned long n)
+{
+	const size_t rlen = addr_len(t) + sizeof(uint32_t);
+	uint64_t r = 0xda942042e4dd58b5;
+	uint8_t *row = rows;
+	uint32_t i, v[4];
+	int j;
+
+	for (i = 0; i < n; i++, row += rlen) {
+		for (j = 0; j < 4; j++) {
+			v[j] = rand64(&r);
+		}
+		memcpy(row, v, addr_len(t));
+		if (t == IP4) {
+			row[0] = 10;
+		} else if (t == IP6) {
+			memcpy(row, "\x20\x01\x0d\xb8", 4);
+		}
+		memcpy(row + addr_len(t), &i, sizeof(uint32_t));
+	}
+}
+
+// Returns the milliseconds to sort n rows, averaged over enough runs to sort
+// ROWS_PER_RUN rows. If threads is 0, qsort is used.
+static double time_sort(const uint8_t *src, uint8_t *rows, uint8_t *tmp,
+	const size_t rlen, const unsigned long n, const unsigned int threads)
+{
+	unsigned long i, runs = (n < ROWS_PER_RUN ? ROWS_PER_RUN / n : 1);
+	double start, t = 0;
+
+	for (i = 0; i < runs; i++) {
+		memcpy(rows, src, n * rlen);
+		start = mono_time();
+		if (threads) {
+			radix_sort(rows, tmp, rlen, klen, n, threads);
+		} else {
+			qsort(rows, n, rlen, cmp_rows);
+		}
+		t += mono_time() - start;
+	}
+
+	return t / runs * 1000;
+}
+
+// Prints the time to sort address rows with qsort and radix_sort, for each
+// address type at sizes from MIN_ROWS up to the given maximum, and the
+// smallest size at which radix_sort was faster.
+int main(int argc, char *argv[])
+{
+	unsigned long max = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_MAX_ROWS);
+	unsigned int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+	const char *names[MAX_ADDR_TYPE] = {"mac", "ip4", "ip6"};
+	uint8_t *src, *rows, *tmp;
+	unsigned long n, cross;
+	double q, r, rt;
+	addr_type t;
+	size_t rlen;
+
+	src = malloc(max * (IP6_LEN + sizeof(uint32_t)));
+	rows = malloc(max * (IP6_LEN + sizeof(uint32_t)));
+	tmp = malloc(max * (IP6_LEN + sizeof(uint32_t)));
+	for (t = 0; t < MAX_ADDR_TYPE; t++) {
+		klen = addr_len(t);
+		rlen = klen + sizeof(uint32_t);
+		gen_rows(src, t, max);
+		cross = 0;
+		for (n = MIN_ROWS; n <= max; n *= 2) {
+			q = time_sort(src, rows, tmp, rlen, n, 0);
+			r = time_sort(src, rows, tmp, rlen, n, 1);
+			printf("sort_bench: %s %8lu rows: qsort %9.3f ms, radix %9.3f ms",
+				names[t], n, q, r);
+			if (ncpu > 1) {
+				rt = time_sort(src, rows, tmp, rlen, n, ncpu);
+				printf(", radix %u threads %9.3f ms", ncpu, rt);
+			}
+			printf("\n");
+			if (r < q && !cross) {
+				cross = n;
+			} else if (r >= q) {
+				cross = 0;
+			}
+		}
+		printf("sort_bench: %s radix faster from %lu rows\n", names[t], cross);
+	}
+	free(src);
+	free(rows);
+	free(tmp);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,156 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bpflib.h"
+#include "log.h"
+#include "sync.h"
+#include "test.h"
+
+#define DEFAULT_ENTRIES 10000000
+#define CLASSIDS 1024
+#define CHURN_PERCENT 1
+
+// Mock BPF directory, removed at exit.
+static char g_dir[] = "/tmp/sync_bench.XXXXXX";
+
+// Removes the mock BPF directory. Registered before the mock backend saves
+// its maps at exit, so it runs after.
+static void remove_dir()
+{
+	char path[sizeof(g_dir) + 256];
+	struct dirent *d;
+	DIR *dir;
+
+	if ((dir = opendir(g_dir))) {
+		while ((d = readdir(dir))) {
+			snprintf(path, sizeof(path), "%s/%s", g_dir, d->d_name);
+			unlink(path);
+		}
+		closedir(dir);
+	}
+	rmdir(g_dir);
+}
+
+// Exits with an error message.
+static void fail(const char *what, const error_t *err)
+{
+	fprintf(stderr, "sync_bench: %s: %s\n", what,
+		(err ? err->message : strerror(errno)));
+	exit(EXIT_FAILURE);
+}
+
+// Sets a to a scattered address for index i, of type i % MAX_ADDR_TYPE.
+// Multiplying by an odd constant is invertible modulo the address size, so
+// the addresses are unique.
+static void gen_addr(const unsigned long i, addr *a)
+{
+	uint64_t r = (i / MAX_ADDR_TYPE + 1) * 0x9e3779b97f4a7c15;
+
+	memset(a, 0, sizeof(*a));
+	a->type = i % MAX_ADDR_TYPE;
+	memcpy(&a->val, &r, sizeof(r));
+	if (a->type == IP6) {
+		rand64(&r);
+		memcpy(a->val.ip6 + sizeof(r), &r, sizeof(r));
+	}
+}
+
+// Returns entries with the addresses for indexes from start to start+n, with
+// classids from their indexes, and changed for every step'th if step is
+// nonzero.
+static entries *gen_entries(const unsigned long start, const unsigned long n,
+	const unsigned long step)
+{
+	entries *es = new_entries();
+	entry e = {0};
+	unsigned long i;
+	bool added;
+
+	reserve_entries(es, n);
+	e.uid = intern_userid(es->us, "user", 4, &added);
+	e.classified = true;
+	for (i = start; i < start + n; i++) {
+		gen_addr(i, &e.addr);
+		e.classid = (i + (step && i % step == 0)) % CLASSIDS;
+		append_entry(es, &e);
+	}
+
+	return es;
+}
+
+// Syncs entries with the maps, whose contents are in bt, and prints the time.
+static void bench_sync(const bpf_handle *hnd, const config *cfg, const char *name,
+	entries *es, addr_table *bt)
+{
+	error_t *err;
+	double start;
+
+	start = mono_time();
+	if ((err = sync_bpf(hnd, cfg, es, bt))) {
+		fail("sync_bpf", err);
+	}
+	printf("sync_bench: %luk entries, %-8s sync, %-15s %7.3fs\n", es->len / 1000,
+		(cfg->parallel_sync ? "parallel" : "serial"), name, mono_time() - start);
+}
+
+// Benchmarks syncs of large tables with the mock BPF backend, given the number
+// of entries, with the mock address maps sized to fit them.
+int main(int argc, char *argv[])
+{
+	unsigned long n = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ENTRIES);
+	unsigned long churn = n * CHURN_PERCENT / 100;
+	char max[32];
+	entries *a, *b;
+	addr_table *bt;
+	bpf_handle hnd;
+	error_t *err;
+	double start;
+	config cfg;
+
+	if (!mkdtemp(g_dir)) {
+		fail(g_dir, NULL);
+	}
+	atexit(remove_dir);
+	setenv(BPF_MOCK_ENV, g_dir, 1);
+	snprintf(max, sizeof(max), "%lu", n / MAX_ADDR_TYPE + 1);
+	setenv(BPF_MOCK_MAX_ELEM_ENV, max, 0);
+
+	init_config(&cfg);
+	cfg.log = LOG_QUIET;
+	if ((err = bpf_open(&hnd))) {
+		fail("bpf_open", err);
+	}
+
+	// b replaces the first CHURN_PERCENT of a's addresses with new ones, and
+	// changes the classids of as many others
+	a = gen_entries(0, n, 0);
+	b = gen_entries(churn, n, (churn ? n / churn : 0));
+	bt = new_addr_table();
+	bench_sync(&hnd, &cfg, "into empty maps", a, bt);
+
+	free_addr_table(bt);
+	bt = new_addr_table();
+	start = mono_time();
+	if ((err = read_bpf_table(&hnd, &cfg, bt))) {
+		fail("read_bpf_table", err);
+	}
+	printf("sync_bench: %luk entries, %-8s read, %-15s %7.3fs\n", n / 1000,
+		"serial", "maps", mono_time() - start);
+
+	bench_sync(&hnd, &cfg, "unchanged", a, bt);
+	bench_sync(&hnd, &cfg, "1% churn", b, bt);
+	cfg.parallel_sync = true;
+	bench_sync(&hnd, &cfg, "unchanged", b, bt);
+	bench_sync(&hnd, &cfg, "1% churn", a, bt);
+
+	free_entries(b);
+	free_entries(a);
+	free_addr_table(bt);
+	bpf_close(&hnd);
+
+	return EXIT_SUCCESS;
+}
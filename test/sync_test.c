@@ -0,0 +1,183 @@
+#include <dirent.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bpf_config.h"
+#include "bpflib.h"
+#include "sync.h"
+#include "test.h"
+
+#define DEFAULT_ADDRS 300000
+#define ROUNDS 4
+#define CLASSIDS 1024
+#define MAX_DIFFS 20
+
+// Mock BPF directory, removed at exit.
+static char g_dir[] = "/tmp/sync_test.XXXXXX";
+
+// Removes the mock BPF directory. Registered before the mock backend saves
+// its maps at exit, so it runs after.
+static void remove_dir()
+{
+	char path[sizeof(g_dir) + 256];
+	struct dirent *d;
+	DIR *dir;
+
+	if ((dir = opendir(g_dir))) {
+		while ((d = readdir(dir))) {
+			snprintf(path, sizeof(path), "%s/%s", g_dir, d->d_name);
+			unlink(path);
+		}
+		closedir(dir);
+	}
+	rmdir(g_dir);
+}
+
+// Exits with an error message.
+static void fail(const char *what, const error_t *err)
+{
+	fprintf(stderr, "sync_test: %s: %s\n", what,
+		(err ? err->message : strerror(errno)));
+	exit(EXIT_FAILURE);
+}
+
+// Sets a to address k, a MAC, IPv4 or IPv6 address from its number.
+static void gen_addr(const unsigned long k, addr *a)
+{
+	uint64_t v = k / MAX_ADDR_TYPE;
+
+	memset(a, 0, sizeof(addr));
+	a->type = k % MAX_ADDR_TYPE;
+	switch (a->type) {
+	case MAC:
+		memcpy(a->val.mac, &v, MAC_LEN);
+		break;
+	case IP4:
+		memcpy(a->val.ip4, &v, IP4_LEN);
+		break;
+	default:
+		a->val.ip6[0] = 0x20;
+		memcpy(a->val.ip6 + IP6_LEN - sizeof(v), &v, sizeof(v));
+		break;
+	}
+}
+
+// Returns a table of about half of n addresses, each with a random classid,
+// and sets classids[k] to the classid of address k, or CLASSIDS if absent.
+static entries *gen_table(uint64_t *r, const unsigned long n, uint16_t *classids)
+{
+	entries *es = new_entries();
+	entry e = {0};
+	unsigned long k;
+	bool added;
+
+	e.uid = intern_userid(es->us, "user", 4, &added);
+	e.classified = true;
+	for (k = 0; k < n; k++) {
+		classids[k] = CLASSIDS;
+		if (randn(r, 2)) {
+			continue;
+		}
+		gen_addr(k, &e.addr);
+		e.classid = classids[k] = randn(r, CLASSIDS);
+		append_entry(es, &e);
+	}
+
+	return es;
+}
+
+// Reads the BPF maps and counts the addresses that differ from classids.
+static unsigned long compare_maps(const bpf_handle *hnd, const config *cfg,
+	const unsigned long n, const uint16_t *classids)
+{
+	unsigned long i, k, len = 0, ndiff = 0;
+	addr_table *t = new_addr_table();
+	uint16_t classid;
+	error_t *err;
+	addr a;
+
+	if ((err = read_bpf_table(hnd, cfg, t))) {
+		fail("read_bpf_table", err);
+	}
+	sort_addr_table(t, 1);
+	for (k = 0; k < n; k++) {
+		gen_addr(k, &a);
+		if (addr_table_find(t, &a, &i)) {
+			classid = t->cols[a.type].classids[i];
+			len++;
+		} else {
+			classid = CLASSIDS;
+		}
+		if (classid != classids[k] && ndiff++ < MAX_DIFFS) {
+			fprintf(stderr, "sync_test: address %lu has classid %u, expected %u\n",
+				k, classid, classids[k]);
+		}
+	}
+	if (len != addr_table_len(t)) {
+		fprintf(stderr, "sync_test: %lu unexpected addresses in maps\n",
+			addr_table_len(t) - len);
+		ndiff += addr_table_len(t) - len;
+	}
+	free_addr_table(t);
+
+	return ndiff;
+}
+
+// Checks that syncing random tables to the mock BPF maps, one after another,
+// leaves the maps with the contents of the last, alternating serial and
+// parallel syncs.
+int main(int argc, char *argv[])
+{
+	unsigned long n = (argc > 1 ? strtoul(argv[1], NULL, 10) : DEFAULT_ADDRS);
+	uint16_t *classids = malloc(n * sizeof(uint16_t));
+	uint64_t r = 0x9b05688c2b3e6c1f;
+	unsigned long d, ndiff = 0;
+	addr_table *bt = NULL;
+	bpf_handle hnd;
+	error_t *err;
+	entries *es;
+	config cfg;
+	int i;
+
+	if (!mkdtemp(g_dir)) {
+		fail(g_dir, NULL);
+	}
+	atexit(remove_dir);
+	setenv(BPF_MOCK_ENV, g_dir, 1);
+
+	init_config(&cfg);
+	cfg.log = LOG_QUIET;
+	if ((err = bpf_open(&hnd))) {
+		fail("bpf_open", err);
+	}
+
+	for (i = 0; i < ROUNDS; i++) {
+		cfg.parallel_sync = (i % 2);
+		es = gen_table(&r, n, classids);
+		// the first round reads the maps, and later ones sync against the
+		// contents the previous one synced, as the daemon does
+		if (!bt) {
+			bt = new_addr_table();
+			if ((err = read_bpf_table(&hnd, &cfg, bt))) {
+				fail("read_bpf_table", err);
+			}
+		}
+		if ((err = sync_bpf(&hnd, &cfg, es, bt))) {
+			fail("sync_bpf", err);
+		}
+		d = compare_maps(&hnd, &cfg, n, classids);
+		printf("sync_test: round %d, %lu entries, %s sync, %lu differences\n",
+			i + 1, es->len, (cfg.parallel_sync ? "parallel" : "serial"), d);
+		ndiff += d;
+		free_entries(es);
+	}
+
+	free_addr_table(bt);
+	bpf_close(&hnd);
+	free(classids);
+
+	return (ndiff ? EXIT_FAILURE : EXIT_SUCCESS);
+}
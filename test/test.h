@@ -0,0 +1,22 @@
+#ifndef __TEST_H
+#define __TEST_H
+
+#include <inttypes.h>
+
+// Returns the next pseudo-random number from a xorshift64 state, so tests and
+// benchmarks see the same inputs on every run.
+static inline uint64_t rand64(uint64_t *s)
+{
+	*s ^= *s << 13;
+	*s ^= *s >> 7;
+	*s ^= *s << 17;
+	return *s;
+}
+
+// Returns a pseudo-random number less than n.
+static inline uint64_t randn(uint64_t *s, const uint64_t n)
+{
+	return rand64(s) % n;
+}
+
+#endif
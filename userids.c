@@ -0,0 +1,160 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "userids.h"
+
+#define INITCAP_USERIDS 64
+#define FNV32_OFFSET 2166136261u
+#define FNV32_PRIME 16777619u
+
+// Returns the 32-bit FNV-1a hash of s.
+static uint32_t hash_userid(const char *s, const size_t len)
+{
+	uint32_t h = FNV32_OFFSET;
+	size_t i;
+
+	for (i = 0; i < len; i++) {
+		h = (h ^ (uint8_t) s[i]) * FNV32_PRIME;
+	}
+
+	return h;
+}
+
+userids *new_userids()
+{
+	userids *u = malloc(sizeof(userids));
+	*u = (const userids){0};
+	return u;
+}
+
+// Returns the slot for a user ID, which is either empty or holds its uid+1.
+static uint32_t *find_slot(const userids *u, const char *s, const size_t len,
+	const uint32_t h)
+{
+	uint32_t mask = u->nslots - 1;
+	uint32_t i, *slot;
+	const char *t;
+
+	for (i = h & mask; ; i = (i + 1) & mask) {
+		slot = &u->slots[i];
+		if (*slot == 0) {
+			return slot;
+		}
+		t = u->strs[*slot - 1];
+		if (u->hashes[*slot - 1] == h && !strncmp(t, s, len) && t[len] == '\0') {
+			return slot;
+		}
+	}
+}
+
+// Doubles the number of hash slots and reinserts all user IDs.
+static void grow_slots(userids *u)
+{
+	uint32_t i, j, mask;
+
+	free(u->slots);
+	u->nslots = (u->nslots ? u->nslots*2 : INITCAP_USERIDS*2);
+	u->slots = calloc(u->nslots, sizeof(uint32_t));
+	mask = u->nslots - 1;
+	for (i = 0; i < u->len; i++) {
+		for (j = u->hashes[i] & mask; u->slots[j]; j = (j + 1) & mask);
+		u->slots[j] = i + 1;
+	}
+}
+
+uint32_t intern_userid(userids *u, const char *s, const size_t len, bool *added)
+{
+	uint32_t h = hash_userid(s, len);
+	uint32_t *slot;
+
+	if ((u->len + 1) * 4 > u->nslots * 3) {
+		grow_slots(u);
+	}
+	slot = find_slot(u, s, len, h);
+	if (*slot) {
+		*added = false;
+		return *slot - 1;
+	}
+
+	if (u->len == u->cap) {
+		u->cap = (u->cap ? u->cap*2 : INITCAP_USERIDS);
+		u->strs = realloc(u->strs, u->cap * sizeof(*u->strs));
+		u->hashes = realloc(u->hashes, u->cap * sizeof(uint32_t));
+	}
+	memcpy(u->strs[u->len], s, len);
+	u->strs[u->len][len] = '\0';
+	u->hashes[u->len] = h;
+	*slot = ++u->len;
+	*added = true;
+
+	return u->len - 1;
+}
+
+bool find_userid(const userids *u, const char *s, const size_t len, uint32_t *uid)
+{
+	uint32_t *slot;
+
+	if (u->nslots == 0) {
+		return false;
+	}
+	if (*(slot = find_slot(u, s, len, hash_userid(s, len))) == 0) {
+		return false;
+	}
+	*uid = *slot - 1;
+
+	return true;
+}
+
+const char *userid_str(const userids *u, const uint32_t uid)
+{
+	return u->strs[uid];
+}
+
+static int cmp_strs(const void *p1, const void *p2)
+{
+	return strcmp(**(char (**)[MAX_USERID_STRLEN+1]) p1,
+		**(char (**)[MAX_USERID_STRLEN+1]) p2);
+}
+
+void order_userids(userids *u, uint32_t *remap)
+{
+	char (**byname)[MAX_USERID_STRLEN+1];
+	char (*strs)[MAX_USERID_STRLEN+1];
+	uint32_t *hashes;
+	uint32_t i, old;
+
+	byname = malloc(u->len * sizeof(*byname));
+	for (i = 0; i < u->len; i++) {
+		byname[i] = &u->strs[i];
+	}
+	qsort(byname, u->len, sizeof(*byname), cmp_strs);
+
+	strs = malloc(u->cap * sizeof(*strs));
+	hashes = malloc(u->cap * sizeof(uint32_t));
+	for (i = 0; i < u->len; i++) {
+		old = byname[i] - u->strs;
+		memcpy(strs[i], u->strs[old], sizeof(*strs));
+		hashes[i] = u->hashes[old];
+		remap[old] = i;
+	}
+	free(u->strs);
+	free(u->hashes);
+	u->strs = strs;
+	u->hashes = hashes;
+
+	// rehash at the same size
+	u->nslots /= 2;
+	grow_slots(u);
+
+	free(byname);
+}
+
+void free_userids(userids *u)
+{
+	if (u) {
+		free(u->slots);
+		free(u->hashes);
+		free(u->strs);
+	}
+	free(u);
+}
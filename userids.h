@@ -0,0 +1,40 @@
+#ifndef __USERIDS_H
+#define __USERIDS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "limits.h"
+
+// Table of interned user IDs, each identified by its index (uid).
+typedef struct {
+	char (*strs)[MAX_USERID_STRLEN+1];
+	uint32_t *hashes;
+	uint32_t len;
+	uint32_t cap;
+	uint32_t *slots;
+	uint32_t nslots;
+} userids;
+
+// Creates a new userids table.
+userids *new_userids();
+
+// Interns a user ID of len chars, returning its uid. *added is set to true if
+// the user ID was not already in the table.
+uint32_t intern_userid(userids *u, const char *s, const size_t len, bool *added);
+
+// Finds the uid for a user ID, returning false if it's not in the table.
+bool find_userid(const userids *u, const char *s, const size_t len, uint32_t *uid);
+
+// Returns the string for a uid.
+const char *userid_str(const userids *u, const uint32_t uid);
+
+// Renumbers uids so that their order matches the order of the user ID
+// strings, setting remap[uid] to the new uid for each old uid.
+void order_userids(userids *u, uint32_t *remap);
+
+// Frees a userids table.
+void free_userids(userids *u);
+
+#endif
@@ -0,0 +1,106 @@
+#include <errno.h>
+#include <libgen.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+
+#include "log.h"
+#include "watch.h"
+
+// Events that show the file is being written.
+#define WATCH_BUSY_EVENTS (IN_CREATE | IN_MODIFY)
+
+// Events that show a write to the file is complete.
+#define WATCH_DONE_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO)
+
+error_t *open_watch(const char *path, watch *w)
+{
+	char *dir, *base;
+	error_t *err;
+
+	*w = (const watch){0};
+	if ((w->fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC)) == -1) {
+		return errorf(E_WATCH_FAIL, "'%s', %s", path, strerror(errno));
+	}
+	w->path = strdup(path);
+	dir = strdup(path);
+	base = strdup(path);
+	w->name = strdup(basename(base));
+	free(base);
+	if (inotify_add_watch(w->fd, dirname(dir),
+		WATCH_BUSY_EVENTS | WATCH_DONE_EVENTS) == -1) {
+		err = errorf(E_WATCH_FAIL, "'%s', %s", path, strerror(errno));
+		free(dir);
+		close_watch(w);
+		return err;
+	}
+	free(dir);
+
+	return NULL;
+}
+
+void close_watch(watch *w)
+{
+	if (w->fd > 0) {
+		close(w->fd);
+	}
+	free(w->path);
+	free(w->name);
+	*w = (const watch){0};
+}
+
+error_t *read_watch(watch *w)
+{
+	char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event *ev;
+	ssize_t n;
+	char *p;
+
+	for (;;) {
+		if ((n = read(w->fd, buf, sizeof(buf))) == -1) {
+			if (errno == EAGAIN) {
+				return NULL;
+			}
+			return errorf(E_WATCH_FAIL, "'%s', %s", w->path, strerror(errno));
+		}
+		for (p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+			ev = (const struct inotify_event *) p;
+			if (ev->mask & IN_Q_OVERFLOW) {
+				w->done = true;
+				w->last = mono_time();
+			} else if (ev->mask & IN_IGNORED) {
+				return errorf(E_WATCH_FAIL, "'%s', directory removed", w->path);
+			} else if (ev->len && !strcmp(ev->name, w->name)) {
+				if (ev->mask & WATCH_DONE_EVENTS) {
+					w->done = true;
+				}
+				w->last = mono_time();
+			}
+		}
+	}
+}
+
+int watch_timeout(const watch *w, const unsigned int debounce_ms,
+	const double not_before)
+{
+	double deadline, now;
+
+	if (!w->done) {
+		return -1;
+	}
+	deadline = w->last + debounce_ms / 1000.0;
+	if (deadline < not_before) {
+		deadline = not_before;
+	}
+	if ((now = mono_time()) >= deadline) {
+		return 0;
+	}
+
+	return (int) ((deadline - now) * 1000) + 1;
+}
+
+void reset_watch(watch *w)
+{
+	w->done = false;
+}
@@ -0,0 +1,38 @@
+#ifndef __WATCH_H
+#define __WATCH_H
+
+#include <stdbool.h>
+
+#include "error.h"
+
+// Watch for changes to a file, using inotify on its directory so that a new
+// file renamed over it is seen as well as writes to it.
+typedef struct {
+	int fd;
+	char *path;
+	char *name;
+	bool done;
+	double last;
+} watch;
+
+// Starts watching the file at path.
+error_t *open_watch(const char *path, watch *w);
+
+// Stops watching the file.
+void close_watch(watch *w);
+
+// Reads the pending events, once the watch fd is readable. A write to the file
+// is done once it's closed after writing, or another file is renamed over it.
+error_t *read_watch(watch *w);
+
+// Returns the milliseconds to wait before syncing the file, if a write to it is
+// done: until there have been no events for the file for debounce_ms, and the
+// monotonic time is at least not_before. Returns 0 if it should be synced now,
+// or -1 if no write is done.
+int watch_timeout(const watch *w, const unsigned int debounce_ms,
+	const double not_before);
+
+// Clears a done write, when the file is synced.
+void reset_watch(watch *w);
+
+#endif